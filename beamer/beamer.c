@@ -2,55 +2,160 @@
  * All Rights Reserved.
  *
  * Example usage:
- *  remote$ beamer 3000 prog &
- *  local$ beamer build prog remote 3000 &
+ *  remote$ beamer 3000 dest &
+ *  local$ beamer build remote 3000 &
  */
 
+#include <arpa/inet.h>
 #include <assert.h>
+#include <dirent.h>
+#include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/epoll.h>
 #include <sys/inotify.h>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "beamer.h"
+#include "delta.h"
+#include "link.h"
+#include "receiver.h"
+#include "stats.h"
+#include "uring.h"
+#include "xxhash.h"
+#include "zstream.h"
+
 #define FMODE_DEFAULT 0755
+#define WAIT_DEFAULT 100
 #define S_(M) S__(M)
 #define S__(M) #M
 
-#define PATH_SEP '/'
-
-#define STR_ISEMPTY(s) (*(s) == 0)
-
-#define STR_ENDSWITH(s, c) \
-    ((strlen(s) > 0) && ((s)[strlen(s) - 1] == (c)))
-
 static const char *usage =
     "Usage:\n"
-    "\tbeamer dir file host port -- transmitter\n"
-    "\tbeamer port file -- receiver\n"
+    "\tbeamer dir host port -- transmit every file under dir\n"
+    "\tbeamer dir file host port -- transmit dir/file only\n"
+    "\t  host may be a comma separated list of host or host:port\n"
+    "\tbeamer port dir -- receiver, recreating files under dir\n"
+    "\n"
+    "transmitter options\n"
+    "\n"
+    " -s or --sync : send every existing file on start\n"
+    " -d or --delta : send only the blocks that changed\n"
+    " -z or --compress : compress file content, backing off on fast links\n"
+    " -j n or --streams n : send files of 64 MiB or more as n ranges over\n"
+    "\tn more connections at once, unless sent with -d\n"
+    " -k or --chunks : send a manifest of content-defined chunks and only\n"
+    "\tthe chunks missing from the receiver's store, before -d and -j\n"
+    " -w msec or --wait msec : send a changed file once it has been quiet\n"
+    "\tthis long, default " S_(WAIT_DEFAULT) "\n"
+    " --cork : hold back partial frames until each file is sent\n"
     "\n"
     "receiver options\n"
     "\n"
-    " -m octal or --mode octal : set the file mode, default " S_(FMODE_DEFAULT) "\n"
+    " -m octal or --mode octal : override the transmitted file mode\n"
+    " -p or --preallocate : reserve each file's space before receiving it\n"
+    " -f or --fsync : flush each file to disk before it replaces the old one\n"
+    " -c dir or --cache dir : keep a store of chunks in dir for -k\n"
+    " -r hosts or --relay hosts : forward every file received to hosts,\n"
+    "\tusing -d, -z, -j and -k as a transmitter would\n"
+    "\n"
+    "common options\n"
+    "\n"
+    " -t or --stats : print a stat line for every transfer and totals on exit\n"
+    " -u or --uring : splice through io_uring where the kernel allows it\n"
+    " --sndbuf bytes, --rcvbuf bytes : socket buffer sizes\n"
+    " --nodelay : disable Nagle's algorithm\n"
     "\n";
 
-static mode_t fmode = FMODE_DEFAULT;
+static struct receiver_opts ropts = { FMODE_DEFAULT, 0, 0, 0, NULL, NULL, 0, 0 };
+static int initial_sync = 0;
+static int delta_mode = 0;
+static int compress_mode = 0;
+static int chunk_mode = 0;
+static int quiet_window = WAIT_DEFAULT;
+
+struct sock_opts sock_opts;
+
+/* Long options without a short form. */
+enum {
+    OPT_SNDBUF = 256,
+    OPT_RCVBUF,
+    OPT_NODELAY,
+    OPT_CORK
+};
 
 static struct option options[] = {
-    { "mode", required_argument, 0, 0 },
+    { "mode", required_argument, 0, 'm' },
+    { "sync", no_argument, 0, 's' },
+    { "delta", no_argument, 0, 'd' },
+    { "compress", no_argument, 0, 'z' },
+    { "preallocate", no_argument, 0, 'p' },
+    { "fsync", no_argument, 0, 'f' },
+    { "relay", required_argument, 0, 'r' },
+    { "wait", required_argument, 0, 'w' },
+    { "streams", required_argument, 0, 'j' },
+    { "stats", no_argument, 0, 't' },
+    { "chunks", no_argument, 0, 'k' },
+    { "cache", required_argument, 0, 'c' },
+    { "uring", no_argument, 0, 'u' },
+    { "sndbuf", required_argument, 0, OPT_SNDBUF },
+    { "rcvbuf", required_argument, 0, OPT_RCVBUF },
+    { "nodelay", no_argument, 0, OPT_NODELAY },
+    { "cork", no_argument, 0, OPT_CORK },
     { 0, 0, 0, 0 }
 };
 
+/* Changed file waiting for quiet_window milliseconds without events. */
+struct pending {
+    char *relpath;
+    uint64_t seen;              /* first event, in now_ns() time */
+    uint64_t due;
+    struct pending *next;
+};
+
+/* Last version of a file queued for sending. */
+struct sent {
+    char *relpath;
+    uint64_t size;
+    struct timespec mtime;
+    int hashed;                 /* hash is known */
+    uint64_t hash;
+    struct sent *next;
+};
+
+#define SENT_BUCKETS 4096
+
+/* Transmitter state: the watched tree, the relative directory path for
+ * each inotify watch descriptor and the changes being coalesced. */
+struct tree {
+    const char *root;
+    const char *filter;
+    int inotify_fd;
+    struct link *links;
+    char **dirs;
+    int ndirs;
+    struct pending *pending;
+    struct sent *sent[SENT_BUCKETS];
+};
+
 void logprint(FILE* out, char prefix, const char *fmt, va_list ap)
 {
     fputc(prefix, out);
@@ -87,7 +192,7 @@ void warn(const char *fmt, ...)
 void info(const char *fmt, ...)
 {
     va_list ap;
-    
+
     va_start(ap, fmt);
     logprint(stdout, 'I', fmt, ap);
     va_end(ap);
@@ -125,12 +230,14 @@ char* join_path(const char *base, const char *ext)
     return joined_path;
 }
 
+/* Create every missing directory leading up to the last component of
+ * path. */
 int create_path(const char *path)
 {
     char *buf;
     const char *slash = path;
     size_t len;
-    int ret;
+    int ret = 0;
 
     buf = malloc(strlen(path) + 1);
     if (buf == NULL) {
@@ -143,7 +250,9 @@ int create_path(const char *path)
         memcpy(buf, path, len);
         buf[len] = 0;
         ret = mkdir(buf, 0777);
-        if (ret != 0) {
+        if (ret != 0 && errno == EEXIST) {
+            ret = 0;
+        } else if (ret != 0) {
             break;
         }
     }
@@ -151,47 +260,73 @@ int create_path(const char *path)
     return ret;
 }
 
-int create_file(const char *path)
+/* Write all of buf, retrying short writes. */
+int write_full(int fd, const void *buf, size_t len)
 {
-    int fd;
-create_file:
-    fd = open(path, O_WRONLY | O_TRUNC | O_CREAT, fmode);
-    if (fd == -1 && (errno == ENOENT || errno == ENOTDIR)) {
-        int err = create_path(path);
-        if (err)
-            return err;
-        goto create_file;
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t ret;
+        ret = write(fd, p, len);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += ret;
+        len -= ret;
     }
-    return fd;
+    return 0;
 }
 
-int open_link(const char *server, const char *port)
+/* Read exactly len bytes. Returns 0 on success, 1 if the peer closed the
+ * connection before the first byte and -1 on error or a truncated read. */
+int read_full(int fd, void *buf, size_t len)
 {
-    int ret, sock;
-    struct addrinfo hints, *res, *rp;
+    char *p = buf;
+    size_t got = 0;
+    while (got < len) {
+        ssize_t ret;
+        ret = read(fd, p + got, len - got);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (ret == 0) {
+            errno = 0;
+            return got == 0 ? 1 : -1;
+        }
+        got += ret;
+    }
+    return 0;
+}
 
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = 0;
+unsigned char *put32(unsigned char *p, uint32_t v)
+{
+    v = htonl(v);
+    memcpy(p, &v, 4);
+    return p + 4;
+}
 
-    ret = getaddrinfo(server, port, &hints, &res);
-    if (ret) {
-        fatal("getaddrinfo error %s", gai_strerror(ret));
-    }
+unsigned char *put64(unsigned char *p, uint64_t v)
+{
+    v = htobe64(v);
+    memcpy(p, &v, 8);
+    return p + 8;
+}
 
-    for (rp = res; rp != NULL; rp = rp->ai_next) {
-        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (sock == -1)
-            continue;
-        ret = connect(sock, rp->ai_addr, rp->ai_addrlen);
-        if (ret == 0)
-            break;
-        close(sock);
-        sock = -1;
-    }
-    freeaddrinfo(res);
-    return sock;
+uint32_t get32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return ntohl(v);
+}
+
+uint64_t get64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return be64toh(v);
 }
 
 int open_server(const char *port)
@@ -212,6 +347,8 @@ int open_server(const char *port)
         sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
         if (sock == -1)
             continue;
+        /* Accepted sockets inherit the buffer sizes. */
+        tune_socket(sock);
         if (bind(sock, rp->ai_addr, rp->ai_addrlen) == 0)
             break;
         close(sock);
@@ -228,7 +365,7 @@ int open_server(const char *port)
         fatal("Could not set SO_REUSEADDR");
     }
 
-    ret = listen(sock, 1);
+    ret = listen(sock, SOMAXCONN);
     if (ret) {
         fatal("listen error port %s\n", port);
     }
@@ -236,220 +373,540 @@ int open_server(const char *port)
     return sock;
 }
 
-int accept_connection(int sock)
+/* Apply sock_opts to sock, before it connects so the buffer sizes set the
+ * window scale. */
+void tune_socket(int sock)
 {
-    struct sockaddr caddr;
-    socklen_t caddrlen = sizeof(caddr);
-    int client;
-    client = accept(sock, &caddr, &caddrlen);
-    if (client == -1) {
-        fatal("error accepting connection");
-    }
-    return client;
+    int on = 1;
+
+    if (sock_opts.sndbuf && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sock_opts.sndbuf,
+                                       sizeof(sock_opts.sndbuf)) == -1)
+        warn("could not set SO_SNDBUF");
+    if (sock_opts.rcvbuf && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &sock_opts.rcvbuf,
+                                       sizeof(sock_opts.rcvbuf)) == -1)
+        warn("could not set SO_RCVBUF");
+    if (sock_opts.nodelay && setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1)
+        warn("could not set TCP_NODELAY");
 }
 
-void txsize(int sock, size_t sz)
+/* With --cork, hold back partial frames on sock, or send them now. */
+void set_cork(int sock, int on)
 {
-    long val;
-    val = htonl(sz);
-    ssize_t ret;
-    ret = send(sock, &val, sizeof(val), 0);
-    if (ret == -1) {
-        fatal("error transmitting size");
-    }
+    if (sock_opts.cork && setsockopt(sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == -1)
+        warn("could not set TCP_CORK");
+}
+
+/* Checksum of a header, with its checksum field zero, and path. */
+uint32_t header_checksum(const unsigned char *buf, size_t len)
+{
+    return (uint32_t)xxh64(buf, len, BEAMER_MAGIC);
 }
 
-int rxsize(int sock, size_t *sz)
+/* Decode and check the fixed part of a header. */
+int decode_header(const unsigned char *buf, struct file_header *hdr)
 {
-    long val;
-    ssize_t ret;
-    ret = recv(sock, &val, sizeof(val), 0);
-    if (ret == sizeof(val)) {
-        val = ntohl(val);
-        *sz = val;
-        return 0;
+    if (get32(buf) != BEAMER_MAGIC) {
+        warn("bad header magic %08x", get32(buf));
+        return -1;
     }
-    return ret;
+    if (get32(buf + 4) != (BEAMER_VERSION << 16 | FILE_HEADER_SIZE)) {
+        warn("unsupported header version %08x", get32(buf + 4));
+        return -1;
+    }
+    hdr->flags = get32(buf + 8);
+    hdr->mode = get32(buf + 12);
+    hdr->size = get64(buf + 16);
+    hdr->path_len = get32(buf + 24);
+    hdr->checksum = get32(buf + 28);
+    if (hdr->path_len > PATH_MAX) {
+        warn("path too long %u", hdr->path_len);
+        return -1;
+    }
+    return 0;
 }
 
-void write_file(int sock, size_t sz, const char *path)
+/* Pipe for splicing from the socket, enlarged so each splice moves more
+ * than the default 64 KiB. */
+void open_pipe(int piping[2])
 {
-    int piping[2];
     if (pipe(piping) < 0) {
         fatal("pipe");
     }
+    fcntl(piping[1], F_SETPIPE_SZ, PIPE_SIZE);
+}
 
-    int fd;
-    fd = create_file(path);
-    if (fd == -1) {
-        warn("error creating file %s", path);
-        goto cleanup_pipes;
+int send_zeros(int sock, uint64_t sz)
+{
+    static const char zeros[4096];
+    while (sz > 0) {
+        size_t n = sz < sizeof(zeros) ? sz : sizeof(zeros);
+        if (write_full(sock, zeros, n) == -1)
+            return -1;
+        sz -= n;
     }
+    return 0;
+}
 
-    ssize_t ret;
-    size_t recvd;
-    recvd = 0;
-    while (recvd < sz) {
-        ret = splice(sock, NULL, piping[1], NULL, sz - recvd,
-                 SPLICE_F_MOVE|SPLICE_F_MORE);
-        if (ret == -1) {
-            warn("error receiving data");
-            goto cleanup_file;
+/* Splice pairs, file to pipe and pipe to socket, per submission. */
+#define TX_RING_PAIRS 8
+
+/* Ring and pipe a transmitting thread splices through with -u. */
+struct tx_ring {
+    struct uring r;
+    int piping[2];
+    unsigned chunk;             /* pipe capacity */
+};
+
+static pthread_key_t tx_ring_key;
+static pthread_once_t tx_ring_once = PTHREAD_ONCE_INIT;
+static __thread struct tx_ring *tx_ring;
+static __thread int tx_ring_failed;
+
+void free_tx_ring(void *arg)
+{
+    struct tx_ring *t = arg;
+    uring_close(&t->r);
+    close(t->piping[0]);
+    close(t->piping[1]);
+    free(t);
+}
+
+void make_tx_ring_key(void)
+{
+    pthread_key_create(&tx_ring_key, free_tx_ring);
+}
+
+/* The calling thread's ring, or NULL to use sendfile(). */
+struct tx_ring *get_tx_ring(void)
+{
+    struct tx_ring *t;
+    int size;
+
+    if (tx_ring || tx_ring_failed || !uring_enabled)
+        return tx_ring;
+    t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        fatal("memory error");
+    }
+    if (uring_open(&t->r, 2 * TX_RING_PAIRS) == -1) {
+        warn("io_uring unavailable, using sendfile");
+        free(t);
+        tx_ring_failed = 1;
+        return NULL;
+    }
+    open_pipe(t->piping);
+    size = fcntl(t->piping[1], F_GETPIPE_SZ);
+    t->chunk = size > 0 ? size : 65536;
+    pthread_once(&tx_ring_once, make_tx_ring_key);
+    pthread_setspecific(tx_ring_key, t);
+    tx_ring = t;
+    return t;
+}
+
+/* send_range() through io_uring: chains of linked splices from the file
+ * into the thread's pipe and on to the socket, TX_RING_PAIRS chunks per
+ * system call. A short splice ends the chain early; what it left in the
+ * pipe is flushed before the next chain. */
+int uring_send_range(struct tx_ring *t, int sock, int fd, uint64_t off, uint64_t len,
+                     const char *path)
+{
+    uint64_t pos = off, end = off + len;
+
+    while (pos < end) {
+        uint64_t q = pos, in = 0, out = 0, tag;
+        unsigned ops = 0;
+        int res, retry = 0, err = 0;
+
+        while (q < end && ops < 2 * TX_RING_PAIRS) {
+            unsigned n = end - q < t->chunk ? end - q : t->chunk;
+            int last = q + n == end || ops + 2 == 2 * TX_RING_PAIRS;
+            uring_splice(&t->r, fd, q, t->piping[1], -1, n, SPLICE_F_MOVE, URING_LINK, n);
+            uring_splice(&t->r, t->piping[0], -1, sock, -1, n, SPLICE_F_MOVE|SPLICE_F_MORE,
+                         last ? 0 : URING_LINK, (uint64_t)1 << 32 | n);
+            q += n;
+            ops += 2;
+        }
+        stats_wait_writable(sock);
+        if (uring_submit(&t->r, ops) == -1) {
+            fatal("io_uring_enter");
+        }
+        while (uring_reap(&t->r, &tag, &res) == 0) {
+            if (res == -ECANCELED)
+                continue;
+            if (URING_INTERRUPTED(res)) {
+                retry = 1;
+                continue;
+            }
+            if (res < 0) {
+                err = -res;
+                continue;
+            }
+            if (stats_current) {
+                stats_current->calls++;
+                if ((unsigned)res < (uint32_t)tag)
+                    stats_current->short_calls++;
+            }
+            if (tag >> 32)
+                out += res;
+            else
+                in += res;
+        }
+        for (; out < in && !err; out += res) {
+            res = splice(t->piping[0], NULL, sock, NULL, in - out, SPLICE_F_MOVE);
+            if (res <= 0)
+                err = res < 0 ? errno : EPIPE;
         }
+        if (err) {
+            /* Whatever is left in the pipe belongs to no stream now. */
+            close(t->piping[0]);
+            close(t->piping[1]);
+            open_pipe(t->piping);
+            errno = err;
+            return -1;
+        }
+        if (in == 0 && !retry) {
+            warn("%s shrank during transfer", path);
+            return send_zeros(sock, end - pos) ? -1 : 1;
+        }
+        pos += in;
+    }
+    return 0;
+}
 
-        ret = splice(piping[0], NULL, fd, NULL, ret,
-                 SPLICE_F_MOVE|SPLICE_F_MORE);
-        if (ret == -1) {
-            warn("error writing file %s", path);
-            goto cleanup_file;
+/* Send len bytes of fd from off. If the file shrank the rest is zero
+ * filled to keep the stream in step and 1 is returned; the write that
+ * truncated it triggers another transfer. Returns -1 with errno set if
+ * the socket or the file fails, leaving the stream unusable. */
+int send_range(int sock, int fd, uint64_t off, uint64_t len, const char *path)
+{
+    struct tx_ring *t = get_tx_ring();
+    if (t)
+        return uring_send_range(t, sock, fd, off, len, path);
+
+    off_t pos = off;
+    uint64_t end = off + len;
+    while ((uint64_t)pos < end) {
+        ssize_t sent;
+        stats_wait_writable(sock);
+        sent = sendfile(sock, fd, &pos, end - pos);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0)
+            return -1;
+        if (stats_current) {
+            stats_current->calls++;
+            if ((uint64_t)sent < end - (pos - sent))
+                stats_current->short_calls++;
+        }
+        if (sent == 0) {
+            warn("%s shrank during transfer", path);
+            return send_zeros(sock, end - pos) ? -1 : 1;
         }
-        recvd += ret;
     }
-    printf("received %zu bytes written to %s\n", sz, path);
+    return 0;
+}
 
-    ret = chmod(path, fmode);
-    if (ret == -1)
-        warn("error writing file mode %o\n", fmode);
+uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-cleanup_file:
-    close(fd);
-cleanup_pipes:
-    close(piping[0]);
-    close(piping[1]);
+/* Content hash of fd as sent with HDR_HASH: XXH64 of each HASH_PIECE,
+ * seeded with the hash of the pieces before it. The file is read rather
+ * than mapped since it may be truncated meanwhile. */
+int hash_fd(int fd, uint64_t *hash)
+{
+    *hash = 0;
+    return hash_pieces(fd, 0, UINT64_MAX, hash);
 }
 
-void backup_file(const char *path)
+/* Carry on a hash_fd() from off, a multiple of HASH_PIECE, with *hash
+ * that of the pieces before it, up to end or the end of the file. */
+int hash_pieces(int fd, uint64_t off, uint64_t end, uint64_t *hash)
 {
-    size_t len = strlen(path) + 5;
-    char *bakpath;
-    bakpath = alloca(len + 1);
-    *bakpath = 0;
-    strncpy(bakpath, path, len);
-    strncat(bakpath, ".prev", len);
-    int ret;
-    ret = rename(path, bakpath);
-    if (ret != 0) {
-        info("rename %s %s", path, bakpath);
+    static __thread unsigned char *buf;
+    uint64_t h = *hash;
+
+    if (buf == NULL && (buf = malloc(HASH_PIECE)) == NULL) {
+        fatal("memory error");
+    }
+    while (off < end) {
+        size_t want = end - off < HASH_PIECE ? end - off : HASH_PIECE, got = 0;
+        while (got < want) {
+            ssize_t n = pread(fd, buf + got, want - got, off + got);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1)
+                return -1;
+            if (n == 0)
+                break;
+            got += n;
+        }
+        if (got == 0)
+            break;
+        h = xxh64(buf, got, h);
+        off += got;
+        if (got < want)
+            break;
     }
+    *hash = h;
+    return 0;
 }
 
-void file_transfer_loop(int sock, char *path, int epfd)
+/* Hash the whole pieces of h's file below pos, or the rest of the file
+ * once pos reaches its size. The content just sent is read back from the
+ * page cache. */
+void hash_upto(struct tx_hash *h, uint64_t pos)
 {
-    struct epoll_event events[1];
-    for (;;) {
-        int nfds;
-        nfds = epoll_wait(epfd, events, 1, -1);
-        if (nfds == -1) {
-            warn("epoll_wait");
-        }
+    uint64_t end = pos < h->size ? pos / HASH_PIECE * HASH_PIECE : h->size;
 
-        size_t sz;
-        sz = 0;
-        int ret;
-        ret = rxsize(sock, &sz);
-        if (ret != 0) {
-            warn("error reading file size");
-        } else if (sz == 0) {
-            puts("zero file size - client disconnect");
-            return;
-        } else {
-            printf("start receiving file %zu bytes\n", sz);
-            backup_file(path);
-            write_file(sock, sz, path);
+    if (end <= h->off || h->err)
+        return;
+    if (hash_pieces(h->fd, h->off, end, &h->hash) != 0)
+        h->err = 1;
+    h->off = end;
+}
+
+int hash_file(const char *path, uint64_t *hash)
+{
+    int fd, ret;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    ret = hash_fd(fd, hash);
+    close(fd);
+    return ret;
+}
+
+struct sent **find_sent(struct tree *t, const char *relpath)
+{
+    struct sent **s = &t->sent[xxh64(relpath, strlen(relpath), 0) % SENT_BUCKETS];
+    while (*s && strcmp((*s)->relpath, relpath) != 0)
+        s = &(*s)->next;
+    return s;
+}
+
+/* Queue relpath on every link unless its size and mtime, or failing that
+ * its content, match the version queued last. Only a file whose size is
+ * unchanged is read here; the links hash the rest as they send them. seen
+ * is when the change was first noticed. */
+void queue_file(struct tree *t, const char *relpath, uint64_t seen)
+{
+    struct stat info;
+    struct sent **sp, *s;
+    uint64_t hash = 0;
+    int hashed = 0;
+    char *path;
+
+    if (t->filter && strcmp(t->filter, relpath) != 0)
+        return;
+    path = join_path(t->root, relpath);
+    if (stat(path, &info) != 0 || !S_ISREG(info.st_mode))
+        goto cleanup_path;
+    sp = find_sent(t, relpath);
+    s = *sp;
+    if (s && s->size == (uint64_t)info.st_size) {
+        if (s->mtime.tv_sec == info.st_mtim.tv_sec && s->mtime.tv_nsec == info.st_mtim.tv_nsec)
+            goto cleanup_path;
+        if (hash_file(path, &hash) != 0) {
+            warn("error reading %s", path);
+            goto cleanup_path;
         }
+        hashed = 1;
+        if (s->hashed && s->hash == hash) {
+            s->mtime = info.st_mtim;
+            printf("skipping %s, content unchanged\n", relpath);
+            goto cleanup_path;
+        }
+    }
+    if (s == NULL) {
+        s = calloc(1, sizeof(*s));
+        if (s == NULL || (s->relpath = strdup(relpath)) == NULL) {
+            fatal("memory error");
+        }
+        *sp = s;
     }
+    s->size = info.st_size;
+    s->mtime = info.st_mtim;
+    s->hashed = hashed;
+    s->hash = hash;
+    links_queue(t->links, relpath, seen);
+
+cleanup_path:
+    free(path);
 }
 
-void receive(char **args)
+/* Note an event for relpath, restarting its quiet window. */
+void note_change(struct tree *t, const char *relpath)
 {
-    int sock;
-    sock = open_server(args[0]);
+    struct pending **p;
 
-    int epfd;
-    epfd = epoll_create(1);
-    if (epfd == -1) {
-        fatal("epoll_create");
+    for (p = &t->pending; *p != NULL; p = &(*p)->next) {
+        if (strcmp((*p)->relpath, relpath) == 0)
+            break;
     }
+    if (*p == NULL) {
+        *p = calloc(1, sizeof(**p));
+        if (*p == NULL || ((*p)->relpath = strdup(relpath)) == NULL) {
+            fatal("memory error");
+        }
+        (*p)->seen = now_ns();
+    }
+    (*p)->due = now_ms() + quiet_window;
+}
 
-    for (;;) {
-        int client;
-        client = accept_connection(sock);
-        if (client == -1)
+/* Queue the files whose quiet window has passed and return the
+ * milliseconds until the next one does, or -1 if none is pending. */
+int flush_pending(struct tree *t)
+{
+    uint64_t now = now_ms();
+    struct pending **p = &t->pending;
+    int timeout = -1;
+
+    while (*p != NULL) {
+        struct pending *e = *p;
+        if (e->due <= now) {
+            *p = e->next;
+            queue_file(t, e->relpath, e->seen);
+            free(e->relpath);
+            free(e);
             continue;
-        else
-            puts("transmitter connected");
+        }
+        if (timeout == -1 || e->due - now < (uint64_t)timeout)
+            timeout = e->due - now;
+        p = &e->next;
+    }
+    return timeout;
+}
 
-        struct epoll_event ev;
-        memset(&ev, 0, sizeof(ev));
-        ev.events = EPOLLIN|EPOLLHUP|EPOLLRDHUP;
-        ev.data.fd = client;
+#define WATCH_MASK (IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE|IN_ONLYDIR)
 
-        int ret;
-        ret = epoll_ctl(epfd, EPOLL_CTL_ADD, client, &ev);
-        if (ret == -1) {
-            fatal("epoll_ctl: server sock");
+/* Watch the directory relpath and everything below it. When send is set
+ * the directories and files found are transmitted, which covers files
+ * written to a new directory before its watch was added. */
+void add_tree(struct tree *t, const char *relpath, int send)
+{
+    char *path = STR_ISEMPTY(relpath) ? strdup(t->root) : join_path(t->root, relpath);
+    int wd;
+
+    wd = inotify_add_watch(t->inotify_fd, path, WATCH_MASK);
+    if (wd == -1) {
+        warn("inotify_add_watch %s", path);
+        goto cleanup_path;
+    }
+    if (wd >= t->ndirs) {
+        int n = wd * 2 + 16;
+        t->dirs = realloc(t->dirs, n * sizeof(*t->dirs));
+        if (t->dirs == NULL) {
+            fatal("memory error");
         }
+        memset(t->dirs + t->ndirs, 0, (n - t->ndirs) * sizeof(*t->dirs));
+        t->ndirs = n;
+    }
+    free(t->dirs[wd]);
+    t->dirs[wd] = strdup(relpath);
 
-        file_transfer_loop(client, args[1], epfd);
-        close(client);
+    if (send && !STR_ISEMPTY(relpath) && !t->filter)
+        links_queue(t->links, relpath, now_ns());
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        warn("opendir %s", path);
+        goto cleanup_path;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        char *child = join_path(relpath, ent->d_name);
+        unsigned char type = ent->d_type;
+        if (type == DT_UNKNOWN) {
+            char *full = join_path(t->root, child);
+            struct stat info;
+            if (lstat(full, &info) == 0)
+                type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+            free(full);
+        }
+        if (type == DT_DIR)
+            add_tree(t, child, send);
+        else if (type == DT_REG && send)
+            queue_file(t, child, now_ns());
+        free(child);
     }
-    close(sock);
+    closedir(dir);
+
+cleanup_path:
+    free(path);
 }
 
-void send_file(int sock, const char *path)
+void handle_event(struct tree *t, const struct inotify_event *ev)
 {
-    struct stat info;
-    int ret;
-    ret = lstat(path, &info);
-    if (ret == -1) {
-        fatal("lstat %s", path);
+    if (ev->mask & IN_Q_OVERFLOW) {
+        warn("inotify queue overflow, events lost");
+        return;
     }
-    int fd = open(path, O_RDONLY);
-    if (ret == -1) {
-        fatal("open %s", path);
+    if (ev->wd < 0 || ev->wd >= t->ndirs || t->dirs[ev->wd] == NULL)
+        return;
+    if (ev->mask & IN_IGNORED) {
+        free(t->dirs[ev->wd]);
+        t->dirs[ev->wd] = NULL;
+        return;
     }
-    if (info.st_size > 0) {
-        ssize_t sent;
-        txsize(sock, info.st_size);
-        sent = sendfile(sock, fd, NULL, info.st_size);
-        if (sent < 0) {
-            fatal("sendfile %s", path);
-        }
+    if (ev->len == 0)
+        return;
+
+    char *relpath = join_path(t->dirs[ev->wd], ev->name);
+    if (ev->mask & IN_ISDIR) {
+        if (ev->mask & (IN_CREATE|IN_MOVED_TO))
+            add_tree(t, relpath, 1);
+    } else if (ev->mask & (IN_CLOSE_WRITE|IN_MOVED_TO)) {
+        note_change(t, relpath);
     }
-    close(fd);
-    printf("transmitting %s %zu\n", path, info.st_size);
+    free(relpath);
 }
 
-void start_transmitter(char **args)
+void start_transmitter(const char *root, const char *filter, const char *hosts, const char *port)
 {
-    int inotify_fd, watch_fd, sock;
-    char *path;
+    struct tree t;
 
-    inotify_fd = inotify_init();
-    if (inotify_fd == -1) {
+    memset(&t, 0, sizeof(t));
+    t.root = root;
+    t.filter = filter;
+    t.inotify_fd = inotify_init();
+    if (t.inotify_fd == -1) {
         fatal("inotify_init");
     }
 
-    watch_fd = inotify_add_watch(inotify_fd, args[0], IN_CLOSE_WRITE);
-    if (watch_fd == -1) {
-        fatal("inotify_add_watch");
-    }
-
-    sock = open_link(args[2], args[3]);
-    if (sock == -1) {
-        fatal("failed to connect to receiver");
-    }
-    puts("connected to receiver");
+    t.links = links_open(hosts, port, root, ropts.relay_features, ropts.relay_streams);
 
-    path = join_path(args[0], args[1]);
-    printf("File to update: %s\n", path);
+    if (filter)
+        printf("File to update: %s%c%s\n", root, PATH_SEP, filter);
+    else
+        printf("Tree to update: %s\n", root);
+    add_tree(&t, "", initial_sync);
 
-#define INOTIFY_EVBUF_SIZE 50
-    char evbuf[(sizeof(struct inotify_event) + 16) * INOTIFY_EVBUF_SIZE];
+    char evbuf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
     for (;;) {
+        struct pollfd pfd[2] = { { t.inotify_fd, POLLIN, 0 }, { stats_fd, POLLIN, 0 } };
         ssize_t len;
-        len = read(inotify_fd, evbuf, sizeof(evbuf));
+        int ret;
+        ret = poll(pfd, stats_fd == -1 ? 1 : 2, flush_pending(&t));
+        if (ret == 0 || (ret == -1 && errno == EINTR))
+            continue;
+        if (ret == -1) {
+            fatal("poll");
+        }
+        if (pfd[1].revents)
+            stats_exit();
+        if (!pfd[0].revents)
+            continue;
+        len = read(t.inotify_fd, evbuf, sizeof(evbuf));
         if (len < 0) {
+            if (errno == EINTR)
+                continue;
             fatal("inotify error");
         }
         ssize_t proc;
@@ -457,16 +914,10 @@ void start_transmitter(char **args)
         while (proc < len) {
             struct inotify_event *ev;
             ev = (struct inotify_event *)&evbuf[proc];
-            if ((ev->mask & ~(IN_DELETE|IN_DELETE_SELF)) &&
-                ev->len && 
-                strcmp(args[1], ev->name) == 0)
-                send_file(sock, path);
+            handle_event(&t, ev);
             proc += ev->len + sizeof(*ev);
         }
     }
-
-    free(path);
-    close(sock);
 }
 
 void parse_fmode(const char *mode)
@@ -476,14 +927,15 @@ void parse_fmode(const char *mode)
     if (*end != 0) {
         fatal("invalid file mode %s", optarg);
     }
-    fmode = (mode_t)val;
+    ropts.mode = (mode_t)val;
+    ropts.mode_override = 1;
 }
 
 int parse_options(int argc, char **argv)
 {
     for (;;) {
         int c, option_index;
-        c = getopt_long(argc, argv, "hm:", options, &option_index);
+        c = getopt_long(argc, argv, "c:dfhj:km:pr:stuzw:", options, &option_index);
         if (c == -1)
             break;
         switch (c) {
@@ -494,6 +946,57 @@ int parse_options(int argc, char **argv)
         case 'm':
             parse_fmode(optarg);
             break;
+        case 's':
+            initial_sync = 1;
+            break;
+        case 'd':
+            delta_mode = 1;
+            break;
+        case 'z':
+            compress_mode = 1;
+            break;
+        case 'p':
+            ropts.preallocate = 1;
+            break;
+        case 'f':
+            ropts.fsync = 1;
+            break;
+        case 'r':
+            ropts.relay = optarg;
+            break;
+        case 'w':
+            quiet_window = atoi(optarg);
+            break;
+        case 't':
+            stats_enabled = 1;
+            break;
+        case 'k':
+            chunk_mode = 1;
+            break;
+        case 'c':
+            ropts.cache = optarg;
+            break;
+        case 'u':
+            uring_enabled = 1;
+            break;
+        case OPT_SNDBUF:
+            sock_opts.sndbuf = atoi(optarg);
+            break;
+        case OPT_RCVBUF:
+            sock_opts.rcvbuf = atoi(optarg);
+            break;
+        case OPT_NODELAY:
+            sock_opts.nodelay = 1;
+            break;
+        case OPT_CORK:
+            sock_opts.cork = 1;
+            break;
+        case 'j':
+            ropts.relay_streams = atoi(optarg);
+            if (ropts.relay_streams < 0 || ropts.relay_streams > MAX_STRIPES) {
+                fatal("streams must be between 0 and %d", MAX_STRIPES);
+            }
+            break;
         default:
             puts(usage);
             exit(EXIT_FAILURE);
@@ -505,11 +1008,22 @@ int parse_options(int argc, char **argv)
 int main(int argc, char **argv)
 {
     int argcnt;
+    char **args;
     argcnt = parse_options(argc, argv);
+    args = argv + optind;
+    signal(SIGPIPE, SIG_IGN);
+    stats_fd = stats_signals();
+    /* Stat lines are read by tools as they happen. */
+    if (stats_enabled)
+        setvbuf(stdout, NULL, _IOLBF, 0);
+    ropts.relay_features = (delta_mode ? LINK_DELTA : 0) | (compress_mode ? LINK_COMPRESS : 0) |
+                           (chunk_mode ? LINK_CHUNKS : 0);
     if (argcnt == 2)
-        receive(argv + optind);
+        receive(args[0], args[1], &ropts);
+    else if (argcnt == 3)
+        start_transmitter(args[0], NULL, args[1], args[2]);
     else if (argcnt == 4)
-        start_transmitter(argv + optind);
+        start_transmitter(args[0], args[1], args[2], args[3]);
     else
         puts(usage);
     return 0;
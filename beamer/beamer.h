@@ -0,0 +1,152 @@
+#ifndef BEAMER_H
+#define BEAMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Protocol and helpers shared by the beamer modules, defined in beamer.c. */
+
+#define PATH_SEP '/'
+
+#define STR_ISEMPTY(s) (*(s) == 0)
+
+#define STR_ENDSWITH(s, c) \
+    ((strlen(s) > 0) && ((s)[strlen(s) - 1] == (c)))
+
+/* A connection starts with the transmitter sending HELLO_SIZE bytes: the
+ * magic number, protocol version and the features it wants. The receiver
+ * replies the same way with the features it accepts, or closes the
+ * connection if the version differs.
+ *
+ * Each file or directory is then sent as a FILE_HEADER_SIZE byte header,
+ * the relative path and, for regular files, size bytes of content. All
+ * fields are in network byte order:
+ *
+ *   0  magic        4  version, header size   8  flags
+ *  12  mode        16  size (64 bit)         24  path length
+ *  28  checksum, the low 32 bits of XXH64 over the header with this
+ *      field zero followed by the path
+ *
+ * A header that fails any check ends the connection rather than
+ * guessing where the next one starts.
+ *
+ * With HDR_DELTA the receiver answers with the block signatures of its
+ * copy (SIGS_HEADER_SIZE bytes then a SIG_SIZE record per block) and the
+ * content is replaced by DELTA_REC_SIZE byte records: 'C' copies blocks
+ * from the old copy, 'D' is followed by literal bytes and 'E' ends the
+ * file.
+ *
+ * With HDR_LZ file content, and the literal bytes of a delta, use the
+ * compressed encoding of zstream.h.
+ *
+ * With HDR_STRIPED the content is replaced by STRIPE_INFO_SIZE bytes, a
+ * 64 bit transfer id and the number of ranges, and the ranges arrive on
+ * other connections from the same transmitter. Each is sent with
+ * HDR_RANGE, size being the range length, followed by STRIPE_INFO_SIZE
+ * bytes holding the transfer id and the range's offset in the file, then
+ * its content.
+ *
+ * With HDR_CHUNKED the content is replaced by a manifest: the 32 bit
+ * number of chunks then a CHUNK_REC_SIZE record per chunk, its id and
+ * length (see chunk.h). The receiver answers with a bitmap, a bit per
+ * chunk from the low bit of the first byte, set for chunks missing from
+ * its store. The missing chunks follow as content, each run of
+ * consecutive ones as one body of their combined length.
+ *
+ * With HDR_HASH the content, in whichever form, is followed by HASH_SIZE
+ * bytes holding the hash of the file: XXH64 of each HASH_PIECE bytes
+ * seeded with the hash of the pieces before it, starting from zero. For a
+ * striped file they follow the stripe information once every range has
+ * been sent. The transmitter hashes the file as it sends it, so the hash
+ * comes last. Once it has the whole file the receiver answers ACK_KEPT,
+ * or ACK_RETRY if the content does not match and should be sent again.
+ * Answers are not waited for; the transmitter reads them as they come. */
+struct file_header {
+    uint32_t flags;
+    uint32_t mode;
+    uint64_t size;
+    uint32_t path_len;
+    uint32_t checksum;
+};
+
+#define BEAMER_VERSION 1
+#define FILE_HEADER_SIZE 32
+#define HDR_DELTA 0x1
+#define HDR_LZ 0x2
+#define HDR_STRIPED 0x4
+#define HDR_RANGE 0x8
+#define HDR_CHUNKED 0x10
+#define HDR_HASH 0x20
+
+#define BEAMER_MAGIC 0x4245414d
+#define HELLO_SIZE 12
+#define FEATURE_LZ 0x1
+#define FEATURE_STRIPE 0x2
+#define FEATURE_CHUNKS 0x4
+#define FEATURE_HASH 0x8
+
+#define STRIPE_INFO_SIZE 16
+#define MAX_STRIPES 64
+
+#define SIGS_HEADER_SIZE 16
+#define SIG_SIZE 12
+#define DELTA_REC_SIZE 17
+
+#define CHUNK_REC_SIZE 20
+
+#define HASH_SIZE 8
+#define HASH_PIECE (1024 * 1024)
+#define ACK_KEPT 'A'
+#define ACK_RETRY 'R'
+
+#define PIPE_SIZE (1024 * 1024)
+
+/* Socket tuning from the command line. Zero leaves the system default. */
+struct sock_opts {
+    int sndbuf;
+    int rcvbuf;
+    int nodelay;
+    int cork;                   /* hold partial frames until a file ends */
+};
+
+extern struct sock_opts sock_opts;
+
+void fatal(const char *fmt, ...);
+void warn(const char *fmt, ...);
+void info(const char *fmt, ...);
+
+int write_full(int fd, const void *buf, size_t len);
+int read_full(int fd, void *buf, size_t len);
+
+unsigned char *put32(unsigned char *p, uint32_t v);
+unsigned char *put64(unsigned char *p, uint64_t v);
+uint32_t get32(const unsigned char *p);
+uint64_t get64(const unsigned char *p);
+
+char* join_path(const char *base, const char *ext);
+int create_path(const char *path);
+int open_server(const char *port);
+void tune_socket(int sock);
+void set_cork(int sock, int on);
+
+uint32_t header_checksum(const unsigned char *buf, size_t len);
+int decode_header(const unsigned char *buf, struct file_header *hdr);
+
+/* Hash of a file being sent, carried on piece by piece behind the content
+ * going out. off is how far it has got. */
+struct tx_hash {
+    int fd;
+    uint64_t size;
+    uint64_t off;
+    uint64_t hash;
+    int err;
+};
+
+int send_range(int sock, int fd, uint64_t off, uint64_t len, const char *path);
+int hash_fd(int fd, uint64_t *hash);
+int hash_pieces(int fd, uint64_t off, uint64_t end, uint64_t *hash);
+void hash_upto(struct tx_hash *h, uint64_t pos);
+void open_pipe(int piping[2]);
+
+#endif
@@ -0,0 +1,691 @@
+/* Loopback benchmark for beamer's transfer paths.
+ *
+ * For every mode and size asked for, starts a receiver and a transmitter
+ * on 127.0.0.1, sends one generated file and prints a line per run:
+ *
+ *   bench mode=plain size=67108864 ok=1 wait_ms=0.4 ms=48.1 MBps=1330.4
+ *       tx_cpu_ms=61.0 rx_cpu_ms=40.2 calls_per_MB=1.1 rw_per_MB=3.2
+ *
+ * wait_ms is the transmitter's time from queueing the file to sending its
+ * first byte, and ms and MBps the receiver's time from the header arriving
+ * to the file being renamed into place, so wait_ms plus ms is roughly the
+ * latency from the change to the new copy. calls_per_MB counts the
+ * sendfile and splice calls of both ends from their -t stat lines, and
+ * rw_per_MB the read and write class system calls counted in
+ * /proc/pid/io. CPU times are for the whole processes, including start up.
+ *
+ * With -x every connection goes through a proxy that forwards pieces of
+ * random length, from a single byte, so the receiver sees short reads and
+ * the transmitter, held back by the proxy, short writes. Every run checks
+ * the received copy and the exit status is non-zero if any differs.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Largest piece the -x proxy forwards at once. */
+#define PIECE_MAX 4096
+
+/* Give up on a run that has printed nothing for this long. */
+#define IDLE_TIMEOUT_MS 30000
+
+#define BUF_SIZE (1024 * 1024)
+#define MB (1024.0 * 1024.0)
+
+/* A way of sending a file and the options each end needs for it. "store"
+ * stands for the run's chunk store directory. */
+struct mode {
+    const char *name;
+    const char *tx[3];
+    const char *rx[3];
+    int delta;                  /* the receiver starts with an older copy */
+};
+
+static const struct mode modes[] = {
+    { "plain", { NULL }, { NULL }, 0 },
+    { "uring", { "-u", NULL }, { "-u", NULL }, 0 },
+    { "lz", { "-z", NULL }, { NULL }, 0 },
+    { "delta", { "-d", NULL }, { NULL }, 1 },
+    { "stripe", { "-j", "4", NULL }, { NULL }, 0 },
+    { "chunks", { "-k", NULL }, { "-c", "store", NULL }, 0 },
+};
+
+#define MODE_COUNT (sizeof(modes) / sizeof(modes[0]))
+
+static const char *usage =
+    "Usage: bench [options]\n"
+    "\n"
+    " -b path : beamer binary, default ./beamer\n"
+    " -m list : comma separated modes, default all of\n"
+    "\tplain, uring, lz, delta, stripe and chunks\n"
+    " -s list : comma separated file sizes with an optional K, M or G\n"
+    "\tsuffix, default 4K,1M,64M,1G\n"
+    " -d dir : work in dir rather than a new directory under /tmp\n"
+    " -x : pass every connection through a proxy making short reads and\n"
+    "\twrites\n"
+    " -v : show the output of beamer\n";
+
+static const char *beamer = "./beamer";
+static int short_io;
+static int verbose;
+static uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+void fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    fputs("F: ", stderr);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    if (errno != 0)
+        fprintf(stderr, ": %s (%d)\n", strerror(errno), errno);
+    else
+        fputc('\n', stderr);
+    exit(EXIT_FAILURE);
+}
+
+uint64_t random64(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+uint64_t parse_size(const char *s)
+{
+    char *end;
+    uint64_t v = strtoull(s, &end, 10);
+
+    switch (*end) {
+    case 'K': case 'k':
+        v <<= 10;
+        end++;
+        break;
+    case 'M': case 'm':
+        v <<= 20;
+        end++;
+        break;
+    case 'G': case 'g':
+        v <<= 30;
+        end++;
+        break;
+    }
+    if (end == s || (*end != 0 && *end != ',')) {
+        errno = 0;
+        fatal("invalid size %s", s);
+    }
+    return v;
+}
+
+int write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t ret = write(fd, p, len);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* Write size bytes of test content to path: each 4 KiB block is half
+ * random bytes and half text, so it compresses to about half. */
+void make_file(const char *path, uint64_t size, uint64_t seed)
+{
+    static const char text[] = "the quick brown fox jumps over the lazy dog ";
+    unsigned char *buf;
+    uint64_t done = 0;
+    size_t i;
+    int fd;
+
+    rng = seed;
+    buf = malloc(BUF_SIZE);
+    if (buf == NULL) {
+        fatal("memory error");
+    }
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fatal("create %s", path);
+    }
+    while (done < size) {
+        size_t n = size - done < BUF_SIZE ? size - done : BUF_SIZE;
+        for (i = 0; i < BUF_SIZE; i += 8) {
+            if (i % 4096 < 2048) {
+                uint64_t r = random64();
+                memcpy(buf + i, &r, 8);
+            } else {
+                memcpy(buf + i, text + i % 40, 8);
+            }
+        }
+        if (write_full(fd, buf, n) != 0) {
+            fatal("write %s", path);
+        }
+        done += n;
+    }
+    close(fd);
+    free(buf);
+}
+
+/* Overwrite a page every 16 MiB of path, and at least one, as a relink
+ * touching a few functions would. */
+void patch_file(const char *path, uint64_t size)
+{
+    unsigned char page[4096];
+    uint64_t off;
+    size_t i;
+    int fd;
+
+    fd = open(path, O_WRONLY);
+    if (fd == -1) {
+        fatal("open %s", path);
+    }
+    for (i = 0; i < sizeof(page); i++)
+        page[i] = random64();
+    for (off = size / 2; off < size; off += 16 * 1024 * 1024) {
+        size_t n = size - off < sizeof(page) ? size - off : sizeof(page);
+        if (pwrite(fd, page, n, off) != (ssize_t)n) {
+            fatal("write %s", path);
+        }
+    }
+    close(fd);
+}
+
+int same_file(const char *a, const char *b)
+{
+    unsigned char *ba, *bb;
+    int fa, fb, same = 0;
+
+    fa = open(a, O_RDONLY);
+    fb = open(b, O_RDONLY);
+    ba = malloc(BUF_SIZE);
+    bb = malloc(BUF_SIZE);
+    if (ba == NULL || bb == NULL) {
+        fatal("memory error");
+    }
+    if (fa == -1 || fb == -1)
+        goto cleanup;
+    for (;;) {
+        ssize_t na = read(fa, ba, BUF_SIZE);
+        ssize_t nb = na > 0 ? read(fb, bb, na) : read(fb, bb, 1);
+        if (na < 0 || nb != na || memcmp(ba, bb, na) != 0)
+            break;
+        if (na == 0) {
+            same = 1;
+            break;
+        }
+    }
+
+cleanup:
+    if (fa != -1)
+        close(fa);
+    if (fb != -1)
+        close(fb);
+    free(ba);
+    free(bb);
+    return same;
+}
+
+int remove_entry(const char *path, const struct stat *info, int flag, struct FTW *ftw)
+{
+    (void)info;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+void remove_tree(const char *path)
+{
+    nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/* Socket listening on a free loopback port, returned in *port. */
+int listen_any(int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int sock;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) {
+        fatal("socket");
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(sock, 16) == -1 ||
+        getsockname(sock, (struct sockaddr *)&addr, &len) == -1) {
+        fatal("listen");
+    }
+    *port = ntohs(addr.sin_port);
+    return sock;
+}
+
+int connect_port(int port)
+{
+    struct sockaddr_in addr;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) {
+        fatal("socket");
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Wait until the receiver accepts connections on port. A connection
+ * closed before its hello is dropped quietly. */
+void wait_listening(int port)
+{
+    double until = now_ms() + IDLE_TIMEOUT_MS;
+    int sock;
+
+    while ((sock = connect_port(port)) == -1) {
+        if (now_ms() > until) {
+            fatal("receiver did not start");
+        }
+        usleep(10000);
+    }
+    close(sock);
+}
+
+/* Move pieces of random length between a and b until both sides have
+ * closed, passing on each half close. */
+void shuttle(int a, int b)
+{
+    struct pollfd fds[2] = { { a, POLLIN, 0 }, { b, POLLIN, 0 } };
+    unsigned char buf[PIECE_MAX];
+    int open = 2;
+
+    while (open > 0) {
+        int i;
+
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < 2; i++) {
+            int to = i == 0 ? b : a;
+            ssize_t n;
+
+            if (fds[i].fd == -1 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            n = read(fds[i].fd, buf, 1 + random64() % PIECE_MAX);
+            if (n > 0 && write_full(to, buf, n) == 0)
+                continue;
+            shutdown(to, SHUT_WR);
+            fds[i].fd = -1;
+            open--;
+        }
+    }
+    exit(0);
+}
+
+/* Start a proxy in front of port, returning its pid and in *proxy_port
+ * the port to connect to. Each connection is served by its own child. */
+pid_t start_proxy(int port, int *proxy_port)
+{
+    int sock = listen_any(proxy_port);
+    pid_t pid;
+
+    pid = fork();
+    if (pid == -1) {
+        fatal("fork");
+    }
+    if (pid > 0) {
+        close(sock);
+        return pid;
+    }
+    signal(SIGCHLD, SIG_IGN);
+    for (;;) {
+        int in, out;
+
+        in = accept(sock, NULL, NULL);
+        if (in == -1)
+            continue;
+        out = connect_port(port);
+        if (out == -1) {
+            close(in);
+            continue;
+        }
+        if (fork() == 0) {
+            close(sock);
+            rng ^= getpid();
+            shuttle(in, out);
+        }
+        close(in);
+        close(out);
+    }
+}
+
+/* Run beamer with args, its standard output read through *out. */
+pid_t spawn(char **args, int *out)
+{
+    int fds[2];
+    pid_t pid;
+
+    if (pipe(fds) == -1) {
+        fatal("pipe");
+    }
+    pid = fork();
+    if (pid == -1) {
+        fatal("fork");
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(beamer, args);
+        fprintf(stderr, "F: cannot run %s: %s\n", beamer, strerror(errno));
+        _exit(127);
+    }
+    close(fds[1]);
+    *out = fds[0];
+    return pid;
+}
+
+/* Output of one beamer process, split into lines. */
+struct output {
+    int fd;
+    char buf[4096];
+    size_t len;
+};
+
+/* Read what is available from o and return the next complete line, or
+ * NULL. Sets *eof once the process has closed its output. */
+char *next_line(struct output *o, int *eof)
+{
+    char *nl;
+    ssize_t n;
+
+    for (;;) {
+        nl = memchr(o->buf, '\n', o->len);
+        if (nl != NULL) {
+            static char line[sizeof(o->buf)];
+            size_t len = nl - o->buf;
+            memcpy(line, o->buf, len);
+            line[len] = 0;
+            memmove(o->buf, nl + 1, o->len - len - 1);
+            o->len -= len + 1;
+            return line;
+        }
+        if (o->len == sizeof(o->buf) - 1)
+            o->len = 0;         /* too long to be a stat line */
+        n = read(o->fd, o->buf + o->len, sizeof(o->buf) - 1 - o->len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0 || errno != EAGAIN)
+                *eof = 1;
+            return NULL;
+        }
+        o->len += n;
+    }
+}
+
+/* Value of key in a key=value line, or zero. */
+double field(const char *line, const char *key)
+{
+    size_t len = strlen(key);
+    const char *p = line;
+
+    while ((p = strstr(p, key)) != NULL) {
+        if (p[len] == '=' && (p == line || p[-1] == ' '))
+            return strtod(p + len + 1, NULL);
+        p += len;
+    }
+    return 0;
+}
+
+/* Read and write class system calls made so far by pid. */
+double proc_rw(pid_t pid)
+{
+    char path[64], line[128];
+    double calls = 0;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    f = fopen(path, "r");
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "syscr:", 6) == 0 || strncmp(line, "syscw:", 6) == 0)
+            calls += strtod(line + 6, NULL);
+    }
+    fclose(f);
+    return calls;
+}
+
+double stop(pid_t pid)
+{
+    struct rusage ru;
+    int status;
+
+    kill(pid, SIGTERM);
+    if (wait4(pid, &status, 0, &ru) == -1)
+        return 0;
+    return ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3 +
+           ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+}
+
+/* Send a size byte file with mode m and print its line. Returns 1 if the
+ * copy arrived intact. */
+int run(const char *dir, const struct mode *m, uint64_t size)
+{
+    char root[PATH_MAX / 2], src[PATH_MAX], dst[PATH_MAX], store[PATH_MAX];
+    char src_file[PATH_MAX + 8], dst_file[PATH_MAX + 8], rx_port[16], tx_port[16];
+    char *rx_args[16], *tx_args[16];
+    struct output out[2];
+    struct pollfd fds[2];
+    double ms = 0, wait_ms = 0, tx_calls = 0, rx_calls = 0, last, rw, tx_cpu, rx_cpu;
+    int port, proxy_port, i, n, done = 0, ok;
+    pid_t rx, tx, proxy = -1;
+
+    snprintf(root, sizeof(root), "%s/%s-%" PRIu64, dir, m->name, size);
+    snprintf(src, sizeof(src), "%s/src", root);
+    snprintf(dst, sizeof(dst), "%s/dst", root);
+    snprintf(store, sizeof(store), "%s/store", root);
+    snprintf(src_file, sizeof(src_file), "%s/f", src);
+    snprintf(dst_file, sizeof(dst_file), "%s/f", dst);
+    remove_tree(root);
+    if (mkdir(root, 0755) == -1 || mkdir(src, 0755) == -1 || mkdir(dst, 0755) == -1) {
+        fatal("mkdir %s", root);
+    }
+    make_file(src_file, size, size + 1);
+    if (m->delta) {
+        make_file(dst_file, size, size + 1);
+        patch_file(src_file, size);
+    }
+
+    /* The port is free when asked for; another program could take it
+     * before the receiver does, which fails the run loudly. */
+    close(listen_any(&port));
+    snprintf(rx_port, sizeof(rx_port), "%d", port);
+    n = 0;
+    rx_args[n++] = (char *)beamer;
+    rx_args[n++] = "-t";
+    for (i = 0; m->rx[i] != NULL; i++)
+        rx_args[n++] = strcmp(m->rx[i], "store") == 0 ? store : (char *)m->rx[i];
+    rx_args[n++] = rx_port;
+    rx_args[n++] = dst;
+    rx_args[n] = NULL;
+    rx = spawn(rx_args, &out[1].fd);
+    wait_listening(port);
+
+    if (short_io)
+        proxy = start_proxy(port, &proxy_port);
+    snprintf(tx_port, sizeof(tx_port), "%d", short_io ? proxy_port : port);
+    n = 0;
+    tx_args[n++] = (char *)beamer;
+    tx_args[n++] = "-t";
+    tx_args[n++] = "-s";
+    for (i = 0; m->tx[i] != NULL; i++)
+        tx_args[n++] = (char *)m->tx[i];
+    tx_args[n++] = src;
+    tx_args[n++] = "127.0.0.1";
+    tx_args[n++] = tx_port;
+    tx_args[n] = NULL;
+    tx = spawn(tx_args, &out[0].fd);
+
+    /* Done once each end has reported the file. A copy the receiver
+     * rejects is sent again and reported again. */
+    for (i = 0; i < 2; i++) {
+        out[i].len = 0;
+        fds[i].fd = out[i].fd;
+        fds[i].events = POLLIN;
+        fcntl(out[i].fd, F_SETFL, O_NONBLOCK);
+    }
+    last = now_ms();
+    while (done != 3 && now_ms() - last < IDLE_TIMEOUT_MS) {
+        if (poll(fds, 2, 1000) == -1 && errno != EINTR) {
+            fatal("poll");
+        }
+        for (i = 0; i < 2; i++) {
+            char *line;
+            int eof = 0;
+
+            if (fds[i].fd == -1)
+                continue;
+            while ((line = next_line(&out[i], &eof)) != NULL) {
+                last = now_ms();
+                if (verbose)
+                    printf("%s: %s\n", i == 0 ? "tx" : "rx", line);
+                if (i == 0 && strncmp(line, "stat tx path=f ", 15) == 0 && field(line, "ok")) {
+                    tx_calls = field(line, "calls");
+                    wait_ms = field(line, "wait_ms");
+                    done |= 1;
+                }
+                if (i == 1 && strncmp(line, "stat rx path=f ", 15) == 0 && field(line, "ok")) {
+                    ms = field(line, "ms");
+                    rx_calls = field(line, "calls");
+                    done |= 2;
+                }
+            }
+            if (eof)
+                fds[i].fd = -1;
+        }
+        if (fds[0].fd == -1 && fds[1].fd == -1)
+            break;
+    }
+
+    rw = proc_rw(tx) + proc_rw(rx);
+    tx_cpu = stop(tx);
+    rx_cpu = stop(rx);
+    if (proxy != -1) {
+        kill(proxy, SIGKILL);
+        waitpid(proxy, NULL, 0);
+    }
+    close(out[0].fd);
+    close(out[1].fd);
+
+    ok = done == 3 && same_file(src_file, dst_file);
+    printf("bench mode=%s size=%" PRIu64 " ok=%d wait_ms=%.1f ms=%.1f MBps=%.1f"
+           " tx_cpu_ms=%.1f rx_cpu_ms=%.1f calls_per_MB=%.1f rw_per_MB=%.1f\n",
+           m->name, size, ok, wait_ms, ms, ms > 0 ? size / MB / (ms / 1e3) : 0, tx_cpu, rx_cpu,
+           size ? (tx_calls + rx_calls) / (size / MB) : 0, size ? rw / (size / MB) : 0);
+    fflush(stdout);
+    remove_tree(root);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const char *mode_list = NULL, *size_list = "4K,1M,64M,1G", *p;
+    char dir[PATH_MAX] = "/tmp/beamer-bench.XXXXXX";
+    int c, own_dir = 1, failed = 0;
+    size_t i;
+
+    while ((c = getopt(argc, argv, "b:d:hm:s:vx")) != -1) {
+        switch (c) {
+        case 'b':
+            beamer = optarg;
+            break;
+        case 'd':
+            snprintf(dir, sizeof(dir), "%s", optarg);
+            own_dir = 0;
+            break;
+        case 'm':
+            mode_list = optarg;
+            break;
+        case 's':
+            size_list = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'x':
+            short_io = 1;
+            break;
+        case 'h':
+            fputs(usage, stdout);
+            return 0;
+        default:
+            fputs(usage, stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (own_dir && mkdtemp(dir) == NULL) {
+        fatal("mkdtemp");
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < MODE_COUNT; i++) {
+        const struct mode *m = &modes[i];
+        size_t len = strlen(m->name);
+
+        if (mode_list != NULL) {
+            for (p = mode_list; p != NULL; p = strchr(p, ','), p = p ? p + 1 : NULL) {
+                if (strncmp(p, m->name, len) == 0 && (p[len] == ',' || p[len] == 0))
+                    break;
+            }
+            if (p == NULL)
+                continue;
+        }
+        for (p = size_list; p != NULL; p = strchr(p, ','), p = p ? p + 1 : NULL)
+            failed += !run(dir, m, parse_size(p));
+    }
+    if (own_dir)
+        remove_tree(dir);
+    return failed ? EXIT_FAILURE : 0;
+}
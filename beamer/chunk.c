@@ -0,0 +1,133 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "beamer.h"
+#include "chunk.h"
+#include "xxhash.h"
+
+/* The gear hash shifts each byte out after 64 more, and its low n bits
+ * depend on only the last n bytes, too short a window to follow the
+ * content. The top bits cover all 64, as in FastCDC. */
+#define CHUNK_MASK ((((uint64_t)1 << CHUNK_AVG_BITS) - 1) << (64 - CHUNK_AVG_BITS))
+
+/* Bytes read at a time. A chunk never straddles a refill. */
+#define CHUNK_READ (4 * CHUNK_MAX)
+
+/* Random values for the gear hash. Fixed, so every transmitter cuts the
+ * same content in the same places. */
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+static void init_gear(void)
+{
+    uint64_t x = 0x6265616d65720000ull;
+    int i;
+
+    /* splitmix64 */
+    for (i = 0; i < 256; i++) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+void chunk_id(const void *buf, size_t len, unsigned char *id)
+{
+    put64(put64(id, xxh64(buf, len, 0)), xxh64(buf, len, 0x9e3779b97f4a7c15ull));
+}
+
+/* Length of the chunk starting at buf, of at most len bytes. */
+static size_t cut(const unsigned char *buf, size_t len)
+{
+    uint64_t h = 0;
+    size_t i;
+
+    if (len <= CHUNK_MIN)
+        return len;
+    if (len > CHUNK_MAX)
+        len = CHUNK_MAX;
+    for (i = CHUNK_MIN; i < len; i++) {
+        h = (h << 1) + gear[buf[i]];
+        if ((h & CHUNK_MASK) == 0)
+            return i + 1;
+    }
+    return len;
+}
+
+int chunk_file(int fd, uint64_t size, struct chunk_list *list)
+{
+    unsigned char *buf;
+    uint64_t pos = 0, cap = 0;
+    size_t have = 0, start = 0;
+
+    pthread_once(&gear_once, init_gear);
+    list->count = 0;
+    list->chunk = NULL;
+    buf = malloc(CHUNK_READ);
+    if (buf == NULL)
+        return -1;
+    while (pos < size) {
+        struct chunk *c;
+        size_t n;
+
+        /* Keep at least CHUNK_MAX bytes ahead unless the file ends. */
+        if (have - start < CHUNK_MAX && pos + (have - start) < size) {
+            memmove(buf, buf + start, have - start);
+            have -= start;
+            start = 0;
+            while (have < CHUNK_READ && pos + have < size) {
+                ssize_t ret = pread(fd, buf + have, CHUNK_READ - have, pos + have);
+                if (ret == -1 && errno == EINTR)
+                    continue;
+                if (ret <= 0)
+                    goto fail;
+                have += ret;
+            }
+        }
+        n = cut(buf + start, size - pos < have - start ? size - pos : have - start);
+        if (list->count == cap) {
+            cap = cap ? cap * 2 : 64;
+            c = realloc(list->chunk, cap * sizeof(*c));
+            if (c == NULL)
+                goto fail;
+            list->chunk = c;
+        }
+        c = &list->chunk[list->count++];
+        c->off = pos;
+        c->len = n;
+        chunk_id(buf + start, n, c->id);
+        start += n;
+        pos += n;
+    }
+    free(buf);
+    return 0;
+
+fail:
+    free(buf);
+    chunk_list_free(list);
+    return -1;
+}
+
+void chunk_list_free(struct chunk_list *list)
+{
+    free(list->chunk);
+    list->chunk = NULL;
+    list->count = 0;
+}
+
+char *chunk_path(const char *store, const unsigned char *id)
+{
+    char name[3 + 2 * CHUNK_ID_SIZE + 1];
+    int i;
+
+    sprintf(name, "%02x%c", id[0], PATH_SEP);
+    for (i = 0; i < CHUNK_ID_SIZE; i++)
+        sprintf(name + 3 + 2 * i, "%02x", id[i]);
+    return join_path(store, name);
+}
@@ -0,0 +1,45 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Content-defined chunking. A boundary falls where a gear hash of the
+ * 64 bytes before it has its top CHUNK_AVG_BITS bits clear, so an
+ * insertion only moves the boundaries near it and identical regions of
+ * different files, or versions of a file, give identical chunks. Every
+ * chunk but the last is at least CHUNK_MIN and none exceeds CHUNK_MAX. */
+#define CHUNK_MIN (16 * 1024)
+#define CHUNK_AVG_BITS 16
+#define CHUNK_MAX (256 * 1024)
+
+/* A chunk is named by XXH64 of its content under two seeds. */
+#define CHUNK_ID_SIZE 16
+
+struct chunk {
+    uint64_t off;
+    uint32_t len;
+    unsigned char id[CHUNK_ID_SIZE];
+};
+
+struct chunk_list {
+    uint64_t count;
+    struct chunk *chunk;
+};
+
+/* Bit i of a bitmap, as answered to a manifest. */
+#define CHUNK_BIT(map, i) (((map)[(i) / 8] >> ((i) % 8)) & 1)
+
+void chunk_id(const void *buf, size_t len, unsigned char *id);
+
+/* Split the size bytes of fd into chunks. Returns -1 on a read error or
+ * if the file is shorter than size. */
+int chunk_file(int fd, uint64_t size, struct chunk_list *list);
+
+void chunk_list_free(struct chunk_list *list);
+
+/* Path of the chunk id in the store directory: the first byte in hex as
+ * a subdirectory, then the whole id in hex. The caller frees it. */
+char *chunk_path(const char *store, const unsigned char *id);
+
+#endif
@@ -0,0 +1,287 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "delta.h"
+#include "xxhash.h"
+
+#define WINDOW_SIZE (1024 * 1024)
+
+uint32_t delta_block_size(uint64_t size)
+{
+    uint64_t b = DELTA_MIN_BLOCK;
+    while (b < DELTA_MAX_BLOCK && b * b < size)
+        b *= 2;
+    return (uint32_t)b;
+}
+
+uint32_t delta_weak(const unsigned char *buf, size_t len)
+{
+    uint32_t a = 0, b = 0;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        a += buf[i];
+        b += (uint32_t)(len - i) * buf[i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+static ssize_t pread_full(int fd, unsigned char *buf, size_t len, uint64_t off)
+{
+    size_t got = 0;
+    while (got < len) {
+        ssize_t ret = pread(fd, buf + got, len - got, off + got);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        got += ret;
+    }
+    return got;
+}
+
+int delta_sign(int fd, uint64_t size, struct delta_sigs *sigs)
+{
+    unsigned char *buf;
+    uint64_t i;
+
+    sigs->block_size = delta_block_size(size);
+    sigs->size = fd == -1 ? 0 : size;
+    sigs->count = (sigs->size + sigs->block_size - 1) / sigs->block_size;
+    sigs->sig = NULL;
+    if (sigs->count == 0)
+        return 0;
+
+    sigs->sig = malloc(sigs->count * sizeof(*sigs->sig));
+    buf = malloc(sigs->block_size);
+    if (sigs->sig == NULL || buf == NULL)
+        goto fail;
+    for (i = 0; i < sigs->count; i++) {
+        uint64_t off = i * sigs->block_size;
+        size_t len = sigs->size - off < sigs->block_size ? sigs->size - off : sigs->block_size;
+        if (pread_full(fd, buf, len, off) != (ssize_t)len)
+            goto fail;
+        sigs->sig[i].weak = delta_weak(buf, len);
+        sigs->sig[i].strong = xxh64(buf, len, 0);
+    }
+    free(buf);
+    return 0;
+
+fail:
+    free(buf);
+    delta_sigs_free(sigs);
+    return -1;
+}
+
+void delta_sigs_free(struct delta_sigs *sigs)
+{
+    free(sigs->sig);
+    sigs->sig = NULL;
+    sigs->count = 0;
+}
+
+/* Chained hash table over the weak checksums of the full blocks. */
+struct sig_table {
+    unsigned bits;
+    int64_t *heads;
+    int64_t *next;
+};
+
+static size_t sig_hash(const struct sig_table *t, uint32_t weak)
+{
+    return (uint32_t)(weak * 2654435761u) >> (32 - t->bits);
+}
+
+static int sig_table_init(struct sig_table *t, const struct delta_sigs *sigs, uint64_t full)
+{
+    uint64_t i;
+    t->bits = 1;
+    while (((uint64_t)1 << t->bits) < full * 2 && t->bits < 30)
+        t->bits++;
+    t->heads = malloc(((size_t)1 << t->bits) * sizeof(*t->heads));
+    t->next = malloc((full ? full : 1) * sizeof(*t->next));
+    if (t->heads == NULL || t->next == NULL)
+        return -1;
+    memset(t->heads, 0xff, ((size_t)1 << t->bits) * sizeof(*t->heads));
+    /* Insert in reverse so chains list lower blocks first. */
+    for (i = full; i-- > 0;) {
+        size_t h = sig_hash(t, sigs->sig[i].weak);
+        t->next[i] = t->heads[h];
+        t->heads[h] = i;
+    }
+    return 0;
+}
+
+static void sig_table_free(struct sig_table *t)
+{
+    free(t->heads);
+    free(t->next);
+}
+
+/* Pending output: a run of copied blocks, then literal bytes up to the
+ * current position. Runs of consecutive blocks are merged. */
+struct diff_state {
+    delta_emit_fn emit;
+    void *ctx;
+    uint64_t run_block;
+    uint64_t run_count;
+    uint64_t lit;
+};
+
+static int flush_run(struct diff_state *s)
+{
+    struct delta_op op = { DELTA_COPY, s->run_block, s->run_count };
+    if (s->run_count == 0)
+        return 0;
+    s->run_count = 0;
+    return s->emit(s->ctx, &op);
+}
+
+static int flush_literal(struct diff_state *s, uint64_t pos)
+{
+    struct delta_op op = { DELTA_DATA, s->lit, pos - s->lit };
+    if (pos == s->lit)
+        return 0;
+    if (flush_run(s) != 0)
+        return -1;
+    s->lit = pos;
+    return s->emit(s->ctx, &op);
+}
+
+/* Record a match of block at file offset pos. */
+static int add_match(struct diff_state *s, uint64_t pos, uint64_t block, uint64_t next_pos)
+{
+    if (flush_literal(s, pos) != 0)
+        return -1;
+    if (s->run_count && s->run_block + s->run_count == block) {
+        s->run_count++;
+    } else {
+        if (flush_run(s) != 0)
+            return -1;
+        s->run_block = block;
+        s->run_count = 1;
+    }
+    s->lit = next_pos;
+    return 0;
+}
+
+static int64_t find_block(const struct sig_table *t, const struct delta_sigs *sigs,
+                          const struct diff_state *s, uint32_t weak,
+                          const unsigned char *p)
+{
+    uint64_t want = s->run_block + s->run_count;
+    uint64_t strong = 0;
+    int have_strong = 0;
+    int64_t i;
+
+    /* Prefer continuing the current run when blocks repeat. */
+    for (i = t->heads[sig_hash(t, weak)]; i >= 0; i = t->next[i]) {
+        if (sigs->sig[i].weak != weak)
+            continue;
+        if (!have_strong) {
+            strong = xxh64(p, sigs->block_size, 0);
+            have_strong = 1;
+        }
+        if (sigs->sig[i].strong != strong)
+            continue;
+        if (!s->run_count || (uint64_t)i == want || want >= sigs->count ||
+            sigs->sig[want].weak != weak || sigs->sig[want].strong != strong)
+            return i;
+        return want;
+    }
+    return -1;
+}
+
+int delta_diff(int fd, uint64_t size, const struct delta_sigs *sigs,
+               delta_emit_fn emit, void *ctx)
+{
+    struct diff_state s = { emit, ctx, 0, 0, 0 };
+    const size_t bs = sigs->block_size;
+    uint64_t full = sigs->size / bs;
+    struct sig_table t = { 0, NULL, NULL };
+    unsigned char *buf = NULL;
+    size_t cap, end = 0, p = 0;
+    uint64_t base = 0;
+    uint32_t a = 0, b = 0;
+    int have_weak = 0, status = -1;
+
+    if (full == 0 && sigs->count == 0) {
+        if (flush_literal(&s, size) != 0)
+            return -1;
+        return 0;
+    }
+
+    cap = bs * 4 > WINDOW_SIZE ? bs * 4 : WINDOW_SIZE;
+    buf = malloc(cap);
+    if (buf == NULL || sig_table_init(&t, sigs, full) != 0)
+        goto out;
+
+    for (;;) {
+        if (p + bs > end && base + end < size) {
+            ssize_t n;
+            memmove(buf, buf + p, end - p);
+            base += p;
+            end -= p;
+            p = 0;
+            n = pread_full(fd, buf + end, size - (base + end) < cap - end ?
+                           size - (base + end) : cap - end, base + end);
+            if (n == -1)
+                goto out;
+            end += n;
+            have_weak = 0;
+            if (n == 0)
+                break;
+            continue;
+        }
+        if (p + bs > end || full == 0)
+            break;
+
+        if (!have_weak) {
+            uint32_t w = delta_weak(buf + p, bs);
+            a = w & 0xffff;
+            b = w >> 16;
+            have_weak = 1;
+        }
+
+        int64_t blk = find_block(&t, sigs, &s, (a & 0xffff) | (b << 16), buf + p);
+        if (blk >= 0) {
+            if (add_match(&s, base + p, blk, base + p + bs) != 0)
+                goto out;
+            p += bs;
+            have_weak = 0;
+            continue;
+        }
+
+        if (p + bs < end) {
+            unsigned char out = buf[p], in = buf[p + bs];
+            a = (a - out + in) & 0xffff;
+            b = (b - (uint32_t)bs * out + a) & 0xffff;
+        } else {
+            have_weak = 0;
+        }
+        p++;
+    }
+
+    /* A short final block can only match the old file's short final
+     * block. */
+    if (base + end == size && end > p && sigs->size % bs == end - p) {
+        const struct delta_sig *last = &sigs->sig[sigs->count - 1];
+        if (last->weak == delta_weak(buf + p, end - p) &&
+            last->strong == xxh64(buf + p, end - p, 0)) {
+            if (add_match(&s, base + p, sigs->count - 1, size) != 0)
+                goto out;
+        }
+    }
+    if (flush_literal(&s, size) != 0 || flush_run(&s) != 0)
+        goto out;
+    status = 0;
+
+out:
+    free(buf);
+    sig_table_free(&t);
+    return status;
+}
@@ -0,0 +1,55 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DELTA_MIN_BLOCK 1024
+#define DELTA_MAX_BLOCK (128 * 1024)
+
+/* Signature of one block of the receiver's copy of a file. */
+struct delta_sig {
+    uint32_t weak;
+    uint64_t strong;
+};
+
+/* Signatures of a whole file. Every block but the last is block_size
+ * bytes. */
+struct delta_sigs {
+    uint32_t block_size;
+    uint64_t size;
+    uint64_t count;
+    struct delta_sig *sig;
+};
+
+/* Instruction to rebuild the new file: copy len blocks of the old file
+ * starting at block pos, or take len bytes of the new file at offset
+ * pos. */
+enum delta_op_type { DELTA_COPY, DELTA_DATA };
+
+struct delta_op {
+    enum delta_op_type type;
+    uint64_t pos;
+    uint64_t len;
+};
+
+/* Called for each instruction in file order. Non-zero stops the diff. */
+typedef int (*delta_emit_fn)(void *ctx, const struct delta_op *op);
+
+uint32_t delta_block_size(uint64_t size);
+
+/* Rolling checksum of len bytes, as in rsync. */
+uint32_t delta_weak(const unsigned char *buf, size_t len);
+
+/* Sign the size bytes of fd. With fd -1 or size 0 the result has no
+ * blocks. Returns -1 on a read error. */
+int delta_sign(int fd, uint64_t size, struct delta_sigs *sigs);
+
+void delta_sigs_free(struct delta_sigs *sigs);
+
+/* Compare the size bytes of fd against sigs and emit the instructions
+ * to rebuild it. Returns -1 on a read error or if emit fails. */
+int delta_diff(int fd, uint64_t size, const struct delta_sigs *sigs,
+               delta_emit_fn emit, void *ctx);
+
+#endif
@@ -0,0 +1,853 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "beamer.h"
+#include "chunk.h"
+#include "delta.h"
+#include "link.h"
+#include "stats.h"
+#include "zstream.h"
+
+/* Files below this size are always sent whole. */
+#define DELTA_MIN_SIZE (64 * 1024)
+#define CHUNKED_MIN_SIZE (64 * 1024)
+
+/* Files at least this size are striped when the link has streams. */
+#define STRIPE_MIN_SIZE (64 * 1024 * 1024)
+
+/* Ranges of a striped file start on multiples of this. */
+#define STRIPE_ALIGN (1024 * 1024)
+
+/* Times a file the receiver rejects is sent again. */
+#define MAX_TRIES 3
+
+/* Delay before reconnecting to a receiver, doubling after each failed
+ * attempt up to the maximum. */
+#define RETRY_MIN_MS 250
+#define RETRY_MAX_MS 30000
+
+/* Reasons a transfer stops early. */
+#define CANCEL_NEWER 0x1        /* a newer version of the file is queued */
+#define CANCEL_LOST 0x2         /* the connection failed */
+
+/* Path waiting to be sent on a link, or waiting for the receiver's
+ * answer. */
+struct job {
+    char *relpath;
+    uint64_t seen;              /* change noticed, in now_ns() time */
+    int tries;
+    struct job *next;
+};
+
+/* A transfer is cancelled at most this many bytes after a newer version
+ * of its file is queued. Plain content is sent in pieces this size. */
+#define CANCEL_CHUNK (4 * 1024 * 1024)
+
+/* Extra connection carrying one range of each striped file. */
+struct stripe {
+    struct link *l;
+    int sock;
+    int accel;
+    pthread_t thread;
+    /* Range being sent. */
+    const char *relpath;
+    const char *path;
+    int fd;
+    uint64_t id;
+    uint64_t off;
+    uint64_t len;
+    uint64_t wire;
+    struct xfer_stats stats;
+};
+
+struct link {
+    char *host;
+    char *port;
+    const char *root;
+    int features;
+    int sock;                   /* -1 while not connected */
+    uint32_t flags;             /* header flags the receiver accepted */
+    int accel;                  /* compression level, see zs_send() */
+    atomic_int cancel;          /* CANCEL_* reasons to stop sending current */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const char *current;        /* path being sent */
+    struct job *head;
+    struct job **tail;
+    struct job *unacked;        /* sent, oldest first */
+    struct job **unacked_tail;
+    int streams;                /* number of stripes */
+    struct stripe *stripes;
+    uint64_t next_id;           /* of the next striped transfer */
+    struct link *next;
+};
+
+int open_link(const char *server, const char *port)
+{
+    int ret, sock;
+    struct addrinfo hints, *res, *rp;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = 0;
+
+    ret = getaddrinfo(server, port, &hints, &res);
+    if (ret) {
+        fatal("getaddrinfo error %s", gai_strerror(ret));
+    }
+
+    for (rp = res; rp != NULL; rp = rp->ai_next) {
+        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (sock == -1)
+            continue;
+        tune_socket(sock);
+        ret = connect(sock, rp->ai_addr, rp->ai_addrlen);
+        if (ret == 0)
+            break;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+/* Record that one of l's connections failed while doing what, stopping
+ * whatever is being sent. The worker then reconnects. Only the first
+ * failure is reported, since the others follow from it. */
+void link_lost(struct link *l, const char *what)
+{
+    int err = errno;
+
+    if (atomic_fetch_or(&l->cancel, CANCEL_LOST) & CANCEL_LOST)
+        return;
+    warn("connection to receiver %s:%s lost %s: %s", l->host, l->port, what,
+         err ? strerror(err) : "closed");
+}
+
+/* Send a file header on sock, one of l's connections. Returns -1 if the
+ * connection failed. */
+int txheader(struct link *l, int sock, const char *relpath, mode_t mode, uint32_t flags,
+             uint64_t size)
+{
+    size_t path_len = strlen(relpath), len = FILE_HEADER_SIZE + path_len;
+    unsigned char buf[FILE_HEADER_SIZE + PATH_MAX], *p = buf;
+
+    assert(path_len <= PATH_MAX);
+    p = put32(p, BEAMER_MAGIC);
+    p = put32(p, BEAMER_VERSION << 16 | FILE_HEADER_SIZE);
+    p = put32(p, flags);
+    p = put32(p, mode);
+    p = put64(p, size);
+    p = put32(p, path_len);
+    p = put32(p, 0);
+    memcpy(p, relpath, path_len);
+    put32(buf + 28, header_checksum(buf, len));
+    if (write_full(sock, buf, len) == -1) {
+        link_lost(l, "sending a header");
+        return -1;
+    }
+    return 0;
+}
+
+/* Send the hash that follows the content of a file sent with HDR_HASH. */
+void txhash(struct link *l, uint64_t hash)
+{
+    unsigned char buf[HASH_SIZE];
+
+    put64(buf, hash);
+    if (write_full(l->sock, buf, sizeof(buf)) == -1)
+        link_lost(l, "sending a hash");
+}
+
+int rxsigs(int sock, struct delta_sigs *sigs)
+{
+    unsigned char hdr[SIGS_HEADER_SIZE], rec[SIG_SIZE];
+    uint64_t i;
+
+    if (read_full(sock, hdr, sizeof(hdr)) != 0)
+        return -1;
+    sigs->block_size = get32(hdr);
+    sigs->size = get64(hdr + 8);
+    if (sigs->block_size < DELTA_MIN_BLOCK || sigs->block_size > DELTA_MAX_BLOCK)
+        return -1;
+    sigs->count = (sigs->size + sigs->block_size - 1) / sigs->block_size;
+    sigs->sig = NULL;
+    if (sigs->count == 0)
+        return 0;
+    sigs->sig = malloc(sigs->count * sizeof(*sigs->sig));
+    if (sigs->sig == NULL)
+        return -1;
+    for (i = 0; i < sigs->count; i++) {
+        if (read_full(sock, rec, sizeof(rec)) != 0) {
+            delta_sigs_free(sigs);
+            return -1;
+        }
+        sigs->sig[i].weak = get32(rec);
+        sigs->sig[i].strong = get64(rec + 4);
+    }
+    return 0;
+}
+
+void txrec(struct link *l, char op, uint64_t pos, uint64_t len)
+{
+    unsigned char buf[DELTA_REC_SIZE];
+    buf[0] = op;
+    put64(put64(buf + 1, pos), len);
+    if (write_full(l->sock, buf, sizeof(buf)) == -1)
+        link_lost(l, "sending a delta");
+}
+
+/* Send file content on sock, one of l's connections, compressed when the
+ * receiver accepted it. If hash is not NULL it is carried on behind each
+ * piece sent. Returns the bytes put on the wire, fewer than len if the
+ * transfer was cancelled or the connection failed. */
+uint64_t send_body(struct link *l, int sock, int *accel, int fd, uint64_t off, uint64_t len,
+                   const char *path, struct tx_hash *hash)
+{
+    uint64_t done = 0;
+    int ret;
+
+    if (l->flags & HDR_LZ) {
+        if (zs_send(sock, fd, off, len, path, accel, &l->cancel, hash, &done) == -1)
+            link_lost(l, "sending data");
+        return done;
+    }
+    while (done < len && !atomic_load(&l->cancel)) {
+        uint64_t n = len - done < CANCEL_CHUNK ? len - done : CANCEL_CHUNK;
+        ret = send_range(sock, fd, off + done, n, path);
+        if (ret == -1) {
+            link_lost(l, "sending data");
+            break;
+        }
+        /* A shrunken file is about to be sent again. */
+        if (ret)
+            atomic_fetch_or(&l->cancel, CANCEL_NEWER);
+        done += n;
+        if (hash)
+            hash_upto(hash, off + done);
+    }
+    return done;
+}
+
+struct delta_tx {
+    struct link *l;
+    int fd;
+    const char *path;
+    struct tx_hash *hash;
+    uint64_t literal;
+    uint64_t wire;
+};
+
+int emit_delta(void *ctx, const struct delta_op *op)
+{
+    struct delta_tx *tx = ctx;
+    if (op->type == DELTA_COPY) {
+        txrec(tx->l, 'C', op->pos, op->len);
+    } else {
+        txrec(tx->l, 'D', 0, op->len);
+        tx->wire += send_body(tx->l, tx->l->sock, &tx->l->accel, tx->fd, op->pos, op->len,
+                              tx->path, tx->hash);
+        tx->literal += op->len;
+    }
+    return atomic_load(&tx->l->cancel);
+}
+
+/* Returns the bytes of literal data put on the wire. */
+uint64_t send_delta(struct link *l, int fd, const char *path, uint64_t size,
+                    struct tx_hash *hash)
+{
+    struct delta_sigs sigs;
+    struct delta_tx tx = { l, fd, path, hash, 0, 0 };
+
+    if (rxsigs(l->sock, &sigs) != 0) {
+        link_lost(l, "receiving signatures");
+        return 0;
+    }
+    if (delta_diff(fd, size, &sigs, emit_delta, &tx) != 0 && !atomic_load(&l->cancel)) {
+        /* The receiver is left expecting more of the delta. */
+        warn("error reading %s", path);
+        link_lost(l, "in a delta");
+    }
+    delta_sigs_free(&sigs);
+    if (atomic_load(&l->cancel))
+        return tx.wire;
+    txrec(l, 'E', 0, 0);
+    printf("delta %s %" PRIu64 " literal of %" PRIu64 " to %s\n", path, tx.literal, size, l->host);
+    return tx.wire;
+}
+
+/* Send the manifest of a chunked file, then the chunks the receiver is
+ * missing. Returns the bytes of content put on the wire. */
+uint64_t send_chunks(struct link *l, int fd, const char *path, const struct chunk_list *list,
+                     struct tx_hash *hash)
+{
+    size_t mlen = 4 + list->count * CHUNK_REC_SIZE, blen = (list->count + 7) / 8;
+    uint64_t i, j, sent = 0, wire = 0;
+    unsigned char *buf, *p;
+
+    buf = malloc(mlen > blen ? mlen : blen);
+    if (buf == NULL) {
+        fatal("memory error");
+    }
+    p = put32(buf, list->count);
+    for (i = 0; i < list->count; i++) {
+        memcpy(p, list->chunk[i].id, CHUNK_ID_SIZE);
+        p = put32(p + CHUNK_ID_SIZE, list->chunk[i].len);
+    }
+    if (write_full(l->sock, buf, mlen) == -1 || read_full(l->sock, buf, blen) != 0) {
+        link_lost(l, "exchanging a chunk manifest");
+        free(buf);
+        return 0;
+    }
+    for (i = 0; i < list->count && !atomic_load(&l->cancel); i = j) {
+        const struct chunk *first = &list->chunk[i];
+        if (!CHUNK_BIT(buf, i)) {
+            j = i + 1;
+            continue;
+        }
+        for (j = i; j < list->count && CHUNK_BIT(buf, j); j++)
+            ;
+        wire += send_body(l, l->sock, &l->accel, fd, first->off,
+                          list->chunk[j - 1].off + list->chunk[j - 1].len - first->off, path,
+                          hash);
+        sent += j - i;
+    }
+    if (!atomic_load(&l->cancel))
+        printf("chunks %s %" PRIu64 " of %" PRIu64 " sent to %s\n", path, sent, list->count, l->host);
+    free(buf);
+    return wire;
+}
+
+void *stripe_worker(void *arg)
+{
+    struct stripe *s = arg;
+    unsigned char buf[STRIPE_INFO_SIZE];
+
+    memset(&s->stats, 0, sizeof(s->stats));
+    if (stats_enabled)
+        stats_current = &s->stats;
+    s->wire = 0;
+    set_cork(s->sock, 1);
+    if (txheader(s->l, s->sock, s->relpath, S_IFREG, HDR_RANGE | (s->l->flags & HDR_LZ),
+                 s->len) == -1)
+        return NULL;
+    put64(put64(buf, s->id), s->off);
+    if (write_full(s->sock, buf, sizeof(buf)) == -1) {
+        link_lost(s->l, "sending a range");
+        return NULL;
+    }
+    s->wire = send_body(s->l, s->sock, &s->accel, s->fd, s->off, s->len, s->path, NULL);
+    set_cork(s->sock, 0);
+    return NULL;
+}
+
+/* Send the content of a file whose striped header has gone out as ranges
+ * on the stripe connections at once, hashing it meanwhile if hash is not
+ * NULL. Returns the bytes put on the wire. */
+uint64_t send_stripes(struct link *l, int fd, const char *relpath, const char *path,
+                      uint64_t size, struct tx_hash *hash)
+{
+    unsigned char buf[STRIPE_INFO_SIZE];
+    uint64_t per, id = l->next_id++, wire = 0;
+    uint32_t i, n;
+
+    per = (size + l->streams - 1) / l->streams;
+    per = (per + STRIPE_ALIGN - 1) / STRIPE_ALIGN * STRIPE_ALIGN;
+    n = (size + per - 1) / per;
+    put32(put32(put64(buf, id), n), 0);
+    if (write_full(l->sock, buf, sizeof(buf)) == -1) {
+        link_lost(l, "sending a header");
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        struct stripe *s = &l->stripes[i];
+        s->relpath = relpath;
+        s->path = path;
+        s->fd = fd;
+        s->id = id;
+        s->off = i * per;
+        s->len = size - s->off < per ? size - s->off : per;
+        if (pthread_create(&s->thread, NULL, stripe_worker, s) != 0) {
+            fatal("pthread_create");
+        }
+    }
+    if (hash)
+        hash_upto(hash, size);
+    for (i = 0; i < n; i++) {
+        pthread_join(l->stripes[i].thread, NULL);
+        wire += l->stripes[i].wire;
+        if (stats_current)
+            stats_add(stats_current, &l->stripes[i].stats);
+    }
+    return wire;
+}
+
+int read_answers(struct link *l, int block);
+
+/* Wait for the answers to every file sent, which the receiver writes
+ * ahead of its reply to the next header. Returns -1 if the connection
+ * failed. */
+int settle(struct link *l)
+{
+    while (l->unacked != NULL) {
+        if (read_answers(l, 1) == -1) {
+            link_lost(l, "reading answers");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Send j's path, a regular file or a directory, as it is now. Returns 1
+ * if the receiver will answer for it. */
+int send_path(struct link *l, struct job *j)
+{
+    const char *relpath = j->relpath;
+    struct chunk_list chunks;
+    struct xfer_stats st;
+    struct stat info;
+    char *path;
+    int fd, cancel, answer = 0;
+
+    path = join_path(l->root, relpath);
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        warn("open %s", path);
+        goto cleanup_path;
+    }
+    if (fstat(fd, &info) == -1) {
+        fatal("fstat %s", path);
+    }
+    if (S_ISDIR(info.st_mode)) {
+        txheader(l, l->sock, relpath, info.st_mode, 0, 0);
+        goto cleanup_file;
+    }
+    if (!S_ISREG(info.st_mode))
+        goto cleanup_file;
+
+    uint64_t size = info.st_size, wire = 0;
+    uint32_t flags = l->flags & (HDR_LZ | HDR_HASH);
+    struct tx_hash th = { fd, size, 0, 0, 0 }, *hash = (flags & HDR_HASH) ? &th : NULL;
+    memset(&st, 0, sizeof(st));
+    st.queued = j->seen;
+    st.started = now_ns();
+    st.size = size;
+    if (stats_enabled)
+        stats_current = &st;
+    if ((l->flags & HDR_CHUNKED) && size >= CHUNKED_MIN_SIZE &&
+        chunk_file(fd, size, &chunks) == 0) {
+        if (settle(l) == 0 &&
+            txheader(l, l->sock, relpath, info.st_mode, flags | HDR_CHUNKED, size) == 0)
+            wire = send_chunks(l, fd, path, &chunks, hash);
+        chunk_list_free(&chunks);
+    } else if ((l->features & LINK_DELTA) && size >= DELTA_MIN_SIZE) {
+        if (settle(l) == 0 &&
+            txheader(l, l->sock, relpath, info.st_mode, flags | HDR_DELTA, size) == 0)
+            wire = send_delta(l, fd, path, size, hash);
+    } else if ((l->flags & HDR_STRIPED) && size >= STRIPE_MIN_SIZE) {
+        if (txheader(l, l->sock, relpath, info.st_mode, flags | HDR_STRIPED, size) == 0)
+            wire = send_stripes(l, fd, relpath, path, size, hash);
+    } else {
+        set_cork(l->sock, 1);
+        if (txheader(l, l->sock, relpath, info.st_mode, flags, size) == 0)
+            wire = send_body(l, l->sock, &l->accel, fd, 0, size, path, hash);
+    }
+    if (hash && !atomic_load(&l->cancel)) {
+        hash_upto(hash, size);
+        if (th.err)
+            warn("error reading %s", path);
+        txhash(l, th.hash);
+    }
+    set_cork(l->sock, 0);
+    stats_current = NULL;
+    st.wire = wire;
+    cancel = atomic_load(&l->cancel);
+    if (stats_enabled)
+        stats_report("tx", relpath, l->host, &st, !cancel);
+    if (cancel == CANCEL_NEWER)
+        printf("cancelled %s to %s for a newer version\n", relpath, l->host);
+    else if (cancel == 0 && wire != size)
+        printf("transmitting %s %" PRIu64 " as %" PRIu64 " to %s\n", relpath, size, wire, l->host);
+    else if (cancel == 0)
+        printf("transmitting %s %" PRIu64 " to %s\n", relpath, size, l->host);
+    answer = (flags & HDR_HASH) && !cancel;
+
+cleanup_file:
+    close(fd);
+cleanup_path:
+    free(path);
+    return answer;
+}
+
+/* Offer features on sock, one of l's connections, and set *flags to the
+ * header flags the receiver accepted. HDR_STRIPED means striped files may
+ * be sent. Returns -1 if the handshake failed. */
+int txhello(struct link *l, int sock, int features, int streams, uint32_t *flags)
+{
+    unsigned char buf[HELLO_SIZE];
+    uint32_t offer = 0;
+
+    if (features & LINK_COMPRESS)
+        offer |= FEATURE_LZ;
+    if (streams > 0)
+        offer |= FEATURE_STRIPE;
+    offer |= FEATURE_HASH;
+    if (features & LINK_CHUNKS)
+        offer |= FEATURE_CHUNKS;
+    put32(put32(put32(buf, BEAMER_MAGIC), BEAMER_VERSION), offer);
+    if (write_full(sock, buf, sizeof(buf)) == -1 || read_full(sock, buf, sizeof(buf)) != 0) {
+        warn("handshake with receiver %s:%s failed", l->host, l->port);
+        return -1;
+    }
+    if (get32(buf) != BEAMER_MAGIC || get32(buf + 4) != BEAMER_VERSION) {
+        warn("receiver %s:%s is not beamer protocol version %u", l->host, l->port,
+             BEAMER_VERSION);
+        return -1;
+    }
+    *flags = 0;
+    if (get32(buf + 8) & FEATURE_LZ)
+        *flags |= HDR_LZ;
+    else if (features & LINK_COMPRESS)
+        warn("receiver does not support compression");
+    if (get32(buf + 8) & FEATURE_STRIPE)
+        *flags |= HDR_STRIPED;
+    else if (streams > 0)
+        warn("receiver does not support striping");
+    if (get32(buf + 8) & FEATURE_HASH)
+        *flags |= HDR_HASH;
+    if (get32(buf + 8) & FEATURE_CHUNKS)
+        *flags |= HDR_CHUNKED;
+    else if (features & LINK_CHUNKS)
+        warn("receiver has no chunk store");
+    return 0;
+}
+
+void link_close(struct link *l)
+{
+    int i;
+
+    if (l->sock != -1)
+        close(l->sock);
+    l->sock = -1;
+    for (i = 0; i < l->streams; i++) {
+        if (l->stripes[i].sock != -1)
+            close(l->stripes[i].sock);
+        l->stripes[i].sock = -1;
+    }
+}
+
+/* Open the link's connection and, if the receiver takes striped files,
+ * one for each stripe. Returns -1, with every connection closed, if any
+ * of them failed. */
+int link_connect(struct link *l)
+{
+    uint32_t flags;
+    int i;
+
+    l->sock = open_link(l->host, l->port);
+    if (l->sock == -1 || txhello(l, l->sock, l->features, l->streams, &l->flags) == -1) {
+        link_close(l);
+        return -1;
+    }
+    printf("connected to receiver %s\n", l->host);
+    if (!(l->flags & HDR_STRIPED))
+        return 0;
+    for (i = 0; i < l->streams; i++) {
+        struct stripe *s = &l->stripes[i];
+        s->sock = open_link(l->host, l->port);
+        if (s->sock == -1 || txhello(l, s->sock, l->features & LINK_COMPRESS, 0, &flags) == -1) {
+            link_close(l);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Connect, retrying with growing delays while the receiver cannot be
+ * reached. Files queued meanwhile wait for the connection. */
+void link_reconnect(struct link *l)
+{
+    unsigned delay = RETRY_MIN_MS;
+
+    while (link_connect(l) == -1) {
+        struct timespec ts = { delay / 1000, delay % 1000 * 1000000L };
+        warn("cannot connect to receiver %s:%s, retrying in %u ms", l->host, l->port, delay);
+        nanosleep(&ts, NULL);
+        delay = delay * 2 < RETRY_MAX_MS ? delay * 2 : RETRY_MAX_MS;
+    }
+}
+
+/* Queue j on l unless its path is waiting already. Called locked. */
+void queue_job(struct link *l, struct job *j)
+{
+    struct job *w;
+
+    for (w = l->head; w != NULL; w = w->next) {
+        if (strcmp(w->relpath, j->relpath) == 0)
+            break;
+    }
+    if (w != NULL) {
+        free(j->relpath);
+        free(j);
+        return;
+    }
+    j->next = NULL;
+    *l->tail = j;
+    l->tail = &j->next;
+}
+
+/* Act on the receiver's answer for the oldest file sent. A rejected file
+ * is sent again. */
+void answered(struct link *l, int ok)
+{
+    struct job *j = l->unacked;
+
+    l->unacked = j->next;
+    if (l->unacked == NULL)
+        l->unacked_tail = &l->unacked;
+    if (ok) {
+        free(j->relpath);
+        free(j);
+        return;
+    }
+    if (++j->tries >= MAX_TRIES) {
+        warn("%s rejected by %s %d times, giving up", j->relpath, l->host, j->tries);
+        free(j->relpath);
+        free(j);
+        return;
+    }
+    printf("%s rejected by %s, sending it again\n", j->relpath, l->host);
+    pthread_mutex_lock(&l->lock);
+    queue_job(l, j);
+    pthread_mutex_unlock(&l->lock);
+}
+
+/* Read the answers that have arrived, waiting for one first if block is
+ * set. Returns -1 if the connection failed or the receiver closed it. */
+int read_answers(struct link *l, int block)
+{
+    while (l->unacked != NULL) {
+        unsigned char a;
+        ssize_t n;
+
+        n = recv(l->sock, &a, 1, block ? 0 : MSG_DONTWAIT);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n == 0)
+            errno = 0;
+        if (n <= 0)
+            return -1;
+        if (a != ACK_KEPT && a != ACK_RETRY) {
+            errno = EPROTO;
+            return -1;
+        }
+        answered(l, a == ACK_KEPT);
+        block = 0;
+    }
+    return 0;
+}
+
+/* After a connection failure: queue every file still unanswered to be
+ * sent again, since the receiver drops whatever it had not committed, and
+ * reconnect. The other links carry on meanwhile. */
+void link_reset(struct link *l)
+{
+    link_close(l);
+    pthread_mutex_lock(&l->lock);
+    while (l->unacked != NULL) {
+        struct job *j = l->unacked;
+        l->unacked = j->next;
+        queue_job(l, j);
+    }
+    l->unacked_tail = &l->unacked;
+    pthread_mutex_unlock(&l->lock);
+    atomic_store(&l->cancel, 0);
+    link_reconnect(l);
+}
+
+void *link_worker(void *arg)
+{
+    struct link *l = arg;
+
+    link_reconnect(l);
+    for (;;) {
+        struct job *j;
+        int cancel;
+
+        pthread_mutex_lock(&l->lock);
+        while (l->head == NULL) {
+            if (l->unacked == NULL) {
+                pthread_cond_wait(&l->cond, &l->lock);
+                continue;
+            }
+            pthread_mutex_unlock(&l->lock);
+            if (read_answers(l, 1) == -1) {
+                link_lost(l, "reading answers");
+                link_reset(l);
+            }
+            pthread_mutex_lock(&l->lock);
+        }
+        j = l->head;
+        l->head = j->next;
+        if (l->head == NULL)
+            l->tail = &l->head;
+        l->current = j->relpath;
+        pthread_mutex_unlock(&l->lock);
+
+        if (send_path(l, j)) {
+            j->next = NULL;
+            *l->unacked_tail = j;
+            l->unacked_tail = &j->next;
+            j = NULL;
+        }
+
+        pthread_mutex_lock(&l->lock);
+        l->current = NULL;
+        pthread_mutex_unlock(&l->lock);
+        cancel = atomic_load(&l->cancel);
+        if (cancel == CANCEL_NEWER) {
+            /* The receiver drops a file cut short when the connection
+             * closes, after answering for the files before it. Wait for
+             * each answer until it closes its side too; any answer lost
+             * with the connection counts as a rejection. */
+            shutdown(l->sock, SHUT_WR);
+            while (l->unacked != NULL && read_answers(l, 1) == 0)
+                ;
+            while (l->unacked != NULL)
+                answered(l, 0);
+            link_close(l);
+            atomic_store(&l->cancel, 0);
+            link_reconnect(l);
+        } else if (cancel == 0 && read_answers(l, 0) == -1) {
+            link_lost(l, "reading answers");
+            cancel = CANCEL_LOST;
+        }
+        if (cancel & CANCEL_LOST) {
+            /* Unless a newer version is queued already, this one still
+             * has to reach the receiver. */
+            if (j != NULL) {
+                pthread_mutex_lock(&l->lock);
+                queue_job(l, j);
+                pthread_mutex_unlock(&l->lock);
+                j = NULL;
+            }
+            link_reset(l);
+        }
+        if (j != NULL) {
+            free(j->relpath);
+            free(j);
+        }
+    }
+    return NULL;
+}
+
+struct link *link_open(const char *host, const char *port, const char *root, int features,
+                       int streams)
+{
+    struct link *l;
+    int i;
+
+    l = calloc(1, sizeof(*l));
+    if (l == NULL || (l->host = strdup(host)) == NULL || (l->port = strdup(port)) == NULL) {
+        fatal("memory error");
+    }
+    l->root = root;
+    l->features = features;
+    l->accel = 1;
+    l->tail = &l->head;
+    l->unacked_tail = &l->unacked;
+    l->sock = -1;
+    l->streams = streams;
+    if (streams > 0) {
+        l->stripes = calloc(streams, sizeof(*l->stripes));
+        if (l->stripes == NULL) {
+            fatal("memory error");
+        }
+        for (i = 0; i < streams; i++) {
+            l->stripes[i].l = l;
+            l->stripes[i].sock = -1;
+            l->stripes[i].accel = 1;
+        }
+        if (getrandom(&l->next_id, sizeof(l->next_id), 0) != sizeof(l->next_id)) {
+            fatal("getrandom");
+        }
+    }
+    pthread_mutex_init(&l->lock, NULL);
+    pthread_cond_init(&l->cond, NULL);
+    if (pthread_create(&l->thread, NULL, link_worker, l) != 0) {
+        fatal("pthread_create");
+    }
+    return l;
+}
+
+struct link *links_open(const char *hosts, const char *port, const char *root, int features,
+                        int streams)
+{
+    struct link *links = NULL, **tail = &links;
+    char *list, *item, *save;
+
+    list = strdup(hosts);
+    if (list == NULL) {
+        fatal("memory error");
+    }
+    for (item = strtok_r(list, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        char *colon = strrchr(item, ':');
+        if (colon)
+            *colon = 0;
+        *tail = link_open(item, colon ? colon + 1 : port, root, features, streams);
+        tail = &(*tail)->next;
+    }
+    free(list);
+    if (links == NULL) {
+        fatal("no receivers in %s", hosts);
+    }
+    return links;
+}
+
+void links_queue(struct link *links, const char *relpath, uint64_t seen)
+{
+    struct link *l;
+
+    for (l = links; l != NULL; l = l->next) {
+        struct job *j;
+
+        pthread_mutex_lock(&l->lock);
+        if (l->current && strcmp(l->current, relpath) == 0)
+            atomic_fetch_or(&l->cancel, CANCEL_NEWER);
+        for (j = l->head; j != NULL; j = j->next) {
+            if (strcmp(j->relpath, relpath) == 0)
+                break;
+        }
+        if (j == NULL) {
+            j = calloc(1, sizeof(*j));
+            if (j == NULL || (j->relpath = strdup(relpath)) == NULL) {
+                fatal("memory error");
+            }
+            j->seen = seen;
+            queue_job(l, j);
+            pthread_cond_signal(&l->cond);
+        }
+        pthread_mutex_unlock(&l->lock);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+
+/* Features a link asks of its receiver. */
+#define LINK_DELTA 0x1
+#define LINK_COMPRESS 0x2
+#define LINK_CHUNKS 0x4
+
+/* Connection from a tree of files to one receiver. Each link has its own
+ * thread and queue of paths to send, so a slow receiver does not hold up
+ * the others. Every link reads the same files, which after the first
+ * transfer come from the page cache rather than the disk. */
+struct link;
+
+/* Open a link to every receiver in hosts, a comma separated list of host
+ * or host:port, and return them chained together. port is used where none
+ * is given. Each link connects on its own thread, and reconnects if the
+ * connection fails, while the others carry on. Paths queued are relative
+ * to root. With streams above zero each link opens that many more
+ * connections and sends large files in ranges across them at once. */
+struct link *links_open(const char *hosts, const char *port, const char *root, int features,
+                        int streams);
+
+/* Send the file or directory relpath to every link. A path already waiting
+ * on a link is not queued twice, and a transfer of relpath in progress is
+ * cancelled by reconnecting, since the newer version replaces it anyway.
+ * seen is the now_ns() time the change was noticed. */
+void links_queue(struct link *links, const char *relpath, uint64_t seen);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define MIN_MATCH 4
+#define MF_LIMIT 12
+#define LAST_LITERALS 5
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static unsigned hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+/* Length of the match between ip and ref, stopping at limit. */
+static size_t match_len(const unsigned char *src, size_t ip, size_t ref, size_t limit)
+{
+    size_t len = MIN_MATCH;
+    while (ip + len + 8 <= limit) {
+        uint64_t diff = read64(src + ip + len) ^ read64(src + ref + len);
+        if (diff) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return len + (__builtin_ctzll(diff) >> 3);
+#else
+            return len + (__builtin_clzll(diff) >> 3);
+#endif
+        }
+        len += 8;
+    }
+    while (ip + len < limit && src[ip + len] == src[ref + len])
+        len++;
+    return len;
+}
+
+/* Lengths of 15 or more continue in bytes of 255 and a remainder. */
+static unsigned char *put_len(unsigned char *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+static unsigned char *put_sequence(unsigned char *op, const unsigned char *lit, size_t nlit,
+                                   size_t offset, size_t mlen)
+{
+    unsigned char *token = op++;
+    *token = (unsigned char)((nlit >= 15 ? 15 : nlit) << 4);
+    if (nlit >= 15)
+        op = put_len(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen == 0)
+        return op;
+    *op++ = (unsigned char)offset;
+    *op++ = (unsigned char)(offset >> 8);
+    mlen -= MIN_MATCH;
+    *token |= (unsigned char)(mlen >= 15 ? 15 : mlen);
+    if (mlen >= 15)
+        op = put_len(op, mlen - 15);
+    return op;
+}
+
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap, int accel)
+{
+    uint32_t table[1 << HASH_BITS];
+    unsigned char *op = dst, *oend = dst + cap;
+    size_t ip = 0, anchor = 0, misses = 0;
+
+    if (accel < 1)
+        accel = 1;
+    memset(table, 0, sizeof(table));
+    while (n > MF_LIMIT && ip < n - MF_LIMIT) {
+        uint32_t v = read32(src + ip);
+        unsigned h = hash32(v);
+        size_t ref = table[h];
+        table[h] = (uint32_t)ip;
+        if (ref >= ip || ip - ref > MAX_OFFSET || read32(src + ref) != v) {
+            ip += accel + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+        while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+            ip--;
+            ref--;
+        }
+        size_t mlen = match_len(src, ip, ref, n - LAST_LITERALS);
+        size_t nlit = ip - anchor;
+        if ((size_t)(oend - op) < nlit + nlit / 255 + mlen / 255 + 8)
+            return 0;
+        op = put_sequence(op, src + anchor, nlit, ip - ref, mlen);
+        ip += mlen;
+        anchor = ip;
+    }
+    size_t nlit = n - anchor;
+    if ((size_t)(oend - op) < nlit + nlit / 255 + 2)
+        return 0;
+    op = put_sequence(op, src + anchor, nlit, 0, 0);
+    return op - dst;
+}
+
+static int get_len(const unsigned char **ip, const unsigned char *iend, size_t *len)
+{
+    unsigned char b;
+    do {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+long lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap)
+{
+    const unsigned char *ip = src, *iend = src + n;
+    unsigned char *op = dst, *oend = dst + cap;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && get_len(&ip, iend, &nlit) != 0)
+            return -1;
+        if ((size_t)(iend - ip) < nlit || (size_t)(oend - op) < nlit)
+            return -1;
+        memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+        size_t mlen = token & 15;
+        if (mlen == 15 && get_len(&ip, iend, &mlen) != 0)
+            return -1;
+        mlen += MIN_MATCH;
+        if ((size_t)(oend - op) < mlen)
+            return -1;
+        const unsigned char *ref = op - offset;
+        if (offset >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            while (mlen--)
+                *op++ = *ref++;
+        }
+    }
+    return op - dst;
+}
@@ -0,0 +1,25 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/* LZ77 codec producing the LZ4 block format: a fast greedy match finder
+ * over a small hash table, no entropy coding. Its blocks decode with the
+ * reference LZ4 library and it decodes theirs; test_lz checks both, and
+ * that truncated or corrupt blocks are rejected. */
+
+/* Largest compressed size of n input bytes. */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+#define LZ_ACCEL_MAX 64
+
+/* Compress n bytes of src into dst. accel from 1 to LZ_ACCEL_MAX trades
+ * ratio for speed. Returns the compressed size, or 0 if it would exceed
+ * cap. */
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap, int accel);
+
+/* Returns the decompressed size, or -1 if src is malformed or would
+ * exceed cap. */
+long lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+#endif
@@ -0,0 +1,1817 @@
+/* Receiver side of beamer. Any number of transmitters are served from one
+ * epoll loop: each connection is a state machine over its nonblocking
+ * socket, advanced only as far as the data already received allows, so a
+ * slow or stalled transmitter never holds up the others. Two connections
+ * sending the same destination path take turns; the second waits, without
+ * reading, until the first has renamed its copy into place. A striped file
+ * is written by several connections at once, each at its own offset. */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "beamer.h"
+#include "chunk.h"
+#include "delta.h"
+#include "link.h"
+#include "lz.h"
+#include "receiver.h"
+#include "stats.h"
+#include "tasks.h"
+#include "uring.h"
+#include "zstream.h"
+
+#define MAX_EVENTS 64
+
+/* Steps a connection takes per wakeup before yielding to the others. */
+#define STEP_BUDGET 64
+
+enum conn_state {
+    ST_HELLO,       /* reading the transmitter's hello */
+    ST_HEADER,      /* reading a file header */
+    ST_PATH,        /* reading the path that follows it */
+    ST_LOCKED,      /* waiting for another connection to finish the path */
+    ST_DELTA_REC,   /* reading a delta record */
+    ST_RAW,         /* moving uncompressed content to the file */
+    ST_ZREC,        /* reading a compressed record */
+    ST_ZDATA,       /* reading the compressed bytes of a record */
+    ST_STRIPE_INFO, /* reading the id and range count of a striped file */
+    ST_STRIPED,     /* waiting for the ranges of a striped file */
+    ST_RANGE_INFO,  /* reading the id and offset of a range */
+    ST_RANGE_WAIT,  /* waiting for the striped file a range belongs to */
+    ST_CHUNK_COUNT, /* reading the number of chunks in a manifest */
+    ST_MANIFEST,    /* reading the chunk records of a manifest */
+    ST_TRAILER,     /* reading the hash that follows the content */
+    ST_DISK,        /* waiting for disk work on a task worker */
+    ST_HASH         /* waiting for the end of the file to be hashed */
+};
+
+/* Result of one step of a connection. */
+enum step {
+    STEP_NEXT,      /* progress made, keep going */
+    STEP_WAIT,      /* nothing more until the socket is ready */
+    STEP_CLOSE,     /* error, already reported */
+    STEP_EOF        /* the transmitter closed the connection */
+};
+
+/* A new copy of path is written to a temporary file in the same
+ * directory and renamed over path once complete, so readers see either
+ * the old or the new file, never a partial one. */
+struct tmpfile {
+    const char *path;
+    char *tmp;
+    int fd;
+};
+
+struct dest_lock;
+struct transfer;
+struct disk_job;
+
+struct conn {
+    int sock;
+    enum conn_state state;
+    uint32_t events;            /* currently registered with epoll */
+
+    /* Input being assembled and how much of it has arrived. */
+    unsigned char buf[FILE_HEADER_SIZE + PATH_MAX];
+    size_t have;
+    size_t need;
+
+    /* Reply waiting for the socket to accept it. */
+    unsigned char *out;
+    size_t out_len;
+    size_t out_pos;
+
+    /* File being received. fd is the temporary file, or -1 when the
+     * content is read and dropped. For a range it is a duplicate of the
+     * owner's descriptor, written at pos. */
+    struct file_header hdr;
+    char relpath[PATH_MAX + 1];
+    char *path;
+    mode_t mode;
+    struct tmpfile tf;
+    int fd;
+    int piping[2];
+    uint64_t left;              /* bytes left in the current body */
+    uint64_t total;
+    uint64_t literal;
+    struct xfer_stats stats;
+    char peer[INET_ADDRSTRLEN];
+    uint64_t hash;              /* the transmitter's, with HDR_HASH */
+    uint64_t written;           /* bytes written in order from the start */
+    uint64_t hashed;            /* bytes of those hashed so far */
+    uint64_t sum;               /* their hash, see hash_fd() */
+    int hash_err;
+    struct disk_job *hashing;   /* hash running on a task worker */
+    struct disk_job *job;       /* other disk work, waited for in ST_DISK */
+    int range;
+    loff_t pos;
+    uint64_t xfer_id;
+    struct transfer *xfer;      /* striped file owned or written */
+
+    /* Delta transfer: the previous copy and its signatures. */
+    int oldfd;
+    struct delta_sigs sigs;
+
+    /* Manifest of a chunked file, the chunks missing from the store and
+     * the next chunk to place. Chunks up to run_end arrive as one body. */
+    struct chunk_list chunks;
+    unsigned char *manifest;
+    unsigned char *missing;
+    uint64_t chunk_next;
+    uint64_t run_end;
+
+    /* Compressed record being read. */
+    uint32_t clen;
+    uint32_t rlen;
+    unsigned char *zin;
+    unsigned char *zout;
+
+    struct dest_lock *lock;     /* held, or waited for in ST_LOCKED */
+    struct conn *next_waiter;
+};
+
+/* Striped file, written by ranges arriving on other connections while
+ * its owner, the connection that sent the header, waits. */
+struct transfer {
+    uint64_t id;
+    struct conn *owner;         /* NULL once the owner has gone */
+    uint64_t size;
+    uint32_t ranges;            /* not yet finished */
+    int refs;                   /* owner and attached ranges */
+    int failed;
+    struct transfer *next;
+};
+
+/* Disk work for a connection on a task worker. c is NULL once the
+ * connection has moved on, and the result is then dropped. Whatever the
+ * job reads it owns while it runs: a duplicate of the descriptor, and
+ * the connection's chunk list and bitmap, which it hands back. */
+struct disk_job {
+    struct conn *c;
+    int fd;
+    int ret;
+    uint64_t ns;
+
+    /* Hash of the file from off to end, UINT64_MAX for all the rest. */
+    uint64_t off;
+    uint64_t end;
+    uint64_t hash;
+
+    /* Signatures of the current copy of a delta's file, size bytes. */
+    uint64_t size;
+    struct delta_sigs sigs;
+
+    /* Chunks from first to last, to look up in the store, copy from it
+     * or add to it. */
+    struct chunk_list chunks;
+    unsigned char *missing;
+    uint64_t first;
+    uint64_t last;
+    char *relpath;
+};
+
+/* Destination path being written, with the connections queued for it. */
+struct dest_lock {
+    char *path;
+    struct conn *owner;
+    struct conn *waiters;
+    struct dest_lock *next;
+};
+
+static const struct receiver_opts *opts;
+static const char *recv_root;
+static struct link *relays;
+static int epfd = -1;
+static struct dest_lock *locks;
+static struct transfer *transfers;
+static struct uring ring;
+static int ring_ok;
+static struct conn *range_waiters;
+static unsigned char scratch[65536];
+
+int create_dir(const char *path, mode_t mode)
+{
+    int ret;
+    ret = create_path(path);
+    if (ret == 0)
+        ret = mkdir(path, mode);
+    if (ret != 0 && errno == EEXIST)
+        ret = chmod(path, mode);
+    return ret;
+}
+
+/* Relative paths from the transmitter must stay below the receiver's
+ * directory. */
+int valid_relpath(const char *path)
+{
+    const char *p = path;
+
+    if (STR_ISEMPTY(path) || *path == PATH_SEP)
+        return 0;
+    while (*p) {
+        const char *end = strchr(p, PATH_SEP);
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 0 || (len == 2 && p[0] == '.' && p[1] == '.'))
+            return 0;
+        p += len;
+        if (*p)
+            p++;
+    }
+    return 1;
+}
+
+/* Append len bytes of src at off to fd, in the kernel where possible. */
+int copy_range(int src, uint64_t off, int fd, uint64_t len)
+{
+    loff_t in = off;
+    while (len > 0) {
+        ssize_t ret;
+        ret = copy_file_range(src, &in, fd, NULL, len, 0);
+        if (ret == -1 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL))
+            break;
+        if (ret <= 0)
+            return -1;
+        len -= ret;
+    }
+    while (len > 0) {
+        char buf[65536];
+        size_t n = len < sizeof(buf) ? len : sizeof(buf);
+        ssize_t ret;
+        ret = pread(src, buf, n, in);
+        if (ret <= 0 || write_full(fd, buf, ret) == -1)
+            return -1;
+        in += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* Keep the current copy of path as path.prev. A hard link leaves path
+ * in place until the new copy replaces it. */
+void backup_file(const char *path)
+{
+    size_t len = strlen(path) + 5;
+    char *bakpath;
+    bakpath = alloca(len + 1);
+    *bakpath = 0;
+    strncpy(bakpath, path, len);
+    strncat(bakpath, ".prev", len);
+    int ret;
+    unlink(bakpath);
+    ret = link(path, bakpath);
+    if (ret != 0 && errno != ENOENT)
+        ret = rename(path, bakpath);
+    if (ret != 0 && errno != ENOENT) {
+        info("rename %s %s", path, bakpath);
+    }
+}
+
+int open_temp(struct tmpfile *tf, const char *path, uint64_t size)
+{
+    const char *base = strrchr(path, PATH_SEP);
+    size_t dirlen = base ? (size_t)(base - path + 1) : 0;
+
+    base = base ? base + 1 : path;
+    tf->path = path;
+    tf->tmp = malloc(strlen(path) + 16);
+    if (tf->tmp == NULL) {
+        fatal("memory error");
+    }
+    sprintf(tf->tmp, "%.*s.%s.XXXXXX", (int)dirlen, path, base);
+    if (create_path(path) != 0)
+        goto fail;
+    tf->fd = mkstemp(tf->tmp);
+    if (tf->fd == -1)
+        goto fail;
+    if (opts->preallocate && size > 0) {
+        int ret = fallocate(tf->fd, FALLOC_FL_KEEP_SIZE, 0, size);
+        if (ret != 0 && errno != EOPNOTSUPP) {
+            warn("cannot allocate %" PRIu64 " bytes for %s", size, path);
+            unlink(tf->tmp);
+            close(tf->fd);
+            goto fail;
+        }
+    }
+    return 0;
+
+fail:
+    free(tf->tmp);
+    return -1;
+}
+
+void abort_temp(struct tmpfile *tf)
+{
+    unlink(tf->tmp);
+    close(tf->fd);
+    free(tf->tmp);
+}
+
+/* Swap the completed temporary file into place. */
+int commit_temp(struct tmpfile *tf, mode_t mode)
+{
+    if (fchmod(tf->fd, mode) == -1)
+        warn("error writing file mode %o\n", mode);
+    if (opts->fsync && fdatasync(tf->fd) == -1)
+        goto fail;
+    backup_file(tf->path);
+    if (rename(tf->tmp, tf->path) == -1)
+        goto fail;
+    if (opts->fsync) {
+        /* Make the rename itself durable. */
+        char *dir = strdup(tf->path);
+        char *slash = strrchr(dir, PATH_SEP);
+        int dfd;
+        if (slash)
+            *slash = 0;
+        dfd = open(slash ? dir : ".", O_RDONLY | O_DIRECTORY);
+        if (dfd != -1) {
+            fsync(dfd);
+            close(dfd);
+        }
+        free(dir);
+    }
+    close(tf->fd);
+    free(tf->tmp);
+    return 0;
+
+fail:
+    warn("error replacing %s", tf->path);
+    abort_temp(tf);
+    return -1;
+}
+
+/* Stop writing the current file after an error but keep reading its
+ * content so the stream stays in step. */
+void drop_file(struct conn *c)
+{
+    if (c->fd != -1 && c->range) {
+        close(c->fd);
+        c->xfer->failed = 1;
+        c->fd = -1;
+    } else if (c->fd != -1) {
+        abort_temp(&c->tf);
+        c->fd = -1;
+    }
+}
+
+/* Write at the range's offset, or the file position otherwise. */
+int write_out(struct conn *c, const unsigned char *buf, size_t len)
+{
+    if (!c->range)
+        return write_full(c->fd, buf, len);
+    while (len > 0) {
+        ssize_t ret;
+        ret = pwrite(c->fd, buf, len, c->pos);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        buf += ret;
+        len -= ret;
+        c->pos += ret;
+    }
+    return 0;
+}
+
+void update_events(struct conn *c)
+{
+    struct epoll_event ev;
+    uint32_t events;
+
+    if (c->out)
+        events = EPOLLOUT;
+    else if (c->state == ST_LOCKED || c->state == ST_STRIPED || c->state == ST_DISK ||
+             c->state == ST_HASH)
+        events = 0;
+    else if (c->state == ST_RANGE_WAIT)
+        events = EPOLLRDHUP;    /* the owner may never come */
+    else
+        events = EPOLLIN;
+    if (events == c->events)
+        return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->sock, &ev) == -1) {
+        fatal("epoll_ctl: transmitter sock");
+    }
+    c->events = events;
+}
+
+/* Queue buf, which the connection takes over, to be sent after any reply
+ * already waiting and before anything more is read. */
+void queue_out(struct conn *c, unsigned char *buf, size_t len)
+{
+    unsigned char *out;
+
+    if (c->out == NULL) {
+        c->out = buf;
+        c->out_len = len;
+        c->out_pos = 0;
+        return;
+    }
+    out = realloc(c->out, c->out_len + len);
+    if (out == NULL) {
+        fatal("memory error");
+    }
+    memcpy(out + c->out_len, buf, len);
+    c->out = out;
+    c->out_len += len;
+    free(buf);
+}
+
+int flush_out(struct conn *c)
+{
+    while (c->out_pos < c->out_len) {
+        ssize_t ret;
+        ret = send(c->sock, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return STEP_WAIT;
+        if (ret == -1) {
+            warn("error transmitting reply");
+            return STEP_CLOSE;
+        }
+        c->out_pos += ret;
+    }
+    free(c->out);
+    c->out = NULL;
+    return STEP_NEXT;
+}
+
+/* Read until dst holds need bytes, counting from c->have. */
+int fill(struct conn *c, unsigned char *dst, size_t need)
+{
+    while (c->have < need) {
+        ssize_t ret;
+        ret = recv(c->sock, dst + c->have, need - c->have, 0);
+        if (ret == 0)
+            return STEP_EOF;
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return STEP_WAIT;
+        if (ret == -1) {
+            warn("error receiving data");
+            return STEP_CLOSE;
+        }
+        c->have += ret;
+    }
+    c->have = 0;
+    return STEP_NEXT;
+}
+
+/* Take the lock on c->path, or queue for it. Returns 1 if taken. */
+int lock_dest(struct conn *c)
+{
+    struct dest_lock *l;
+    struct conn **w;
+
+    for (l = locks; l != NULL; l = l->next) {
+        if (strcmp(l->path, c->path) == 0)
+            break;
+    }
+    if (l == NULL) {
+        l = calloc(1, sizeof(*l));
+        if (l == NULL || (l->path = strdup(c->path)) == NULL) {
+            fatal("memory error");
+        }
+        l->owner = c;
+        l->next = locks;
+        locks = l;
+        c->lock = l;
+        return 1;
+    }
+    for (w = &l->waiters; *w != NULL; w = &(*w)->next_waiter)
+        ;
+    *w = c;
+    c->next_waiter = NULL;
+    c->lock = l;
+    return 0;
+}
+
+void begin_file(struct conn *c);
+
+/* Release or stop waiting for c->lock, handing it to the next waiter. */
+void unlock_dest(struct conn *c)
+{
+    struct dest_lock *l = c->lock, **lp;
+    struct conn **w, *next;
+
+    if (l == NULL)
+        return;
+    c->lock = NULL;
+    if (l->owner != c) {
+        for (w = &l->waiters; *w != c; w = &(*w)->next_waiter)
+            ;
+        *w = c->next_waiter;
+        return;
+    }
+    next = l->waiters;
+    if (next != NULL) {
+        l->waiters = next->next_waiter;
+        l->owner = next;
+        begin_file(next);
+        update_events(next);
+        return;
+    }
+    for (lp = &locks; *lp != l; lp = &(*lp)->next)
+        ;
+    *lp = l->next;
+    free(l->path);
+    free(l);
+}
+
+struct disk_job *new_job(struct conn *c)
+{
+    struct disk_job *j;
+
+    j = calloc(1, sizeof(*j));
+    if (j == NULL) {
+        fatal("memory error");
+    }
+    j->c = c;
+    j->fd = -1;
+    return j;
+}
+
+void free_job(struct disk_job *j)
+{
+    delta_sigs_free(&j->sigs);
+    chunk_list_free(&j->chunks);
+    free(j->missing);
+    free(j->relpath);
+    free(j);
+}
+
+/* Run do_job on a task worker with c waiting in ST_DISK, then done. */
+void wait_job(struct conn *c, struct disk_job *j, void (*do_job)(void *arg),
+              void (*done)(void *arg))
+{
+    c->job = j;
+    c->state = ST_DISK;
+    tasks_submit(do_job, done, j);
+}
+
+void hash_run(void *arg)
+{
+    struct disk_job *j = arg;
+    uint64_t start = now_ns();
+
+    j->ret = j->fd == -1 ? -1 : hash_pieces(j->fd, j->off, j->end, &j->hash);
+    j->ns = now_ns() - start;
+    if (j->fd != -1)
+        close(j->fd);
+}
+
+void hash_done(void *arg);
+
+/* Hash c's file from c->hashed up to end on a task worker. */
+void start_hash(struct conn *c, uint64_t end)
+{
+    struct disk_job *j = new_job(c);
+
+    j->fd = dup(c->fd);
+    j->off = c->hashed;
+    j->end = end;
+    j->hash = c->sum;
+    c->hashing = j;
+    tasks_submit(hash_run, hash_done, j);
+}
+
+/* Hash the whole pieces written so far, unless a hash is running already,
+ * so that little is left to read once the file is complete. Ranges of a
+ * striped file arrive out of order, so it is hashed only at the end. */
+void hash_ahead(struct conn *c)
+{
+    uint64_t end = c->written / HASH_PIECE * HASH_PIECE;
+
+    if ((c->hdr.flags & HDR_HASH) && !c->range && c->fd != -1 && !c->hash_err &&
+        c->hashing == NULL && end > c->hashed)
+        start_hash(c, end);
+}
+
+/* Count n bytes appended to c's file. */
+void note_written(struct conn *c, uint64_t n)
+{
+    c->written += n;
+    hash_ahead(c);
+}
+
+void commit_file(struct conn *c);
+
+/* The content of the file received on c is complete. With HDR_HASH the
+ * transmitter's hash follows, read in ST_TRAILER. */
+void finish_file(struct conn *c)
+{
+    if (c->fd != -1 && (c->hdr.flags & HDR_DELTA) && c->total != c->hdr.size) {
+        warn("delta for %s produced %" PRIu64 " bytes, expected %" PRIu64,
+             c->path, c->total, c->hdr.size);
+        drop_file(c);
+    }
+    if (c->hdr.flags & HDR_HASH) {
+        c->state = ST_TRAILER;
+        return;
+    }
+    commit_file(c);
+}
+
+/* Read the transmitter's hash, then commit the file once the rest of it
+ * has been hashed, waiting in ST_HASH meanwhile. */
+int step_trailer(struct conn *c)
+{
+    int ret;
+
+    ret = fill(c, c->buf, HASH_SIZE);
+    if (ret != STEP_NEXT)
+        return ret;
+    c->hash = get64(c->buf);
+    if (c->fd != -1 && !c->hash_err) {
+        c->state = ST_HASH;
+        if (c->hashing == NULL)
+            start_hash(c, UINT64_MAX);
+        return STEP_NEXT;
+    }
+    commit_file(c);
+    return STEP_NEXT;
+}
+
+void hash_done(void *arg)
+{
+    struct disk_job *j = arg;
+    struct conn *c = j->c;
+
+    if (c == NULL) {
+        free_job(j);
+        return;
+    }
+    c->hashing = NULL;
+    c->stats.disk_ns += j->ns;
+    if (j->ret == -1)
+        c->hash_err = 1;
+    c->hashed = j->end;
+    c->sum = j->hash;
+    if (c->state != ST_HASH) {
+        hash_ahead(c);
+    } else if (j->end != UINT64_MAX && !c->hash_err) {
+        start_hash(c, UINT64_MAX);
+    } else {
+        commit_file(c);
+        update_events(c);
+    }
+    free_job(j);
+}
+
+/* Rename the file received on c into place. With HDR_HASH the transmitter
+ * is told whether it matched and was kept. */
+void commit_file(struct conn *c)
+{
+    uint64_t start = now_ns();
+    unsigned char *ack;
+    int ok;
+
+    if (c->hashing) {
+        c->hashing->c = NULL;
+        c->hashing = NULL;
+    }
+    if (c->hdr.flags & HDR_HASH) {
+        ack = malloc(1);
+        if (ack == NULL) {
+            fatal("memory error");
+        }
+        *ack = ACK_KEPT;
+        if (c->fd != -1 && (c->hash_err || c->sum != c->hash)) {
+            warn("checksum mismatch for %s, asking for it again", c->path);
+            drop_file(c);
+            *ack = ACK_RETRY;
+        }
+        queue_out(c, ack, 1);
+    }
+    ok = c->fd != -1 && commit_temp(&c->tf, c->mode) == 0;
+    c->stats.disk_ns += now_ns() - start;
+    if (stats_enabled)
+        stats_report("rx", c->relpath, c->peer, &c->stats, ok);
+    if (ok) {
+        if (c->hdr.flags & HDR_DELTA)
+            printf("received %" PRIu64 " bytes (%" PRIu64 " literal) written to %s\n",
+                   c->total, c->literal, c->path);
+        else
+            printf("received %" PRIu64 " bytes written to %s\n", c->hdr.size, c->path);
+        if (relays)
+            links_queue(relays, c->relpath, c->stats.queued);
+    }
+    c->fd = -1;
+    delta_sigs_free(&c->sigs);
+    chunk_list_free(&c->chunks);
+    free(c->missing);
+    c->missing = NULL;
+    if (c->oldfd != -1) {
+        close(c->oldfd);
+        c->oldfd = -1;
+    }
+    unlock_dest(c);
+    free(c->path);
+    c->path = NULL;
+    c->state = ST_HEADER;
+}
+
+void finish_transfer(struct transfer *t);
+
+/* Stop ranges finding t. */
+void forget_transfer(struct transfer *t)
+{
+    struct transfer **tp;
+
+    for (tp = &transfers; *tp != t; tp = &(*tp)->next)
+        ;
+    *tp = t->next;
+}
+
+/* A range is complete, or failed, and the connection moves on. */
+void range_done(struct conn *c, int ok)
+{
+    struct transfer *t = c->xfer;
+
+    if (c->fd != -1)
+        close(c->fd);
+    c->fd = -1;
+    c->range = 0;
+    c->xfer = NULL;
+    c->state = ST_HEADER;
+    if (!ok)
+        t->failed = 1;
+    if (t->owner)
+        stats_add(&t->owner->stats, &c->stats);
+    t->ranges--;
+    t->refs--;
+    if (t->owner && t->ranges == 0)
+        finish_transfer(t);
+    else if (t->refs == 0)
+        free(t);
+}
+
+void next_chunks(struct conn *c);
+
+/* The current body is complete: back to the delta records or done. */
+void body_done(struct conn *c)
+{
+    if (c->range) {
+        range_done(c, 1);
+    } else if (c->hdr.flags & HDR_CHUNKED) {
+        c->chunk_next = c->run_end;
+        next_chunks(c);
+    }
+    else if (c->hdr.flags & HDR_DELTA)
+        c->state = ST_DELTA_REC;
+    else
+        finish_file(c);
+}
+
+void start_body(struct conn *c, uint64_t len)
+{
+    c->left = len;
+    c->state = (c->hdr.flags & HDR_LZ) ? ST_ZREC : ST_RAW;
+    if (len == 0)
+        body_done(c);
+}
+
+unsigned char *encode_sigs(const struct delta_sigs *sigs, size_t *len)
+{
+    unsigned char *buf, *p;
+    uint64_t i;
+
+    *len = SIGS_HEADER_SIZE + sigs->count * SIG_SIZE;
+    buf = malloc(*len);
+    if (buf == NULL) {
+        fatal("memory error");
+    }
+    p = put32(buf, sigs->block_size);
+    p = put32(p, 0);
+    p = put64(p, sigs->size);
+    for (i = 0; i < sigs->count; i++) {
+        p = put32(p, sigs->sig[i].weak);
+        p = put64(p, sigs->sig[i].strong);
+    }
+    return buf;
+}
+
+void sign_run(void *arg)
+{
+    struct disk_job *j = arg;
+    uint64_t start = now_ns();
+
+    j->ret = delta_sign(j->fd, j->size, &j->sigs);
+    if (j->ret != 0)
+        delta_sign(-1, 0, &j->sigs);
+    j->ns = now_ns() - start;
+    if (j->fd != -1)
+        close(j->fd);
+}
+
+void sign_done(void *arg)
+{
+    struct disk_job *j = arg;
+    struct conn *c = j->c;
+    unsigned char *buf;
+    size_t len;
+
+    if (c != NULL) {
+        c->job = NULL;
+        c->stats.disk_ns += j->ns;
+        if (j->ret != 0)
+            warn("error reading %s, sending it whole", c->path);
+        c->sigs = j->sigs;
+        memset(&j->sigs, 0, sizeof(j->sigs));
+        buf = encode_sigs(&c->sigs, &len);
+        queue_out(c, buf, len);
+        c->state = ST_DELTA_REC;
+        update_events(c);
+    }
+    free_job(j);
+}
+
+/* Start writing c->path, which c holds the lock for. For a delta the
+ * current copy is signed on a task worker and the signatures queued
+ * before anything more is read. */
+void begin_file(struct conn *c)
+{
+    c->stats.started = now_ns();
+    c->total = 0;
+    c->literal = 0;
+    c->written = 0;
+    c->hashed = 0;
+    c->sum = 0;
+    c->hash_err = 0;
+
+    c->fd = -1;
+    if (open_temp(&c->tf, c->path, c->hdr.size) == -1)
+        warn("error creating file %s", c->path);
+    else
+        c->fd = c->tf.fd;
+
+    if (c->hdr.flags & HDR_DELTA) {
+        struct disk_job *j = new_job(c);
+        struct stat info;
+
+        c->oldfd = open(c->path, O_RDONLY);
+        if (c->oldfd != -1 && (fstat(c->oldfd, &info) == -1 || !S_ISREG(info.st_mode))) {
+            close(c->oldfd);
+            c->oldfd = -1;
+        }
+        if (c->oldfd != -1) {
+            j->fd = dup(c->oldfd);
+            j->size = info.st_size;
+        }
+        wait_job(c, j, sign_run, sign_done);
+    } else if (c->hdr.flags & HDR_STRIPED) {
+        c->state = ST_STRIPE_INFO;
+    } else if (c->hdr.flags & HDR_CHUNKED) {
+        c->state = ST_CHUNK_COUNT;
+    } else {
+        start_body(c, c->hdr.size);
+    }
+}
+
+/* Find which of the job's chunks the store lacks. */
+void lookup_run(void *arg)
+{
+    struct disk_job *j = arg;
+    uint64_t i, start = now_ns();
+
+    for (i = 0; i < j->chunks.count; i++) {
+        char *path = chunk_path(opts->cache, j->chunks.chunk[i].id);
+        if (access(path, F_OK) != 0)
+            j->missing[i / 8] |= 1 << (i % 8);
+        free(path);
+    }
+    j->ns = now_ns() - start;
+}
+
+void next_chunks(struct conn *c);
+
+/* Answer the manifest with the chunks missing and start placing them. */
+void answer_manifest(struct conn *c)
+{
+    size_t len = (c->chunks.count + 7) / 8;
+    unsigned char *reply;
+
+    reply = malloc(len);
+    if (reply == NULL) {
+        fatal("memory error");
+    }
+    memcpy(reply, c->missing, len);
+    queue_out(c, reply, len);
+    c->chunk_next = 0;
+    next_chunks(c);
+}
+
+void lookup_done(void *arg)
+{
+    struct disk_job *j = arg;
+    struct conn *c = j->c;
+
+    if (c != NULL) {
+        c->job = NULL;
+        c->stats.disk_ns += j->ns;
+        c->chunks = j->chunks;
+        c->missing = j->missing;
+        memset(&j->chunks, 0, sizeof(j->chunks));
+        j->missing = NULL;
+        answer_manifest(c);
+        update_events(c);
+    }
+    free_job(j);
+}
+
+/* Append the job's chunks from first to last from the store to the file. */
+void copy_run(void *arg)
+{
+    struct disk_job *j = arg;
+    uint64_t i, start = now_ns();
+
+    for (i = j->first; i < j->last && j->ret == 0; i++) {
+        const struct chunk *ch = &j->chunks.chunk[i];
+        char *path = chunk_path(opts->cache, ch->id);
+        int fd = open(path, O_RDONLY);
+
+        if (fd == -1 || copy_range(fd, 0, j->fd, ch->len) != 0) {
+            warn("error copying chunk %s", path);
+            j->ret = -1;
+        }
+        if (fd != -1)
+            close(fd);
+        free(path);
+    }
+    if (j->fd != -1)
+        close(j->fd);
+    j->ns = now_ns() - start;
+}
+
+void copy_done(void *arg)
+{
+    struct disk_job *j = arg;
+    struct conn *c = j->c;
+    uint64_t i;
+
+    if (c != NULL) {
+        c->job = NULL;
+        c->stats.disk_ns += j->ns;
+        c->chunks = j->chunks;
+        memset(&j->chunks, 0, sizeof(j->chunks));
+        if (j->ret != 0) {
+            warn("error copying chunks into %s", c->path);
+            drop_file(c);
+        }
+        for (i = j->first; i < j->last; i++)
+            note_written(c, c->chunks.chunk[i].len);
+        c->chunk_next = j->last;
+        next_chunks(c);
+        update_events(c);
+    }
+    free_job(j);
+}
+
+/* Add the job's chunks marked missing to the store, unless they are there
+ * already or their content no longer matches their id, as happens when
+ * the file changed while it was being sent. */
+void store_run(void *arg)
+{
+    struct disk_job *j = arg;
+    unsigned char id[CHUNK_ID_SIZE], *buf;
+    uint64_t i;
+
+    buf = malloc(CHUNK_MAX);
+    if (buf == NULL) {
+        fatal("memory error");
+    }
+    for (i = 0; i < j->chunks.count; i++) {
+        const struct chunk *ch = &j->chunks.chunk[i];
+        char *path, *tmp;
+        uint32_t got = 0;
+        int fd;
+
+        if (!CHUNK_BIT(j->missing, i))
+            continue;
+        path = chunk_path(opts->cache, ch->id);
+        if (access(path, F_OK) == 0)
+            goto next;
+        while (got < ch->len) {
+            ssize_t ret = pread(j->fd, buf + got, ch->len - got, ch->off + got);
+            if (ret == -1 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                break;
+            got += ret;
+        }
+        if (got < ch->len) {
+            warn("error reading chunk at %" PRIu64 " of %s", ch->off, j->relpath);
+            goto next;
+        }
+        chunk_id(buf, ch->len, id);
+        if (memcmp(id, ch->id, CHUNK_ID_SIZE) != 0) {
+            warn("chunk at %" PRIu64 " of %s changed while sent, not stored", ch->off,
+                 j->relpath);
+            goto next;
+        }
+        tmp = malloc(strlen(path) + 8);
+        if (tmp == NULL) {
+            fatal("memory error");
+        }
+        sprintf(tmp, "%s.XXXXXX", path);
+        create_path(tmp);
+        fd = mkstemp(tmp);
+        if (fd == -1 || write_full(fd, buf, ch->len) == -1 || rename(tmp, path) == -1) {
+            warn("error storing chunk %s", path);
+            if (fd != -1)
+                unlink(tmp);
+        }
+        if (fd != -1)
+            close(fd);
+        free(tmp);
+    next:
+        free(path);
+    }
+    free(buf);
+    close(j->fd);
+}
+
+void store_done(void *arg)
+{
+    free_job(arg);
+}
+
+/* Place the chunks from chunk_next that are in the store, copying them on
+ * a task worker, then start the body of the run of missing ones after
+ * them. Once every chunk is placed the new ones are handed to a worker to
+ * store, without waiting, and the file is done. */
+void next_chunks(struct conn *c)
+{
+    uint64_t i = c->chunk_next, j;
+    struct disk_job *job;
+
+    for (j = i; j < c->chunks.count && !CHUNK_BIT(c->missing, j); j++)
+        ;
+    if (j > i && c->fd != -1) {
+        job = new_job(c);
+        job->fd = dup(c->fd);
+        job->chunks = c->chunks;
+        memset(&c->chunks, 0, sizeof(c->chunks));
+        job->first = i;
+        job->last = j;
+        if (job->fd == -1)
+            job->ret = -1;
+        wait_job(c, job, copy_run, copy_done);
+        return;
+    }
+    c->chunk_next = i = j;
+    if (i < c->chunks.count) {
+        for (; j < c->chunks.count && CHUNK_BIT(c->missing, j); j++)
+            ;
+        c->run_end = j;
+        start_body(c, c->chunks.chunk[j - 1].off + c->chunks.chunk[j - 1].len -
+                   c->chunks.chunk[i].off);
+        return;
+    }
+    if (c->fd != -1) {
+        job = new_job(NULL);
+        job->fd = dup(c->fd);
+        job->chunks = c->chunks;
+        job->missing = c->missing;
+        job->relpath = strdup(c->relpath);
+        memset(&c->chunks, 0, sizeof(c->chunks));
+        c->missing = NULL;
+        if (job->fd == -1 || job->relpath == NULL)
+            free_job(job);
+        else
+            tasks_submit(store_run, store_done, job);
+    }
+    finish_file(c);
+}
+
+int step_chunk_count(struct conn *c)
+{
+    uint64_t count;
+    int ret;
+
+    ret = fill(c, c->buf, 4);
+    if (ret != STEP_NEXT)
+        return ret;
+    count = get32(c->buf);
+    if (count == 0 || count > c->hdr.size / CHUNK_MIN + 1) {
+        warn("invalid chunk count %" PRIu64 " for %s", count, c->relpath);
+        return STEP_CLOSE;
+    }
+    c->chunks.count = count;
+    c->chunks.chunk = calloc(count, sizeof(*c->chunks.chunk));
+    c->manifest = malloc(count * CHUNK_REC_SIZE);
+    c->missing = calloc((count + 7) / 8, 1);
+    if (c->chunks.chunk == NULL || c->manifest == NULL || c->missing == NULL) {
+        fatal("memory error");
+    }
+    c->state = ST_MANIFEST;
+    return STEP_NEXT;
+}
+
+int step_manifest(struct conn *c)
+{
+    uint64_t i, off = 0;
+    struct disk_job *j;
+    int ret;
+
+    ret = fill(c, c->manifest, c->chunks.count * CHUNK_REC_SIZE);
+    if (ret != STEP_NEXT)
+        return ret;
+    for (i = 0; i < c->chunks.count; i++) {
+        struct chunk *ch = &c->chunks.chunk[i];
+        const unsigned char *rec = c->manifest + i * CHUNK_REC_SIZE;
+        memcpy(ch->id, rec, CHUNK_ID_SIZE);
+        ch->len = get32(rec + CHUNK_ID_SIZE);
+        ch->off = off;
+        off += ch->len;
+        if (ch->len == 0 || ch->len > CHUNK_MAX || off > c->hdr.size) {
+            warn("invalid chunk manifest for %s", c->relpath);
+            return STEP_CLOSE;
+        }
+    }
+    free(c->manifest);
+    c->manifest = NULL;
+    if (off != c->hdr.size) {
+        warn("invalid chunk manifest for %s", c->relpath);
+        return STEP_CLOSE;
+    }
+    /* With nowhere to write, ask for nothing and drop the file. */
+    if (c->fd == -1) {
+        answer_manifest(c);
+        return STEP_NEXT;
+    }
+    j = new_job(c);
+    j->chunks = c->chunks;
+    j->missing = c->missing;
+    memset(&c->chunks, 0, sizeof(c->chunks));
+    c->missing = NULL;
+    wait_job(c, j, lookup_run, lookup_done);
+    return STEP_NEXT;
+}
+
+/* Start writing range c of transfer t. */
+void attach_range(struct conn *c, struct transfer *t)
+{
+    struct conn *o = t->owner;
+
+    c->xfer = t;
+    c->range = 1;
+    c->fd = -1;
+    t->refs++;
+    if (c->pos < 0 || (uint64_t)c->pos > t->size || c->hdr.size > t->size - c->pos) {
+        warn("range outside %s", c->relpath);
+        t->failed = 1;
+    } else if (o && o->fd != -1 && !t->failed) {
+        c->fd = dup(o->fd);
+        if (c->fd == -1)
+            t->failed = 1;
+    }
+    start_body(c, c->hdr.size);
+}
+
+/* All ranges are in: commit the owner's file, or drop it if any failed. */
+void finish_transfer(struct transfer *t)
+{
+    struct conn *o = t->owner;
+
+    forget_transfer(t);
+    if (t->failed) {
+        warn("striped transfer of %s failed", o->relpath);
+        drop_file(o);
+    }
+    o->xfer = NULL;
+    free(t);
+    finish_file(o);
+    update_events(o);
+}
+
+int step_stripe_info(struct conn *c)
+{
+    struct transfer *t;
+    struct conn **w;
+    int ret;
+
+    ret = fill(c, c->buf, STRIPE_INFO_SIZE);
+    if (ret != STEP_NEXT)
+        return ret;
+    t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        fatal("memory error");
+    }
+    t->id = get64(c->buf);
+    t->ranges = get32(c->buf + 8);
+    t->size = c->hdr.size;
+    t->owner = c;
+    t->refs = 1;
+    if (t->ranges == 0 || t->ranges > MAX_STRIPES) {
+        warn("invalid range count %u for %s", t->ranges, c->relpath);
+        free(t);
+        return STEP_CLOSE;
+    }
+    if (c->fd != -1 && ftruncate(c->fd, t->size) == -1) {
+        warn("error writing file %s", c->path);
+        drop_file(c);
+    }
+    if (c->fd == -1)
+        t->failed = 1;
+    t->next = transfers;
+    transfers = t;
+    c->xfer = t;
+    c->state = ST_STRIPED;
+
+    /* Ranges that arrived before the header. */
+    for (w = &range_waiters; *w != NULL;) {
+        struct conn *r = *w;
+        if (r->xfer_id == t->id) {
+            *w = r->next_waiter;
+            attach_range(r, t);
+            update_events(r);
+        } else {
+            w = &r->next_waiter;
+        }
+    }
+    return STEP_WAIT;
+}
+
+int step_range_info(struct conn *c)
+{
+    struct transfer *t;
+    int ret;
+
+    ret = fill(c, c->buf, STRIPE_INFO_SIZE);
+    if (ret != STEP_NEXT)
+        return ret;
+    c->xfer_id = get64(c->buf);
+    c->pos = get64(c->buf + 8);
+    for (t = transfers; t != NULL; t = t->next) {
+        if (t->id == c->xfer_id)
+            break;
+    }
+    if (t == NULL) {
+        c->state = ST_RANGE_WAIT;
+        c->next_waiter = range_waiters;
+        range_waiters = c;
+        return STEP_WAIT;
+    }
+    attach_range(c, t);
+    return STEP_NEXT;
+}
+
+int step_hello(struct conn *c)
+{
+    unsigned char *buf;
+    int ret;
+
+    ret = fill(c, c->buf, HELLO_SIZE);
+    if (ret != STEP_NEXT)
+        return ret == STEP_EOF ? STEP_CLOSE : ret;
+    if (get32(c->buf) != BEAMER_MAGIC) {
+        warn("not a beamer transmitter");
+        return STEP_CLOSE;
+    }
+    if (get32(c->buf + 4) != BEAMER_VERSION) {
+        warn("transmitter protocol version %u, expected %u", get32(c->buf + 4), BEAMER_VERSION);
+        return STEP_CLOSE;
+    }
+    buf = malloc(HELLO_SIZE);
+    if (buf == NULL) {
+        fatal("memory error");
+    }
+    put32(put32(put32(buf, BEAMER_MAGIC), BEAMER_VERSION),
+          get32(c->buf + 8) & (FEATURE_LZ | FEATURE_STRIPE | FEATURE_HASH |
+                               (opts->cache ? FEATURE_CHUNKS : 0)));
+    queue_out(c, buf, HELLO_SIZE);
+    c->state = ST_HEADER;
+    return STEP_NEXT;
+}
+
+int step_header(struct conn *c)
+{
+    int ret;
+
+    ret = fill(c, c->buf, FILE_HEADER_SIZE);
+    if (ret != STEP_NEXT)
+        return ret;
+    if (decode_header(c->buf, &c->hdr) != 0)
+        return STEP_CLOSE;
+    c->have = FILE_HEADER_SIZE;
+    c->need = FILE_HEADER_SIZE + c->hdr.path_len;
+    c->state = ST_PATH;
+    return STEP_NEXT;
+}
+
+int step_path(struct conn *c)
+{
+    int ret;
+
+    ret = fill(c, c->buf, c->need);
+    if (ret != STEP_NEXT)
+        return ret;
+    put32(c->buf + 28, 0);
+    if (header_checksum(c->buf, c->need) != c->hdr.checksum) {
+        warn("header checksum mismatch");
+        return STEP_CLOSE;
+    }
+    memcpy(c->relpath, c->buf + FILE_HEADER_SIZE, c->hdr.path_len);
+    c->relpath[c->hdr.path_len] = 0;
+    memset(&c->stats, 0, sizeof(c->stats));
+    c->stats.queued = now_ns();
+    if (!valid_relpath(c->relpath)) {
+        warn("rejecting path %s", c->relpath);
+        return STEP_CLOSE;
+    }
+    if (c->hdr.flags & HDR_RANGE) {
+        c->state = ST_RANGE_INFO;
+        return STEP_NEXT;
+    }
+
+    c->mode = opts->mode_override ? opts->mode : (c->hdr.mode & 07777);
+    c->path = join_path(recv_root, c->relpath);
+    if (S_ISDIR(c->hdr.mode)) {
+        if (create_dir(c->path, c->mode | S_IRWXU) != 0)
+            warn("error creating directory %s", c->path);
+        else if (relays)
+            links_queue(relays, c->relpath, c->stats.queued);
+        free(c->path);
+        c->path = NULL;
+        c->state = ST_HEADER;
+        return STEP_NEXT;
+    }
+    if (!S_ISREG(c->hdr.mode)) {
+        warn("unsupported file type %o for %s", c->hdr.mode, c->relpath);
+        return STEP_CLOSE;
+    }
+    printf("start receiving %s %" PRIu64 " bytes\n", c->relpath, c->hdr.size);
+    c->stats.size = c->hdr.size;
+    if (!lock_dest(c)) {
+        c->state = ST_LOCKED;
+        return STEP_WAIT;
+    }
+    begin_file(c);
+    return STEP_NEXT;
+}
+
+int step_delta_rec(struct conn *c)
+{
+    uint64_t pos, len;
+    int ret;
+
+    ret = fill(c, c->buf, DELTA_REC_SIZE);
+    if (ret != STEP_NEXT)
+        return ret;
+    pos = get64(c->buf + 1);
+    len = get64(c->buf + 9);
+    if (c->buf[0] == 'E') {
+        finish_file(c);
+    } else if (c->buf[0] == 'D') {
+        c->literal += len;
+        c->total += len;
+        start_body(c, len);
+    } else if (c->buf[0] == 'C' && pos < c->sigs.count && len <= c->sigs.count - pos) {
+        uint64_t off = pos * c->sigs.block_size;
+        uint64_t n = len * c->sigs.block_size;
+        if (n > c->sigs.size - off)
+            n = c->sigs.size - off;
+        uint64_t start = now_ns();
+        if (c->fd != -1 && copy_range(c->oldfd, off, c->fd, n) != 0) {
+            warn("error copying blocks to %s", c->path);
+            drop_file(c);
+        }
+        note_written(c, n);
+        c->stats.disk_ns += now_ns() - start;
+        c->total += n;
+    } else {
+        warn("invalid delta record %c", c->buf[0]);
+        return STEP_CLOSE;
+    }
+    return STEP_NEXT;
+}
+
+/* Move n bytes just spliced into the pipe on to the file. */
+void drain_pipe(struct conn *c, size_t n)
+{
+    uint64_t start = now_ns();
+
+    while (n > 0 && c->fd != -1) {
+        ssize_t out;
+        out = splice(c->piping[0], NULL, c->fd, c->range ? &c->pos : NULL, n,
+                     SPLICE_F_MOVE|SPLICE_F_MORE);
+        c->stats.calls++;
+        if (out <= 0) {
+            warn("error writing file %s", c->path);
+            drop_file(c);
+            break;
+        }
+        if ((size_t)out < n)
+            c->stats.short_calls++;
+        n -= out;
+        note_written(c, out);
+    }
+    c->stats.disk_ns += now_ns() - start;
+    while (n > 0) {
+        size_t want = n < sizeof(scratch) ? n : sizeof(scratch);
+        ssize_t ret;
+        ret = read(c->piping[0], scratch, want);
+        if (ret <= 0) {
+            fatal("pipe");
+        }
+        n -= ret;
+    }
+}
+
+/* step_raw() with both splices, socket to pipe and pipe to file, in one
+ * io_uring submission. The second is hard linked so it runs, taking what
+ * the first delivered, even when the first comes up short. */
+int step_raw_uring(struct conn *c, size_t want)
+{
+    uint64_t tag, start;
+    int res, in = -EAGAIN, out = -EAGAIN;
+
+    if (c->piping[0] == -1)
+        open_pipe(c->piping);
+    uring_splice(&ring, c->sock, -1, c->piping[1], -1, want,
+                 SPLICE_F_MOVE|SPLICE_F_NONBLOCK, URING_HARDLINK, 0);
+    uring_splice(&ring, c->piping[0], -1, c->fd, c->range ? c->pos : -1, want,
+                 SPLICE_F_MOVE|SPLICE_F_NONBLOCK|SPLICE_F_MORE, 0, 1);
+    start = now_ns();
+    if (uring_submit(&ring, 2) == -1) {
+        fatal("io_uring_enter");
+    }
+    while (uring_reap(&ring, &tag, &res) == 0) {
+        if (tag)
+            out = res;
+        else
+            in = res;
+    }
+    /* Includes the socket read, which cannot be told apart here. */
+    c->stats.disk_ns += now_ns() - start;
+    if (in == 0)
+        return STEP_EOF;
+    if (in == -EAGAIN)
+        return STEP_WAIT;
+    if (URING_INTERRUPTED(in))
+        return STEP_NEXT;
+    if (in < 0) {
+        warn("error receiving data");
+        return STEP_CLOSE;
+    }
+    c->stats.wire += in;
+    c->stats.calls += 2;
+    if ((size_t)in < want)
+        c->stats.short_calls++;
+    if (out < 0 && out != -EAGAIN && !URING_INTERRUPTED(out)) {
+        warn("error writing file %s", c->path);
+        drop_file(c);
+        out = 0;
+    }
+    if (out < 0)
+        out = 0;
+    if (c->range)
+        c->pos += out;
+    note_written(c, out);
+    if (out < in)
+        drain_pipe(c, in - out);
+    c->left -= in;
+    if (c->left == 0)
+        body_done(c);
+    return STEP_NEXT;
+}
+
+/* Raw content goes from the socket to the file through the pipe, without
+ * passing through user space. Dropped content is read and discarded. */
+int step_raw(struct conn *c)
+{
+    size_t want = c->left < PIPE_SIZE ? c->left : PIPE_SIZE;
+    ssize_t ret;
+
+    if (c->fd == -1) {
+        if (want > sizeof(scratch))
+            want = sizeof(scratch);
+        ret = recv(c->sock, scratch, want, 0);
+    } else if (ring_ok) {
+        return step_raw_uring(c, want);
+    } else {
+        if (c->piping[0] == -1)
+            open_pipe(c->piping);
+        ret = splice(c->sock, NULL, c->piping[1], NULL, want,
+                     SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    }
+    if (ret == 0)
+        return STEP_EOF;
+    if (ret == -1 && errno == EINTR)
+        return STEP_NEXT;
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return STEP_WAIT;
+    if (ret == -1) {
+        warn("error receiving data");
+        return STEP_CLOSE;
+    }
+    c->stats.wire += ret;
+    if (c->fd != -1) {
+        c->stats.calls++;
+        if ((size_t)ret < want)
+            c->stats.short_calls++;
+        drain_pipe(c, ret);
+    }
+    c->left -= ret;
+    if (c->left == 0)
+        body_done(c);
+    return STEP_NEXT;
+}
+
+int step_zrec(struct conn *c)
+{
+    int ret;
+
+    ret = fill(c, c->buf, ZS_RECORD_SIZE);
+    if (ret != STEP_NEXT)
+        return ret;
+    c->clen = get32(c->buf);
+    c->rlen = get32(c->buf + 4);
+    if (c->clen == ZS_RAW_TAIL) {
+        c->state = ST_RAW;
+        return STEP_NEXT;
+    }
+    if (c->rlen == 0 || c->rlen > ZS_CHUNK || c->rlen > c->left || c->clen > c->rlen) {
+        warn("invalid compressed record for %s", c->relpath);
+        return STEP_CLOSE;
+    }
+    if (c->zin == NULL) {
+        c->zin = malloc(ZS_CHUNK);
+        c->zout = malloc(ZS_CHUNK);
+        if (c->zin == NULL || c->zout == NULL) {
+            fatal("memory error");
+        }
+    }
+    c->state = ST_ZDATA;
+    return STEP_NEXT;
+}
+
+int step_zdata(struct conn *c)
+{
+    const unsigned char *data = c->zin;
+    uint64_t start;
+    int ret;
+
+    ret = fill(c, c->zin, c->clen);
+    if (ret != STEP_NEXT)
+        return ret;
+    c->stats.wire += ZS_RECORD_SIZE + c->clen;
+    if (c->clen < c->rlen) {
+        if (lz_decompress(c->zin, c->clen, c->zout, c->rlen) != (long)c->rlen) {
+            warn("corrupt compressed data for %s", c->relpath);
+            return STEP_CLOSE;
+        }
+        data = c->zout;
+    }
+    start = now_ns();
+    if (c->fd != -1 && write_out(c, data, c->rlen) == -1) {
+        warn("error writing file %s", c->path);
+        drop_file(c);
+    }
+    note_written(c, c->rlen);
+    c->stats.disk_ns += now_ns() - start;
+    c->left -= c->rlen;
+    c->state = ST_ZREC;
+    if (c->left == 0)
+        body_done(c);
+    return STEP_NEXT;
+}
+
+void close_conn(struct conn *c)
+{
+    struct conn **w;
+
+    if (c->state == ST_RANGE_WAIT) {
+        for (w = &range_waiters; *w != c; w = &(*w)->next_waiter)
+            ;
+        *w = c->next_waiter;
+    }
+    if (c->range) {
+        range_done(c, 0);
+    } else if (c->xfer) {
+        forget_transfer(c->xfer);
+        c->xfer->owner = NULL;
+        c->xfer->failed = 1;
+        if (--c->xfer->refs == 0)
+            free(c->xfer);
+    }
+    if (c->hashing)
+        c->hashing->c = NULL;
+    if (c->job)
+        c->job->c = NULL;
+    drop_file(c);
+    delta_sigs_free(&c->sigs);
+    chunk_list_free(&c->chunks);
+    free(c->manifest);
+    free(c->missing);
+    if (c->oldfd != -1)
+        close(c->oldfd);
+    unlock_dest(c);
+    free(c->path);
+    if (c->piping[0] != -1) {
+        close(c->piping[0]);
+        close(c->piping[1]);
+    }
+    close(c->sock);
+    free(c->out);
+    free(c->zin);
+    free(c->zout);
+    free(c);
+}
+
+/* Advance c as far as its socket allows, or until its budget runs out;
+ * level-triggered epoll reports it again while data remains. */
+void run_conn(struct conn *c)
+{
+    int n, ret = STEP_NEXT;
+
+    for (n = 0; n < STEP_BUDGET && ret == STEP_NEXT; n++) {
+        if (c->out) {
+            ret = flush_out(c);
+            if (ret != STEP_NEXT)
+                break;
+        }
+        switch (c->state) {
+        case ST_HELLO:
+            ret = step_hello(c);
+            break;
+        case ST_HEADER:
+            ret = step_header(c);
+            break;
+        case ST_PATH:
+            ret = step_path(c);
+            break;
+        case ST_LOCKED:
+            ret = STEP_WAIT;
+            break;
+        case ST_DELTA_REC:
+            ret = step_delta_rec(c);
+            break;
+        case ST_RAW:
+            ret = step_raw(c);
+            break;
+        case ST_ZREC:
+            ret = step_zrec(c);
+            break;
+        case ST_ZDATA:
+            ret = step_zdata(c);
+            break;
+        case ST_STRIPE_INFO:
+            ret = step_stripe_info(c);
+            break;
+        case ST_RANGE_INFO:
+            ret = step_range_info(c);
+            break;
+        case ST_STRIPED:
+            ret = STEP_WAIT;
+            break;
+        case ST_RANGE_WAIT:
+            /* Only woken when the transmitter hangs up. */
+            ret = STEP_EOF;
+            break;
+        case ST_CHUNK_COUNT:
+            ret = step_chunk_count(c);
+            break;
+        case ST_MANIFEST:
+            ret = step_manifest(c);
+            break;
+        case ST_TRAILER:
+            ret = step_trailer(c);
+            break;
+        case ST_DISK:
+        case ST_HASH:
+            ret = STEP_WAIT;
+            break;
+        }
+    }
+
+    if (ret == STEP_EOF) {
+        if (c->state == ST_HEADER && c->have == 0)
+            puts("transmitter disconnected");
+        else
+            warn("transmitter disconnected mid-transfer");
+    }
+    if (ret == STEP_EOF || ret == STEP_CLOSE)
+        close_conn(c);
+    else
+        update_events(c);
+}
+
+void accept_conns(int sock)
+{
+    for (;;) {
+        struct epoll_event ev;
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        struct conn *c;
+        int client;
+
+        client = accept4(sock, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if (client == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                warn("error accepting connection");
+            return;
+        }
+        c = calloc(1, sizeof(*c));
+        if (c == NULL) {
+            fatal("memory error");
+        }
+        c->sock = client;
+        inet_ntop(AF_INET, &addr.sin_addr, c->peer, sizeof(c->peer));
+        c->state = ST_HELLO;
+        c->events = EPOLLIN;
+        c->fd = -1;
+        c->oldfd = -1;
+        c->piping[0] = c->piping[1] = -1;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = c->events;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, client, &ev) == -1) {
+            fatal("epoll_ctl: transmitter sock");
+        }
+        puts("transmitter connected");
+    }
+}
+
+void receive(const char *port, const char *root, const struct receiver_opts *ropts)
+{
+    struct epoll_event ev, events[MAX_EVENTS];
+    int sock;
+
+    opts = ropts;
+    recv_root = root;
+    if (uring_enabled) {
+        ring_ok = uring_open(&ring, 8) == 0;
+        if (!ring_ok)
+            warn("io_uring unavailable, using splice");
+    }
+    tasks_start();
+    if (opts->relay)
+        relays = links_open(opts->relay, port, root, opts->relay_features,
+                            opts->relay_streams);
+    sock = open_server(port);
+    if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) == -1) {
+        fatal("fcntl: server sock");
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        fatal("epoll_create");
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) == -1) {
+        fatal("epoll_ctl: server sock");
+    }
+    ev.data.ptr = &stats_fd;
+    if (stats_fd != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, stats_fd, &ev) == -1) {
+        fatal("epoll_ctl: signal fd");
+    }
+    ev.data.ptr = &tasks_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, tasks_fd, &ev) == -1) {
+        fatal("epoll_ctl: task fd");
+    }
+
+    for (;;) {
+        int i, nfds;
+        fflush(stdout);
+        nfds = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (nfds == -1) {
+            if (errno == EINTR)
+                continue;
+            fatal("epoll_wait");
+        }
+        /* Only the connection being run can be closed, so pointers
+         * later in events stay valid. */
+        for (i = 0; i < nfds; i++) {
+            if (events[i].data.ptr == NULL)
+                accept_conns(sock);
+            else if (events[i].data.ptr == &stats_fd)
+                stats_exit();
+            else if (events[i].data.ptr == &tasks_fd)
+                tasks_reap();
+            else
+                run_conn(events[i].data.ptr);
+        }
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#include <sys/types.h>
+
+struct receiver_opts {
+    mode_t mode;            /* used for every file when mode_override */
+    int mode_override;
+    int preallocate;        /* reserve each file's size before writing */
+    int fsync;              /* flush each file before it is renamed */
+    const char *cache;      /* chunk store directory, or NULL */
+    const char *relay;      /* receivers to forward every file to, or NULL */
+    int relay_features;     /* LINK_ flags for the relay links */
+    int relay_streams;      /* stripes per relay link */
+};
+
+/* Accept transmitters on port and recreate their files under root,
+ * serving every connection from one epoll loop. Never returns. */
+void receive(const char *port, const char *root, const struct receiver_opts *opts);
+
+#endif
@@ -0,0 +1,145 @@
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <time.h>
+
+#include "beamer.h"
+#include "stats.h"
+
+/* Transfer lines and the summary are single lines of key=value pairs after
+ * "stat", so a log can be filtered with grep and split with awk:
+ *
+ *   stat tx path=a/big peer=board1 ok=1 size=... wire=... wait_ms=...
+ *
+ * wait_ms is the time from the change being seen, or from the header
+ * arriving, to the first byte; ms is the time from then to the end. */
+
+int stats_enabled = 0;
+int stats_fd = -1;
+__thread struct xfer_stats *stats_current;
+
+struct totals {
+    uint64_t files;
+    uint64_t failed;
+    uint64_t busy_ns;           /* sum of transfer times */
+    struct xfer_stats sum;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct totals tx_totals, rx_totals;
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_wait_writable(int sock)
+{
+    struct pollfd pfd = { sock, POLLOUT, 0 };
+    uint64_t start;
+
+    if (stats_current == NULL || poll(&pfd, 1, 0) != 0)
+        return;
+    stats_current->stalls++;
+    start = now_ns();
+    while (poll(&pfd, 1, -1) == 0)
+        ;
+    stats_current->stall_ns += now_ns() - start;
+}
+
+void stats_add(struct xfer_stats *a, const struct xfer_stats *b)
+{
+    a->size += b->size;
+    a->wire += b->wire;
+    a->calls += b->calls;
+    a->short_calls += b->short_calls;
+    a->stalls += b->stalls;
+    a->stall_ns += b->stall_ns;
+    a->disk_ns += b->disk_ns;
+}
+
+/* Megabytes per second for bytes moved in ns. */
+double rate(uint64_t bytes, uint64_t ns)
+{
+    return ns ? bytes * 1000.0 / ns : 0;
+}
+
+void stats_report(const char *dir, const char *path, const char *peer,
+                  const struct xfer_stats *s, int ok)
+{
+    struct totals *t = strcmp(dir, "tx") == 0 ? &tx_totals : &rx_totals;
+    uint64_t end = now_ns(), ns = end - s->started;
+
+    printf("stat %s path=%s peer=%s ok=%d size=%" PRIu64 " wire=%" PRIu64
+           " wait_ms=%.3f ms=%.3f MBps=%.1f calls=%" PRIu64 " short=%" PRIu64
+           " stalls=%" PRIu64 " stall_ms=%.3f disk_ms=%.3f\n",
+           dir, path, peer, ok, s->size, s->wire,
+           (s->started - s->queued) / 1e6, ns / 1e6, rate(s->wire, ns),
+           s->calls, s->short_calls, s->stalls, s->stall_ns / 1e6, s->disk_ns / 1e6);
+
+    pthread_mutex_lock(&lock);
+    t->files++;
+    if (!ok)
+        t->failed++;
+    t->busy_ns += ns;
+    stats_add(&t->sum, s);
+    pthread_mutex_unlock(&lock);
+}
+
+void print_totals(const char *dir, const struct totals *t)
+{
+    const struct xfer_stats *s = &t->sum;
+
+    if (t->files == 0)
+        return;
+    printf("stat total %s files=%" PRIu64 " failed=%" PRIu64 " size=%" PRIu64
+           " wire=%" PRIu64 " ms=%.3f MBps=%.1f calls=%" PRIu64 " short=%" PRIu64
+           " stalls=%" PRIu64 " stall_ms=%.3f disk_ms=%.3f\n",
+           dir, t->files, t->failed, s->size, s->wire, t->busy_ns / 1e6,
+           rate(s->wire, t->busy_ns), s->calls, s->short_calls, s->stalls,
+           s->stall_ns / 1e6, s->disk_ns / 1e6);
+}
+
+void stats_summary(void)
+{
+    pthread_mutex_lock(&lock);
+    print_totals("tx", &tx_totals);
+    print_totals("rx", &rx_totals);
+    pthread_mutex_unlock(&lock);
+    fflush(stdout);
+}
+
+int stats_signals(void)
+{
+    sigset_t mask;
+    int fd;
+
+    if (!stats_enabled)
+        return -1;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
+        fatal("pthread_sigmask");
+    }
+    fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (fd == -1) {
+        fatal("signalfd");
+    }
+    return fd;
+}
+
+void stats_exit(void)
+{
+    stats_summary();
+    exit(0);
+}
@@ -0,0 +1,52 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/* Counters for one file transfer. Times are monotonic nanoseconds. */
+struct xfer_stats {
+    uint64_t queued;            /* change seen, or header received */
+    uint64_t started;           /* first byte sent, or file opened */
+    uint64_t size;              /* file bytes */
+    uint64_t wire;              /* bytes on the socket */
+    uint64_t calls;             /* sendfile() or splice() calls */
+    uint64_t short_calls;       /* calls that moved less than asked */
+    uint64_t stalls;            /* writes that found the send queue full */
+    uint64_t stall_ns;          /* time waiting for the send queue */
+    uint64_t disk_ns;           /* time writing the received file */
+};
+
+/* Non-zero when -t asked for a line per transfer and a summary on exit. */
+extern int stats_enabled;
+
+/* The transfer the calling thread is working on, or NULL. send_range()
+ * and the compressed writes in zs_send() count into it. */
+extern __thread struct xfer_stats *stats_current;
+
+uint64_t now_ns(void);
+
+/* Count a stall if sock has no room to write and wait until it has. Does
+ * nothing unless the thread has a current transfer. */
+void stats_wait_writable(int sock);
+
+/* Add the counters of b into a. */
+void stats_add(struct xfer_stats *a, const struct xfer_stats *b);
+
+/* Print a line for a finished transfer and add it to the totals. dir is
+ * "tx" or "rx", ok is zero for a cancelled or failed transfer. */
+void stats_report(const char *dir, const char *path, const char *peer,
+                  const struct xfer_stats *s, int ok);
+
+/* Print the totals for each direction. */
+void stats_summary(void);
+
+/* Signal descriptor the main loop watches when stats are enabled, else
+ * -1. Once it is readable stats_exit() prints the totals and exits. */
+extern int stats_fd;
+
+/* With stats enabled, block SIGINT, SIGTERM and SIGHUP in every thread and
+ * return a signalfd for them. Call before starting threads. */
+int stats_signals(void);
+void stats_exit(void);
+
+#endif
@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "beamer.h"
+#include "tasks.h"
+
+/* Enough that a large file being hashed does not hold up the small ones
+ * queued behind it. */
+#define TASK_WORKERS 4
+
+struct task {
+    void (*run)(void *arg);
+    void (*done)(void *arg);
+    void *arg;
+    struct task *next;
+};
+
+int tasks_fd = -1;
+
+static pthread_mutex_t tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tasks_cond = PTHREAD_COND_INITIALIZER;
+static struct task *pending;
+static struct task **pending_tail = &pending;
+static struct task *finished;         /* newest first */
+
+static void *task_worker(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        uint64_t one = 1;
+        struct task *t;
+
+        pthread_mutex_lock(&tasks_lock);
+        while (pending == NULL)
+            pthread_cond_wait(&tasks_cond, &tasks_lock);
+        t = pending;
+        pending = t->next;
+        if (pending == NULL)
+            pending_tail = &pending;
+        pthread_mutex_unlock(&tasks_lock);
+
+        t->run(t->arg);
+
+        pthread_mutex_lock(&tasks_lock);
+        t->next = finished;
+        finished = t;
+        pthread_mutex_unlock(&tasks_lock);
+        while (write(tasks_fd, &one, sizeof(one)) == -1 && errno == EINTR)
+            ;
+    }
+    return NULL;
+}
+
+void tasks_start(void)
+{
+    pthread_t thread;
+    int i;
+
+    tasks_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (tasks_fd == -1) {
+        fatal("eventfd");
+    }
+    for (i = 0; i < TASK_WORKERS; i++) {
+        if (pthread_create(&thread, NULL, task_worker, NULL) != 0) {
+            fatal("pthread_create");
+        }
+        pthread_detach(thread);
+    }
+}
+
+void tasks_submit(void (*run)(void *arg), void (*done)(void *arg), void *arg)
+{
+    struct task *t;
+
+    t = malloc(sizeof(*t));
+    if (t == NULL) {
+        fatal("memory error");
+    }
+    t->run = run;
+    t->done = done;
+    t->arg = arg;
+    t->next = NULL;
+    pthread_mutex_lock(&tasks_lock);
+    *pending_tail = t;
+    pending_tail = &t->next;
+    pthread_cond_signal(&tasks_cond);
+    pthread_mutex_unlock(&tasks_lock);
+}
+
+void tasks_reap(void)
+{
+    struct task *t, *list = NULL;
+    uint64_t count;
+
+    if (read(tasks_fd, &count, sizeof(count)) == -1 && errno != EAGAIN && errno != EINTR) {
+        fatal("eventfd");
+    }
+    pthread_mutex_lock(&tasks_lock);
+    while (finished != NULL) {
+        t = finished;
+        finished = t->next;
+        t->next = list;
+        list = t;
+    }
+    pthread_mutex_unlock(&tasks_lock);
+    while (list != NULL) {
+        t = list;
+        list = t->next;
+        t->done(t->arg);
+        free(t);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+/* Disk work taken off the receiver's event loop, so reading or writing a
+ * large file does not hold up the other connections. Each task runs on
+ * one of a few worker threads and its done callback then runs on the
+ * loop, which watches tasks_fd and calls tasks_reap() once it is
+ * readable. */
+
+/* Readable while finished tasks wait for tasks_reap(), else -1 until
+ * tasks_start(). */
+extern int tasks_fd;
+
+/* Start the workers. Call after stats_signals(). */
+void tasks_start(void);
+
+/* Call run(arg) on a worker, then done(arg) from tasks_reap(). */
+void tasks_submit(void (*run)(void *arg), void (*done)(void *arg), void *arg);
+
+/* Call done for every task finished, in the order they finished. */
+void tasks_reap(void);
+
+#endif
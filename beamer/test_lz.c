@@ -0,0 +1,408 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "lz.h"
+
+/* Checked in every build type, unlike assert(). */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+/* Blocks written by the reference LZ4 library (1.9.4): LZ4_compress_default
+ * of "", of text() and of ref_input(20000), and LZ4_compress_HC at level 12
+ * of ref_input(20000). */
+static const unsigned char ref_empty[] = {
+    0x00,
+};
+static const unsigned char ref_text[] = {
+    0xff, 0x1e, 0x54, 0x68, 0x65, 0x20, 0x71, 0x75, 0x69, 0x63, 0x6b, 0x20,
+    0x62, 0x72, 0x6f, 0x77, 0x6e, 0x20, 0x66, 0x6f, 0x78, 0x20, 0x6a, 0x75,
+    0x6d, 0x70, 0x73, 0x20, 0x6f, 0x76, 0x65, 0x72, 0x20, 0x74, 0x68, 0x65,
+    0x20, 0x6c, 0x61, 0x7a, 0x79, 0x20, 0x64, 0x6f, 0x67, 0x2e, 0x20, 0x2d,
+    0x00, 0xff, 0x29, 0xa0, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+    0x38, 0x39,
+};
+static const unsigned char ref_fast[] = {
+    0xff, 0xff, 0x1e, 0x63, 0x7a, 0xa0, 0x7e, 0xe1, 0xea, 0xf2, 0x3d, 0xc7,
+    0x39, 0x6d, 0x0d, 0xa6, 0x78, 0x16, 0x80, 0x05, 0x12, 0x3a, 0xa7, 0x4e,
+    0xde, 0x9f, 0x78, 0x9c, 0x70, 0x63, 0x00, 0x0b, 0xe6, 0xc8, 0x25, 0x21,
+    0x3d, 0xad, 0x22, 0xbc, 0x70, 0xb3, 0x85, 0xda, 0x21, 0x23, 0x63, 0x36,
+    0x17, 0x7b, 0xc3, 0x79, 0xfd, 0x62, 0x6c, 0xf9, 0x66, 0x43, 0xf1, 0x1f,
+    0xbd, 0x61, 0x63, 0xbd, 0x7c, 0x99, 0x90, 0x67, 0xf3, 0xd1, 0x98, 0xf0,
+    0x8c, 0x88, 0xd3, 0x90, 0x34, 0x3f, 0x14, 0xd1, 0xaa, 0xff, 0x72, 0x48,
+    0x27, 0x35, 0xf9, 0xde, 0x34, 0x4e, 0xb0, 0x4a, 0x10, 0xd8, 0xd5, 0x83,
+    0x7e, 0x10, 0xa4, 0x57, 0x4d, 0xd7, 0x31, 0x39, 0x3c, 0x26, 0x9f, 0x56,
+    0x69, 0x48, 0x3b, 0x0d, 0x32, 0x34, 0xa7, 0x0c, 0x79, 0x3d, 0x1a, 0x24,
+    0x37, 0xbf, 0xc2, 0x8b, 0xd2, 0x16, 0x20, 0xcf, 0x84, 0x7c, 0xbe, 0xc6,
+    0xba, 0xbb, 0xf4, 0x77, 0x3f, 0x32, 0x89, 0xc9, 0xbb, 0xae, 0xed, 0x0b,
+    0x7d, 0x14, 0xa7, 0x1e, 0xe0, 0xed, 0x3c, 0x0f, 0x8f, 0x3e, 0xb7, 0x78,
+    0xb6, 0x7e, 0x23, 0x38, 0x04, 0x7c, 0x01, 0x4d, 0x4b, 0x54, 0x38, 0xbd,
+    0xcc, 0x3a, 0xf0, 0x63, 0x23, 0x20, 0xc6, 0x4b, 0x4b, 0xfb, 0xff, 0xbd,
+    0x42, 0x33, 0x75, 0x5f, 0xff, 0x20, 0xe5, 0x40, 0x6d, 0x89, 0x6f, 0xf6,
+    0x43, 0x77, 0xf8, 0xf4, 0x1f, 0x1e, 0x04, 0x87, 0xba, 0x00, 0xe4, 0x21,
+    0x6e, 0x90, 0xf1, 0x46, 0xfd, 0xfd, 0x02, 0x47, 0x05, 0x2a, 0x17, 0x9e,
+    0x5f, 0xd9, 0x80, 0x78, 0x69, 0x83, 0x0a, 0x73, 0x67, 0xd2, 0x82, 0x9c,
+    0x0b, 0x03, 0xe3, 0xc0, 0xf4, 0x9d, 0x33, 0x74, 0xf1, 0x9f, 0x58, 0x1a,
+    0x8e, 0x02, 0x27, 0x78, 0x51, 0xb6, 0xeb, 0x45, 0x10, 0x6d, 0x4a, 0xad,
+    0xfe, 0x90, 0x66, 0xc1, 0xe1, 0xe6, 0xbf, 0x8c, 0x9d, 0x9f, 0x30, 0xe8,
+    0xe4, 0x1a, 0xdc, 0x28, 0xb7, 0x40, 0xd7, 0xe3, 0x78, 0x2c, 0xcb, 0x8c,
+    0x01, 0x96, 0x34, 0x26, 0x51, 0xcb, 0x32, 0xab, 0x0a, 0x18, 0x14, 0x3f,
+    0x03, 0xad, 0x2e, 0x12, 0x58, 0x57, 0xd6, 0x7b, 0x4d, 0xda, 0x20, 0xc6,
+    0xee, 0xf2, 0x4f, 0x2c, 0x01, 0x45, 0x1f, 0x4b, 0x2c, 0x01, 0x4d, 0x1f,
+    0x6c, 0x2c, 0x01, 0x4d, 0x1f, 0x19, 0x2c, 0x01, 0x4d, 0x14, 0x73, 0x58,
+    0x02, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xbc, 0x58, 0x02, 0x0f, 0x2c, 0x01,
+    0x45, 0x14, 0x00, 0x58, 0x02, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x89, 0x84,
+    0x03, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xf1, 0x84, 0x03, 0x0f, 0x2c, 0x01,
+    0x45, 0x14, 0x29, 0x84, 0x03, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x7d, 0xb0,
+    0x04, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x7d, 0xb0, 0x04, 0x0f, 0x2c, 0x01,
+    0x45, 0x14, 0xbe, 0xb0, 0x04, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xf8, 0xdc,
+    0x05, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x8e, 0xdc, 0x05, 0x0f, 0x2c, 0x01,
+    0x45, 0x14, 0x6c, 0xdc, 0x05, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x62, 0x08,
+    0x07, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x0a, 0x08, 0x07, 0x0f, 0x2c, 0x01,
+    0x45, 0x14, 0x8f, 0x08, 0x07, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xac, 0x34,
+    0x08, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xf5, 0x34, 0x08, 0x0f, 0x2c, 0x01,
+    0x45, 0x14, 0xc1, 0x34, 0x08, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x71, 0x60,
+    0x09, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x17, 0x60, 0x09, 0x0f, 0x2c, 0x01,
+    0x45, 0x14, 0x0b, 0x60, 0x09, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x04, 0x8c,
+    0x0a, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x78, 0x8c, 0x0a, 0x0f, 0x2c, 0x01,
+    0x45, 0x14, 0x2b, 0x8c, 0x0a, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x3c, 0xb8,
+    0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x57, 0xb8, 0x0b, 0x0f, 0x2c, 0x01,
+    0x45, 0x14, 0x6f, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x23, 0xf3, 0x4f,
+    0xe4, 0x0c, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xa5, 0xe4, 0x0c, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xf5, 0xe4, 0x0c, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x59,
+    0xe4, 0x0c, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x4f, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xe4, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xaa,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xab, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xfa, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xca,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xf1, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xcd, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x1b,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x62, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0x39, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xe0,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x63, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0x3d, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x44,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x20, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xaf, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x59,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x20, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xbb, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x02,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x79, 0xe4, 0x0c, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0x8a, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x68,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x17, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xa6, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x46,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xeb, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0x27, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xe5,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xc7, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0x7f, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x76,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x2f, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xdf, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xfe,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xca, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0x15, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x4a,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x79, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xd0, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x39,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xe9, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xbc, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x7f,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x67, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0x78, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xe1,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xb7, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0x84, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xc8,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xf0, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xc9, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xbf,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x9d, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xdf, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xbe,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x81, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xa7, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x33,
+    0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xfc, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0x7f, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0x38,
+    0xe4, 0x0c, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xbb, 0xb8, 0x0b, 0x0f, 0x2c,
+    0x01, 0x45, 0x14, 0xdb, 0xb8, 0x0b, 0x0f, 0x2c, 0x01, 0x45, 0x14, 0xd4,
+    0xb8, 0x0b, 0x1f, 0x00, 0x01, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0x73, 0x0f, 0x1c, 0x3e, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x97, 0x50, 0x04, 0x87, 0xba, 0x00, 0xe4,
+};
+static const unsigned char ref_hc[] = {
+    0xff, 0xff, 0x1e, 0x63, 0x7a, 0xa0, 0x7e, 0xe1, 0xea, 0xf2, 0x3d, 0xc7,
+    0x39, 0x6d, 0x0d, 0xa6, 0x78, 0x16, 0x80, 0x05, 0x12, 0x3a, 0xa7, 0x4e,
+    0xde, 0x9f, 0x78, 0x9c, 0x70, 0x63, 0x00, 0x0b, 0xe6, 0xc8, 0x25, 0x21,
+    0x3d, 0xad, 0x22, 0xbc, 0x70, 0xb3, 0x85, 0xda, 0x21, 0x23, 0x63, 0x36,
+    0x17, 0x7b, 0xc3, 0x79, 0xfd, 0x62, 0x6c, 0xf9, 0x66, 0x43, 0xf1, 0x1f,
+    0xbd, 0x61, 0x63, 0xbd, 0x7c, 0x99, 0x90, 0x67, 0xf3, 0xd1, 0x98, 0xf0,
+    0x8c, 0x88, 0xd3, 0x90, 0x34, 0x3f, 0x14, 0xd1, 0xaa, 0xff, 0x72, 0x48,
+    0x27, 0x35, 0xf9, 0xde, 0x34, 0x4e, 0xb0, 0x4a, 0x10, 0xd8, 0xd5, 0x83,
+    0x7e, 0x10, 0xa4, 0x57, 0x4d, 0xd7, 0x31, 0x39, 0x3c, 0x26, 0x9f, 0x56,
+    0x69, 0x48, 0x3b, 0x0d, 0x32, 0x34, 0xa7, 0x0c, 0x79, 0x3d, 0x1a, 0x24,
+    0x37, 0xbf, 0xc2, 0x8b, 0xd2, 0x16, 0x20, 0xcf, 0x84, 0x7c, 0xbe, 0xc6,
+    0xba, 0xbb, 0xf4, 0x77, 0x3f, 0x32, 0x89, 0xc9, 0xbb, 0xae, 0xed, 0x0b,
+    0x7d, 0x14, 0xa7, 0x1e, 0xe0, 0xed, 0x3c, 0x0f, 0x8f, 0x3e, 0xb7, 0x78,
+    0xb6, 0x7e, 0x23, 0x38, 0x04, 0x7c, 0x01, 0x4d, 0x4b, 0x54, 0x38, 0xbd,
+    0xcc, 0x3a, 0xf0, 0x63, 0x23, 0x20, 0xc6, 0x4b, 0x4b, 0xfb, 0xff, 0xbd,
+    0x42, 0x33, 0x75, 0x5f, 0xff, 0x20, 0xe5, 0x40, 0x6d, 0x89, 0x6f, 0xf6,
+    0x43, 0x77, 0xf8, 0xf4, 0x1f, 0x1e, 0x04, 0x87, 0xba, 0x00, 0xe4, 0x21,
+    0x6e, 0x90, 0xf1, 0x46, 0xfd, 0xfd, 0x02, 0x47, 0x05, 0x2a, 0x17, 0x9e,
+    0x5f, 0xd9, 0x80, 0x78, 0x69, 0x83, 0x0a, 0x73, 0x67, 0xd2, 0x82, 0x9c,
+    0x0b, 0x03, 0xe3, 0xc0, 0xf4, 0x9d, 0x33, 0x74, 0xf1, 0x9f, 0x58, 0x1a,
+    0x8e, 0x02, 0x27, 0x78, 0x51, 0xb6, 0xeb, 0x45, 0x10, 0x6d, 0x4a, 0xad,
+    0xfe, 0x90, 0x66, 0xc1, 0xe1, 0xe6, 0xbf, 0x8c, 0x9d, 0x9f, 0x30, 0xe8,
+    0xe4, 0x1a, 0xdc, 0x28, 0xb7, 0x40, 0xd7, 0xe3, 0x78, 0x2c, 0xcb, 0x8c,
+    0x01, 0x96, 0x34, 0x26, 0x51, 0xcb, 0x32, 0xab, 0x0a, 0x18, 0x14, 0x3f,
+    0x03, 0xad, 0x2e, 0x12, 0x58, 0x57, 0xd6, 0x7b, 0x4d, 0xda, 0x20, 0xc6,
+    0xee, 0xf2, 0x4f, 0x2c, 0x01, 0x45, 0x1f, 0x4b, 0x2c, 0x01, 0x4d, 0x1f,
+    0x6c, 0x2c, 0x01, 0x4d, 0x1f, 0x19, 0x2c, 0x01, 0x4d, 0x1f, 0x73, 0x2c,
+    0x01, 0x4d, 0x1f, 0xbc, 0x2c, 0x01, 0x4d, 0x1f, 0x00, 0x2c, 0x01, 0x4d,
+    0x1f, 0x89, 0x2c, 0x01, 0x4d, 0x1f, 0xf1, 0x2c, 0x01, 0x4d, 0x1f, 0x29,
+    0x2c, 0x01, 0x4d, 0x1f, 0x7d, 0x2c, 0x01, 0x4d, 0x1f, 0x7d, 0x2c, 0x01,
+    0x4d, 0x1f, 0xbe, 0x2c, 0x01, 0x4d, 0x1f, 0xf8, 0x2c, 0x01, 0x4d, 0x1f,
+    0x8e, 0x2c, 0x01, 0x4d, 0x1f, 0x6c, 0x2c, 0x01, 0x4d, 0x1f, 0x62, 0x2c,
+    0x01, 0x4d, 0x1f, 0x0a, 0x2c, 0x01, 0x4d, 0x1f, 0x8f, 0x2c, 0x01, 0x4d,
+    0x1f, 0xac, 0x2c, 0x01, 0x4d, 0x1f, 0xf5, 0x2c, 0x01, 0x4d, 0x1f, 0xc1,
+    0x2c, 0x01, 0x4d, 0x1f, 0x71, 0x2c, 0x01, 0x4d, 0x1f, 0x17, 0x2c, 0x01,
+    0x4d, 0x1f, 0x0b, 0x2c, 0x01, 0x4d, 0x1f, 0x04, 0x2c, 0x01, 0x4d, 0x1f,
+    0x78, 0x2c, 0x01, 0x4d, 0x1f, 0x2b, 0x2c, 0x01, 0x4d, 0x1f, 0x3c, 0x2c,
+    0x01, 0x4d, 0x1f, 0x57, 0x2c, 0x01, 0x4d, 0x1f, 0x6f, 0x2c, 0x01, 0x4d,
+    0x1f, 0xf3, 0x2c, 0x01, 0x4d, 0x1f, 0xa5, 0x2c, 0x01, 0x4d, 0x1f, 0xf5,
+    0x2c, 0x01, 0x4d, 0x1f, 0x59, 0x2c, 0x01, 0x4d, 0x1f, 0x4f, 0x2c, 0x01,
+    0x4d, 0x1f, 0xe4, 0x2c, 0x01, 0x4d, 0x1f, 0xaa, 0x2c, 0x01, 0x4d, 0x1f,
+    0xab, 0x2c, 0x01, 0x4d, 0x1f, 0xfa, 0x2c, 0x01, 0x4d, 0x1f, 0xca, 0x2c,
+    0x01, 0x4d, 0x1f, 0xf1, 0x2c, 0x01, 0x4d, 0x1f, 0xcd, 0x2c, 0x01, 0x4d,
+    0x1f, 0x1b, 0x2c, 0x01, 0x4d, 0x1f, 0x62, 0x2c, 0x01, 0x4d, 0x1f, 0x39,
+    0x2c, 0x01, 0x4d, 0x1f, 0xe0, 0x2c, 0x01, 0x4d, 0x1f, 0x63, 0x2c, 0x01,
+    0x4d, 0x1f, 0x3d, 0x2c, 0x01, 0x4d, 0x1f, 0x44, 0x2c, 0x01, 0x4d, 0x1f,
+    0x20, 0x2c, 0x01, 0x4d, 0x1f, 0xaf, 0x2c, 0x01, 0x4d, 0x1f, 0x59, 0x2c,
+    0x01, 0x4d, 0x1f, 0x20, 0x2c, 0x01, 0x4d, 0x1f, 0xbb, 0x2c, 0x01, 0x4d,
+    0x1f, 0x02, 0x2c, 0x01, 0x4d, 0x1f, 0x79, 0x2c, 0x01, 0x4d, 0x1f, 0x8a,
+    0x2c, 0x01, 0x4d, 0x1f, 0x68, 0x2c, 0x01, 0x4d, 0x1f, 0x17, 0x2c, 0x01,
+    0x4d, 0x1f, 0xa6, 0x2c, 0x01, 0x4d, 0x1f, 0x46, 0x2c, 0x01, 0x4d, 0x1f,
+    0xeb, 0x2c, 0x01, 0x4d, 0x1f, 0x27, 0x2c, 0x01, 0x4d, 0x1f, 0xe5, 0x2c,
+    0x01, 0x4d, 0x1f, 0xc7, 0x2c, 0x01, 0x4d, 0x1f, 0x7f, 0x2c, 0x01, 0x4d,
+    0x1f, 0x76, 0x2c, 0x01, 0x4d, 0x1f, 0x2f, 0x2c, 0x01, 0x4d, 0x1f, 0xdf,
+    0x2c, 0x01, 0x4d, 0x1f, 0xfe, 0x2c, 0x01, 0x4d, 0x1f, 0xca, 0x2c, 0x01,
+    0x4d, 0x1f, 0x15, 0x2c, 0x01, 0x4d, 0x1f, 0x4a, 0x2c, 0x01, 0x4d, 0x1f,
+    0x79, 0x2c, 0x01, 0x4d, 0x1f, 0xd0, 0x2c, 0x01, 0x4d, 0x1f, 0x39, 0x2c,
+    0x01, 0x4d, 0x1f, 0xe9, 0x2c, 0x01, 0x4d, 0x1f, 0xbc, 0x2c, 0x01, 0x4d,
+    0x1f, 0x7f, 0x2c, 0x01, 0x4d, 0x1f, 0x67, 0x2c, 0x01, 0x4d, 0x1f, 0x78,
+    0x2c, 0x01, 0x4d, 0x1f, 0xe1, 0x2c, 0x01, 0x4d, 0x1f, 0xb7, 0x2c, 0x01,
+    0x4d, 0x1f, 0x84, 0x2c, 0x01, 0x4d, 0x1f, 0xc8, 0x2c, 0x01, 0x4d, 0x1f,
+    0xf0, 0x2c, 0x01, 0x4d, 0x1f, 0xc9, 0x2c, 0x01, 0x4d, 0x1f, 0xbf, 0x2c,
+    0x01, 0x4d, 0x1f, 0x9d, 0x2c, 0x01, 0x4d, 0x1f, 0xdf, 0x2c, 0x01, 0x4d,
+    0x1f, 0xbe, 0x2c, 0x01, 0x4d, 0x1f, 0x81, 0x2c, 0x01, 0x4d, 0x1f, 0xa7,
+    0x2c, 0x01, 0x4d, 0x1f, 0x33, 0x2c, 0x01, 0x4d, 0x1f, 0xfc, 0x2c, 0x01,
+    0x4d, 0x1f, 0x7f, 0x2c, 0x01, 0x4d, 0x1f, 0x38, 0x2c, 0x01, 0x4d, 0x1f,
+    0xbb, 0x2c, 0x01, 0x4d, 0x1f, 0xdb, 0x2c, 0x01, 0x4d, 0x14, 0xd4, 0x2c,
+    0x01, 0x1f, 0x00, 0x01, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0x73, 0x0f, 0x1c, 0x3e, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x97,
+    0x50, 0x04, 0x87, 0xba, 0x00, 0xe4,
+};
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void)
+{
+    uint32_t x = rnd_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return rnd_state = x;
+}
+
+static size_t text(unsigned char *p)
+{
+    size_t n = 0;
+    for (int i = 0; i < 8; i++, n += 45)
+        memcpy(p + n, "The quick brown fox jumps over the lazy dog. ", 45);
+    memcpy(p + n, "0123456789", 10);
+    return n + 10;
+}
+
+/* Random bytes, then copies of them with a bit flipped every 97 bytes, a
+ * run of zeros and a copy from far back. */
+static void ref_input(unsigned char *p, size_t n)
+{
+    rnd_state = 2463534242u;
+    for (size_t i = 0; i < n; i++) {
+        if (i < 300)
+            p[i] = rnd() & 0xff;
+        else if (i < 10000)
+            p[i] = p[i - 300] ^ (i % 97 == 0);
+        else if (i < 16000)
+            p[i] = 0;
+        else
+            p[i] = p[i - 15900];
+    }
+}
+
+/* Buffers of exactly the size asked, so that a sanitizer catches any
+ * access past them. */
+static void *alloc(size_t n)
+{
+    void *p = malloc(n ? n : 1);
+    CHECK(p);
+    return p;
+}
+
+static long decode(const unsigned char *src, size_t n, unsigned char *out, size_t cap)
+{
+    unsigned char *in = alloc(n), *dst = alloc(cap);
+    memcpy(in, src, n);
+    long r = lz_decompress(in, n, dst, cap);
+    CHECK(r >= -1 && r <= (long)cap);
+    if (r > 0 && out)
+        memcpy(out, dst, r);
+    free(in);
+    free(dst);
+    return r;
+}
+
+/* ref must decode to want. An empty block decodes to nothing, any other
+ * truncation must be rejected or give a strict prefix, and any corruption
+ * must stay inside the output. */
+static void check_ref(const unsigned char *ref, size_t nref, const unsigned char *want,
+                      size_t nwant)
+{
+    unsigned char *out = alloc(nwant), *bad = alloc(nref);
+
+    CHECK(decode(ref, nref, out, nwant) == (long)nwant);
+    CHECK(memcmp(out, want, nwant) == 0);
+    if (nwant > 0)
+        CHECK(decode(ref, nref, NULL, nwant - 1) == -1);
+
+    CHECK(decode(ref, 0, NULL, nwant) == 0);
+    for (size_t k = 1; k < nref; k++) {
+        long r = decode(ref, k, out, nwant);
+        CHECK(r == -1 || (r < (long)nwant && memcmp(out, want, r) == 0));
+    }
+
+    for (size_t i = 0; i < nref; i++) {
+        for (int bit = 0; bit < 8; bit++) {
+            memcpy(bad, ref, nref);
+            bad[i] ^= 1 << bit;
+            decode(bad, nref, NULL, nwant);
+        }
+        memcpy(bad, ref, nref);
+        bad[i] = 0xff;
+        decode(bad, nref, NULL, nwant);
+        bad[i] = 0;
+        decode(bad, nref, NULL, nwant);
+    }
+    free(out);
+    free(bad);
+}
+
+static void ref_test(void)
+{
+    unsigned char t[400], *p = alloc(20000);
+    size_t nt = text(t);
+    ref_input(p, 20000);
+    check_ref(ref_empty, sizeof(ref_empty), t, 0);
+    check_ref(ref_text, sizeof(ref_text), t, nt);
+    check_ref(ref_fast, sizeof(ref_fast), p, 20000);
+    check_ref(ref_hc, sizeof(ref_hc), p, 20000);
+    free(p);
+}
+
+static void garbage_test(void)
+{
+    unsigned char in[64];
+    for (int i = 0; i < 200000; i++) {
+        size_t n = rnd() % sizeof(in);
+        for (size_t j = 0; j < n; j++)
+            in[j] = rnd() & 0xff;
+        decode(in, n, NULL, rnd() % 512);
+    }
+}
+
+static void round_trip(const unsigned char *src, size_t n)
+{
+    size_t cap = LZ_BOUND(n);
+    unsigned char *z = alloc(cap), *out = alloc(n);
+
+    for (int accel = 1; accel <= LZ_ACCEL_MAX; accel *= 2) {
+        size_t nz = lz_compress(src, n, z, cap, accel);
+        CHECK(nz > 0 && nz <= cap);
+        CHECK(decode(z, nz, out, n) == (long)n);
+        CHECK(memcmp(out, src, n) == 0);
+#ifdef HAVE_LZ4
+        CHECK(LZ4_decompress_safe((const char *)z, (char *)out, nz, n) == (int)n);
+        CHECK(memcmp(out, src, n) == 0);
+#endif
+        /* Too small an output buffer fails cleanly. */
+        unsigned char *small = alloc(nz - 1);
+        CHECK(lz_compress(src, n, small, nz - 1, accel) == 0);
+        free(small);
+    }
+#ifdef HAVE_LZ4
+    int nref = LZ4_compress_default((const char *)src, (char *)z, n, cap);
+    CHECK(nref > 0);
+    CHECK(decode(z, nref, out, n) == (long)n);
+    CHECK(memcmp(out, src, n) == 0);
+#endif
+    free(z);
+    free(out);
+}
+
+static void round_trip_test(void)
+{
+    size_t max = 256 * 1024;
+    unsigned char *p = alloc(max);
+
+    for (size_t n = 0; n <= 40; n++) {
+        memset(p, 'a', n);
+        round_trip(p, n);
+        for (size_t i = 0; i < n; i++)
+            p[i] = rnd() & 0xff;
+        round_trip(p, n);
+    }
+    ref_input(p, 20000);
+    round_trip(p, 20000);
+
+    /* Blocks of random, repeated, zero and text-like bytes, with matches
+     * reaching back past the 64 KiB window. */
+    for (int seed = 1; seed <= 4; seed++) {
+        size_t i = 0;
+        rnd_state = seed;
+        while (i < max) {
+            size_t len = 1 + rnd() % 5000;
+            if (len > max - i)
+                len = max - i;
+            switch (rnd() % 4) {
+            case 0:
+                for (size_t j = 0; j < len; j++)
+                    p[i + j] = rnd() & 0xff;
+                break;
+            case 1:
+                memset(p + i, rnd() & 0xff, len);
+                break;
+            case 2:
+                for (size_t j = 0; j < len; j++)
+                    p[i + j] = "etaoin shrdlu"[rnd() % 13];
+                break;
+            default:
+                for (size_t j = 0, back = 1 + rnd() % 100000; j < len; j++)
+                    p[i + j] = i + j >= back ? p[i + j - back] : 0;
+                break;
+            }
+            i += len;
+        }
+        round_trip(p, max);
+    }
+    free(p);
+}
+
+int main(void)
+{
+    ref_test();
+    garbage_test();
+    round_trip_test();
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+int uring_enabled = 0;
+
+/* glibc has no wrappers for these. */
+int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int uring_open(struct uring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    void *sq;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = io_uring_setup(entries, &p);
+    if (r->fd == -1)
+        return -1;
+    r->entries = p.sq_entries;
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_size > r->sq_size)
+            r->sq_size = r->cq_size;
+        r->cq_size = 0;
+    }
+    r->sq_map = mmap(NULL, r->sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED)
+        goto fail_fd;
+    r->cq_map = r->sq_map;
+    if (r->cq_size) {
+        r->cq_map = mmap(NULL, r->cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED)
+            goto fail_sq;
+    }
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail_cq;
+
+    sq = r->sq_map;
+    r->sq_head = (unsigned *)((char *)sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)sq + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_map + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_map + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_map + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_map + p.cq_off.cqes);
+    return 0;
+
+fail_cq:
+    if (r->cq_size)
+        munmap(r->cq_map, r->cq_size);
+fail_sq:
+    munmap(r->sq_map, r->sq_size);
+fail_fd:
+    close(r->fd);
+    r->fd = -1;
+    return -1;
+}
+
+void uring_close(struct uring *r)
+{
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_size)
+        munmap(r->cq_map, r->cq_size);
+    munmap(r->sq_map, r->sq_size);
+    close(r->fd);
+    r->fd = -1;
+}
+
+int uring_splice(struct uring *r, int in, int64_t off_in, int out, int64_t off_out,
+                 unsigned len, unsigned splice_flags, int link, uint64_t tag)
+{
+    unsigned tail = *r->sq_tail + r->queued, idx;
+    struct io_uring_sqe *sqe;
+
+    if (tail - atomic_load_explicit((_Atomic unsigned *)r->sq_head, memory_order_acquire)
+        >= r->entries)
+        return -1;
+    idx = tail & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = in;
+    sqe->splice_off_in = off_in;
+    sqe->fd = out;
+    sqe->off = off_out;
+    sqe->len = len;
+    sqe->splice_flags = splice_flags;
+    if (link & URING_LINK)
+        sqe->flags |= IOSQE_IO_LINK;
+    if (link & URING_HARDLINK)
+        sqe->flags |= IOSQE_IO_HARDLINK;
+    sqe->user_data = tag;
+    r->sq_array[idx] = idx;
+    r->queued++;
+    return 0;
+}
+
+int uring_submit(struct uring *r, unsigned wait)
+{
+    unsigned n = r->queued;
+    int ret;
+
+    atomic_store_explicit((_Atomic unsigned *)r->sq_tail, *r->sq_tail + n, memory_order_release);
+    r->queued = 0;
+    for (;;) {
+        ret = io_uring_enter(r->fd, n, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (ret >= 0 || errno != EINTR)
+            break;
+        /* What was submitted before the signal stays submitted. */
+        n = 0;
+    }
+    return ret < 0 ? -1 : 0;
+}
+
+int uring_reap(struct uring *r, uint64_t *tag, int *res)
+{
+    unsigned head = *r->cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == atomic_load_explicit((_Atomic unsigned *)r->cq_tail, memory_order_acquire))
+        return -1;
+    cqe = &r->cqes[head & *r->cq_mask];
+    *tag = cqe->user_data;
+    *res = cqe->res;
+    atomic_store_explicit((_Atomic unsigned *)r->cq_head, head + 1, memory_order_release);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+
+/* Minimal io_uring over the raw system calls, enough to chain splices so
+ * a pair of them costs one system call instead of two. */
+struct uring {
+    int fd;
+    unsigned entries;
+    /* Submission ring. */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned queued;            /* sqes filled but not yet submitted */
+    /* Completion ring. */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_size, cq_size, sqes_size;
+};
+
+/* Non-zero when -u asked for io_uring where it is available. */
+extern int uring_enabled;
+
+/* Splice links. A short or failed splice cancels the rest of an
+ * URING_LINK chain; URING_HARDLINK carries on regardless. */
+#define URING_LINK 0x1
+#define URING_HARDLINK 0x2
+
+/* A completion result for an operation that moved nothing because its
+ * worker thread was interrupted, for example by SIGSTOP. Such workers
+ * report the kernel's internal ERESTARTSYS (512) rather than EINTR. */
+#define URING_INTERRUPTED(res) ((res) == -EINTR || (res) == -512)
+
+/* Set up a ring of entries submissions. Returns -1 with errno set when
+ * the kernel has no io_uring or it is not permitted. */
+int uring_open(struct uring *r, unsigned entries);
+void uring_close(struct uring *r);
+
+/* Queue a splice of len bytes. An offset of -1 uses the file position,
+ * as it must for pipes and sockets. Returns -1 if the ring is full. */
+int uring_splice(struct uring *r, int in, int64_t off_in, int out, int64_t off_out,
+                 unsigned len, unsigned splice_flags, int link, uint64_t tag);
+
+/* Submit everything queued and wait until wait completions are ready. */
+int uring_submit(struct uring *r, unsigned wait);
+
+/* Take the next completion, returning 0 and its tag and result, or -1 if
+ * there is none. */
+int uring_reap(struct uring *r, uint64_t *tag, int *res);
+
+#endif
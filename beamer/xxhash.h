@@ -0,0 +1,10 @@
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* XXH64 hash of len bytes. Matches the reference implementation. */
+uint64_t xxh64(const void *buf, size_t len, uint64_t seed);
+
+#endif
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "beamer.h"
+#include "lz.h"
+#include "stats.h"
+#include "zstream.h"
+
+#define ZS_SLOTS 4
+
+/* Consecutive chunks the socket waits for at the fastest level before
+ * compression is abandoned for the rest of the range. */
+#define ZS_FAST_LINK 4
+
+/* The raw tail is sent in pieces this size so it can be cancelled. */
+#define ZS_RAW_PIECE (16 * ZS_CHUNK)
+
+struct zs_slot {
+    unsigned char *buf;
+    uint32_t clen;
+    uint32_t rlen;
+};
+
+struct zs_pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct zs_slot slot[ZS_SLOTS];
+    unsigned head;
+    unsigned tail;
+    int starved;
+    int stop;
+    int *accel;
+    int fd;
+    uint64_t off;
+    uint64_t len;
+    const char *path;
+};
+
+static size_t read_chunk(struct zs_pipe *zp, unsigned char *buf, uint64_t pos, size_t n)
+{
+    size_t got = 0;
+    while (got < n) {
+        ssize_t ret = pread(zp->fd, buf + got, n - got, zp->off + pos + got);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret == -1) {
+            fatal("read %s", zp->path);
+        }
+        if (ret == 0) {
+            /* The file shrank; the write that truncated it triggers
+             * another transfer. */
+            memset(buf + got, 0, n - got);
+            break;
+        }
+        got += ret;
+    }
+    return n;
+}
+
+static void *compress_worker(void *arg)
+{
+    struct zs_pipe *zp = arg;
+    unsigned char *in = malloc(ZS_CHUNK);
+    uint64_t pos = 0;
+    int fast = 0;
+
+    if (in == NULL) {
+        fatal("memory error");
+    }
+    while (pos < zp->len) {
+        struct zs_slot *s;
+        int waited = 0;
+
+        pthread_mutex_lock(&zp->lock);
+        while (zp->head - zp->tail == ZS_SLOTS && !zp->stop) {
+            waited = 1;
+            pthread_cond_wait(&zp->cond, &zp->lock);
+        }
+        if (zp->stop) {
+            pthread_mutex_unlock(&zp->lock);
+            break;
+        }
+        int starved = zp->starved;
+        zp->starved = 0;
+        s = &zp->slot[zp->head % ZS_SLOTS];
+        pthread_mutex_unlock(&zp->lock);
+
+        if (waited && *zp->accel > 1)
+            *zp->accel /= 2;
+        else if (starved && *zp->accel < LZ_ACCEL_MAX)
+            *zp->accel *= 2;
+        fast = (starved && *zp->accel == LZ_ACCEL_MAX) ? fast + 1 : 0;
+
+        if (fast >= ZS_FAST_LINK) {
+            s->clen = ZS_RAW_TAIL;
+            s->rlen = 0;
+            pos = zp->len;
+        } else {
+            size_t n = zp->len - pos < ZS_CHUNK ? zp->len - pos : ZS_CHUNK;
+            size_t c;
+            read_chunk(zp, in, pos, n);
+            c = lz_compress(in, n, s->buf, n - 1, *zp->accel);
+            if (c == 0) {
+                memcpy(s->buf, in, n);
+                c = n;
+            }
+            s->clen = c;
+            s->rlen = n;
+            pos += n;
+        }
+
+        pthread_mutex_lock(&zp->lock);
+        zp->head++;
+        pthread_cond_signal(&zp->cond);
+        pthread_mutex_unlock(&zp->lock);
+    }
+    free(in);
+    return NULL;
+}
+
+int zs_send(int sock, int fd, uint64_t off, uint64_t len, const char *path, int *accel,
+            atomic_int *cancel, struct tx_hash *hash, uint64_t *wire)
+{
+    struct zs_pipe zp;
+    pthread_t worker;
+    uint64_t done = 0;
+    int i, ret = 0, err = 0;
+
+    memset(&zp, 0, sizeof(zp));
+    pthread_mutex_init(&zp.lock, NULL);
+    pthread_cond_init(&zp.cond, NULL);
+    zp.accel = accel;
+    zp.fd = fd;
+    zp.off = off;
+    zp.len = len;
+    zp.path = path;
+    for (i = 0; i < ZS_SLOTS; i++) {
+        zp.slot[i].buf = malloc(ZS_CHUNK);
+        if (zp.slot[i].buf == NULL) {
+            fatal("memory error");
+        }
+    }
+    if (pthread_create(&worker, NULL, compress_worker, &zp) != 0) {
+        fatal("pthread_create");
+    }
+
+    *wire = 0;
+    while (done < len && ret == 0) {
+        unsigned char rec[ZS_RECORD_SIZE];
+        struct zs_slot *s;
+
+        if (cancel && atomic_load(cancel))
+            break;
+
+        pthread_mutex_lock(&zp.lock);
+        if (zp.head == zp.tail && done > 0)
+            zp.starved = 1;
+        while (zp.head == zp.tail)
+            pthread_cond_wait(&zp.cond, &zp.lock);
+        s = &zp.slot[zp.tail % ZS_SLOTS];
+        pthread_mutex_unlock(&zp.lock);
+
+        put32(put32(rec, s->clen), s->rlen);
+        if (write_full(sock, rec, sizeof(rec)) == -1) {
+            ret = -1;
+            err = errno;
+        } else if (s->clen == ZS_RAW_TAIL) {
+            while (done < len && !(cancel && atomic_load(cancel))) {
+                uint64_t n = len - done < ZS_RAW_PIECE ? len - done : ZS_RAW_PIECE;
+                int sent = send_range(sock, fd, off + done, n, path);
+                if (sent == -1) {
+                    ret = -1;
+                    err = errno;
+                    break;
+                }
+                if (sent && cancel)
+                    atomic_fetch_or(cancel, 1);
+                *wire += n;
+                done += n;
+                if (hash)
+                    hash_upto(hash, off + done);
+            }
+        } else {
+            stats_wait_writable(sock);
+            if (write_full(sock, s->buf, s->clen) == -1) {
+                ret = -1;
+                err = errno;
+            }
+            *wire += s->clen;
+            done += s->rlen;
+        }
+
+        pthread_mutex_lock(&zp.lock);
+        zp.tail++;
+        pthread_cond_signal(&zp.cond);
+        pthread_mutex_unlock(&zp.lock);
+        if (hash && ret == 0)
+            hash_upto(hash, off + done);
+    }
+
+    pthread_mutex_lock(&zp.lock);
+    zp.stop = 1;
+    pthread_cond_signal(&zp.cond);
+    pthread_mutex_unlock(&zp.lock);
+    pthread_join(worker, NULL);
+    for (i = 0; i < ZS_SLOTS; i++)
+        free(zp.slot[i].buf);
+    pthread_cond_destroy(&zp.cond);
+    pthread_mutex_destroy(&zp.lock);
+    errno = err;
+    return ret;
+}
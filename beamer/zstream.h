@@ -0,0 +1,34 @@
+#ifndef ZSTREAM_H
+#define ZSTREAM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+struct tx_hash;
+
+/* Compressed encoding of a byte range of a file. The range is split into
+ * ZS_CHUNK byte chunks, each sent as a record of the compressed and raw
+ * lengths (network order) followed by the LZ compressed bytes, or the raw
+ * bytes when compression does not help. A record with compressed length
+ * ZS_RAW_TAIL is followed by the rest of the range uncompressed. */
+
+#define ZS_CHUNK (256 * 1024)
+#define ZS_RECORD_SIZE 8
+#define ZS_RAW_TAIL 0xffffffffu
+
+/* Send len bytes of fd from off, setting *wire to the bytes put on the
+ * wire. Returns -1 with errno set if the socket or the file fails.
+ * Compression runs on a worker thread ahead of the socket writes.
+ *
+ * accel is the compression level, carried between transfers on the same
+ * socket and starting at 1. It doubles when the socket writer waits for
+ * the compressor and halves when the compressor waits for the socket, so
+ * slow links get the best ratio and fast links fall back to sendfile().
+ *
+ * If cancel is not NULL and becomes non-zero the transfer stops at the
+ * next chunk, leaving the stream unusable. If hash is not NULL it is
+ * carried on while the compressor works ahead. */
+int zs_send(int sock, int fd, uint64_t off, uint64_t len, const char *path, int *accel,
+            atomic_int *cancel, struct tx_hash *hash, uint64_t *wire);
+
+#endif
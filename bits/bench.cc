@@ -0,0 +1,178 @@
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bitmap.hh"
+#include "bits.hh"
+#include "bitstream.hh"
+#include "rank_select.hh"
+#include "setops.hh"
+
+// Micro benchmarks for the bits library. Build with
+// -DCMAKE_BUILD_TYPE=Release for meaningful numbers. Each line reports the
+// operation, input size in bytes, time per operation and, for range
+// operations, the input bandwidth.
+//
+//   bench [filter]
+//
+// runs only benchmarks whose name contains filter.
+
+namespace {
+  typedef std::chrono::steady_clock clock_type;
+
+  const char *filter = nullptr;
+
+  // Keep results live without a memory barrier per iteration.
+  volatile std::uint64_t sink;
+
+  // Run f repeatedly for about 0.2s and report per call figures. f returns
+  // a value folded into sink. ops is the number of operations per call and
+  // bytes the input size, which f reads in full when bandwidth is set.
+  template <typename F>
+  void run(const char *name, std::size_t bytes, std::size_t ops, F f, bool bandwidth = true) {
+    if (filter && !std::strstr(name, filter))
+      return;
+    std::uint64_t acc = f();
+    std::size_t iters = 1;
+    double secs = 0;
+    for (;;) {
+      auto start = clock_type::now();
+      for (std::size_t i = 0; i < iters; i++)
+        acc += f();
+      secs = std::chrono::duration<double>(clock_type::now() - start).count();
+      if (secs > 0.2)
+        break;
+      iters *= (secs < 0.01) ? 10 : 2;
+    }
+    sink = acc;
+    double ns = secs * 1e9 / (double(iters) * ops);
+    if (bytes && bandwidth)
+      std::printf("%-24s %10zu %10.3f ns/op %8.2f GB/s\n", name, bytes, ns,
+                  double(bytes) * iters / secs / 1e9);
+    else if (bytes)
+      std::printf("%-24s %10zu %10.3f ns/op\n", name, bytes, ns);
+    else
+      std::printf("%-24s %10s %10.3f ns/op\n", name, "-", ns);
+  }
+
+  void fill_random(std::vector<std::uint64_t> &v, std::uint64_t seed) {
+    std::mt19937_64 rnd(seed);
+    for (auto &w : v)
+      w = rnd();
+  }
+
+  std::vector<std::uint64_t> random_words(std::size_t n, std::uint64_t seed) {
+    std::vector<std::uint64_t> v(n);
+    fill_random(v, seed);
+    return v;
+  }
+
+  void scalar_benchmarks() {
+    std::vector<std::uint64_t> v = random_words(1024, 1);
+    run("count_u64", 0, v.size(), [&]() {
+        std::uint64_t n = 0;
+        for (std::uint64_t w : v)
+          n += bits::count(w);
+        return n;
+      });
+    run("alter_u64", 0, v.size(), [&]() {
+        for (std::size_t i = 0; i < v.size(); i++)
+          bits::alter(v[i], bits::bit_off(i % 64), bits::bit_off(i % 32), i & 1);
+        return v[7];
+      });
+    run("copy_u64", 0, v.size(), [&]() {
+        std::uint64_t d = 0;
+        for (std::size_t i = 0; i < v.size(); i++)
+          bits::copy(v[i], bits::rng(bits::bit_off(12 + i % 8), 4), d, bits::bit_off(i % 32));
+        return d;
+      });
+    run("copy_u64_static", 0, v.size(), [&]() {
+        std::uint64_t d = 0;
+        for (std::size_t i = 0; i < v.size(); i++) {
+          bits::copy<19, 4, 20>(v[i], d);
+          d ^= v[i];
+        }
+        return d;
+      });
+    run("make_mask_u64", 0, v.size(), [&]() {
+        std::uint64_t m = 0;
+        for (std::size_t i = 0; i < v.size(); i++)
+          m ^= bits::make_mask<std::uint64_t>(bits::bit_off(v[i] % 64 | 32), bits::bit_off(v[i] % 32));
+        return m;
+      });
+  }
+
+  void range_benchmarks(std::size_t bytes) {
+    std::size_t n = bytes / sizeof(std::uint64_t);
+    std::vector<std::uint64_t> a = random_words(n, 2), b = random_words(n, 3);
+    const std::uint64_t *pa = a.data(), *pb = b.data();
+    bits::bitmap_view<std::uint64_t> view(a.data(), n * 64);
+
+    run("count_range", bytes, 1, [&]() { return bits::count(pa, pa + n); });
+    run("alter_range", bytes, 1, [&]() {
+        bits::alter(a.begin(), a.end(), bits::bit_off(n * 64 - 2), 1, true);
+        return a[0];
+      });
+    run("bitmap_assign", bytes, 1, [&]() {
+        view.assign(n * 64 - 2, 1, false);
+        return a[0];
+      });
+    run("bitmap_find_first_set", bytes, 1, [&]() {
+        a.back() |= std::uint64_t(1) << 63;
+        return view.find_first_set(2);
+      });
+    fill_random(a, 2);
+    run("and_into", bytes * 2, 1, [&]() {
+        bits::and_into(a.data(), a.data() + n, pb);
+        return a[0];
+      });
+    fill_random(a, 2);
+    run("and_count", bytes * 2, 1, [&]() { return bits::and_count(pa, pa + n, pb); });
+    run("and_count_4t", bytes * 2, 1, [&]() { return bits::and_count(pa, pa + n, pb, 4); });
+    run("xor_count", bytes * 2, 1, [&]() { return bits::xor_count(pa, pa + n, pb); });
+
+    bits::rank_select rs(pa, n * 64);
+    std::size_t ones = rs.count();
+    std::mt19937_64 rnd(4);
+    std::vector<std::size_t> q(1024);
+    for (auto &x : q)
+      x = rnd() % (n * 64);
+    run("rank", bytes, q.size(), [&]() {
+        std::uint64_t s = 0;
+        for (std::size_t x : q)
+          s += rs.rank(x);
+        return s;
+      }, false);
+    run("select", bytes, q.size(), [&]() {
+        std::uint64_t s = 0;
+        for (std::size_t x : q)
+          s += rs.select(x % ones);
+        return s;
+      }, false);
+
+    std::size_t fields = bytes * 8 / 13;
+    std::vector<std::uint32_t> out(fields);
+    run("unpack_13bit", bytes, fields, [&]() {
+        bits::unpack_fields(reinterpret_cast<const unsigned char *>(pa), bytes, fields, 13, out.data());
+        return out[fields / 2];
+      });
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1)
+    filter = argv[1];
+  std::printf("%-24s %10s %16s %13s\n", "benchmark", "bytes", "time", "bandwidth");
+  scalar_benchmarks();
+  for (std::size_t bytes : { std::size_t(4) << 10, std::size_t(256) << 10, std::size_t(16) << 20 })
+    range_benchmarks(bytes);
+  return 0;
+}
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bits.hh"
+
+namespace bits {
+  namespace detail {
+    // Index of the first word in [i, n) that differs from fill. Fill must be
+    // all zeros or all ones so it can be compared a byte at a time.
+    template <typename W>
+    std::size_t skip_fill(const W *w, std::size_t i, std::size_t n, W fill) {
+      assert(fill == 0 || fill == std::numeric_limits<W>::max());
+#if defined(__AVX2__)
+      const std::size_t step = sizeof(__m256i) / sizeof(W);
+      const __m256i f = _mm256_set1_epi8(char(fill));
+      for (; i + step <= n; i += step) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, f)) != -1)
+          break;
+      }
+#elif defined(__SSE2__)
+      const std::size_t step = sizeof(__m128i) / sizeof(W);
+      const __m128i f = _mm_set1_epi8(char(fill));
+      for (; i + step <= n; i += step) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(w + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, f)) != 0xffff)
+          break;
+      }
+#endif
+      while (i < n && w[i] == fill)
+        i++;
+      return i;
+    }
+
+    // Operations shared by bitmap and bitmap_view. Derived provides data()
+    // and size(). Bit i lives in word i / digits at position i % digits, the
+    // same layout alter() uses for ranges of words.
+    template <typename Derived, typename W>
+    class bitmap_base {
+    public:
+      typedef W word_type;
+      static const std::size_t word_bits = std::numeric_limits<W>::digits;
+      static const std::size_t npos = std::size_t(-1);
+
+      // Iterates over the offsets of set bits in ascending order.
+      class set_bit_iterator {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::size_t value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::size_t *pointer;
+        typedef std::size_t reference;
+
+        set_bit_iterator(const W *w, std::size_t nbits, std::size_t idx) :
+          w_(w), nbits_(nbits), nwords_(word_count(nbits)), idx_(idx), cur_(0) {
+          if (idx_ < nwords_) {
+            cur_ = load(idx_);
+            if (!cur_)
+              advance();
+          }
+        }
+
+        std::size_t operator*() const {
+          return idx_ * word_bits + ctz(cur_);
+        }
+
+        set_bit_iterator &operator++() {
+          cur_ &= cur_ - 1;
+          if (!cur_)
+            advance();
+          return *this;
+        }
+
+        set_bit_iterator operator++(int) {
+          set_bit_iterator tmp(*this);
+          ++*this;
+          return tmp;
+        }
+
+        bool operator==(const set_bit_iterator &o) const {
+          return idx_ == o.idx_ && cur_ == o.cur_;
+        }
+
+        bool operator!=(const set_bit_iterator &o) const {
+          return !(*this == o);
+        }
+
+      private:
+        W load(std::size_t i) const {
+          return (i == nwords_ - 1) ? W(w_[i] & tail_mask(nbits_)) : w_[i];
+        }
+
+        void advance() {
+          while (!cur_) {
+            idx_ = skip_fill(w_, idx_ + 1, nwords_, W(0));
+            if (idx_ >= nwords_) {
+              idx_ = nwords_;
+              cur_ = 0;
+              return;
+            }
+            cur_ = load(idx_);
+          }
+        }
+
+        const W *w_;
+        std::size_t nbits_;
+        std::size_t nwords_;
+        std::size_t idx_;
+        W cur_;
+      };
+
+      struct set_bit_range {
+        set_bit_iterator bg, nd;
+        set_bit_iterator begin() const { return bg; }
+        set_bit_iterator end() const { return nd; }
+      };
+
+      static std::size_t word_count(std::size_t nbits) {
+        return (nbits + word_bits - 1) / word_bits;
+      }
+
+      bool test(std::size_t i) const {
+        assert(i < size());
+        return (words()[i / word_bits] >> (i % word_bits)) & 1;
+      }
+
+      void set(std::size_t i) {
+        assert(i < size());
+        words()[i / word_bits] |= W(1) << (i % word_bits);
+      }
+
+      void clear(std::size_t i) {
+        assert(i < size());
+        words()[i / word_bits] &= W(~(W(1) << (i % word_bits)));
+      }
+
+      // Ranges are inclusive and given high bit first, as with rng.
+      void set(std::size_t hi, std::size_t lo) {
+        assign(hi, lo, true);
+      }
+
+      void clear(std::size_t hi, std::size_t lo) {
+        assign(hi, lo, false);
+      }
+
+      void assign(std::size_t hi, std::size_t lo, bool val) {
+        assert(hi >= lo && hi < size());
+        W *w = words();
+        std::size_t bw = lo / word_bits, ew = hi / word_bits;
+        W lo_msk = W(ones << (lo % word_bits));
+        W hi_msk = W(ones >> (word_bits - 1 - hi % word_bits));
+        if (bw == ew) {
+          fill_word(w[bw], W(lo_msk & hi_msk), val);
+          return;
+        }
+        fill_word(w[bw], lo_msk, val);
+        for (std::size_t i = bw + 1; i < ew; i++)
+          w[i] = val ? ones : W(0);
+        fill_word(w[ew], hi_msk, val);
+      }
+
+      // True when every bit in [lo, hi] is set.
+      bool all(std::size_t hi, std::size_t lo) const {
+        assert(hi >= lo && hi < size());
+        std::size_t c = find_first_clear(lo);
+        return c == npos || c > hi;
+      }
+
+      // True when some bit in [lo, hi] is set.
+      bool any(std::size_t hi, std::size_t lo) const {
+        assert(hi >= lo && hi < size());
+        std::size_t s = find_first_set(lo);
+        return s != npos && s <= hi;
+      }
+
+      bool none(std::size_t hi, std::size_t lo) const {
+        return !any(hi, lo);
+      }
+
+      std::size_t count() const {
+        std::size_t nw = word_count(size());
+        if (nw == 0)
+          return 0;
+        const W *w = words();
+        return bits::count(w, w + nw - 1) + bits::count(W(w[nw - 1] & tail_mask(size())));
+      }
+
+      // Offset of the first set bit at or after from, or npos.
+      std::size_t find_first_set(std::size_t from = 0) const {
+        return find_first(from, W(0));
+      }
+
+      // Offset of the first clear bit at or after from, or npos.
+      std::size_t find_first_clear(std::size_t from = 0) const {
+        return find_first(from, ones);
+      }
+
+      // Offset of the last set bit at or before from, or npos.
+      std::size_t find_last_set(std::size_t from = npos) const {
+        if (size() == 0)
+          return npos;
+        if (from >= size())
+          from = size() - 1;
+        const W *w = words();
+        std::size_t i = from / word_bits;
+        W cur = W(w[i] & (ones >> (word_bits - 1 - from % word_bits)));
+        while (!cur) {
+          if (i == 0)
+            return npos;
+          cur = w[--i];
+        }
+        return i * word_bits + (word_bits - 1 - clz(cur));
+      }
+
+      // Offset of the first run of at least len clear bits starting at or
+      // after from, or npos.
+      std::size_t find_clear_run(std::size_t len, std::size_t from = 0) const {
+        std::size_t s = find_first_clear(from);
+        if (len == 0)
+          return from < size() ? from : npos;
+        while (s != npos) {
+          std::size_t e = find_first_set(s);
+          std::size_t end = (e == npos) ? size() : e;
+          if (end - s >= len)
+            return s;
+          if (e == npos)
+            break;
+          s = find_first_clear(e);
+        }
+        return npos;
+      }
+
+      set_bit_iterator begin_set() const {
+        return set_bit_iterator(words(), size(), 0);
+      }
+
+      set_bit_iterator end_set() const {
+        return set_bit_iterator(words(), size(), word_count(size()));
+      }
+
+      // For use with range-for: for (auto i : bm.set_bits()) ...
+      set_bit_range set_bits() const {
+        set_bit_range r = { begin_set(), end_set() };
+        return r;
+      }
+
+    protected:
+      static const W ones = std::numeric_limits<W>::max();
+
+      // Mask of the valid bits in the last word.
+      static W tail_mask(std::size_t nbits) {
+        std::size_t r = nbits % word_bits;
+        return r ? W(ones >> (word_bits - r)) : ones;
+      }
+
+      static void fill_word(W &w, W msk, bool val) {
+        w = val ? W(w | msk) : W(w & ~msk);
+      }
+
+    private:
+      const Derived &derived() const { return static_cast<const Derived &>(*this); }
+      Derived &derived() { return static_cast<Derived &>(*this); }
+      W *words() { return derived().data(); }
+      const W *words() const { return derived().data(); }
+      std::size_t size() const { return derived().size(); }
+
+      // Shared search for set (fill 0) or clear (fill all ones) bits.
+      std::size_t find_first(std::size_t from, W fill) const {
+        if (from >= size())
+          return npos;
+        const W *w = words();
+        std::size_t nw = word_count(size());
+        std::size_t i = from / word_bits;
+        W cur = W((w[i] ^ fill) & (ones << (from % word_bits)));
+        if (!cur) {
+          i = skip_fill(w, i + 1, nw, fill);
+          if (i == nw)
+            return npos;
+          cur = W(w[i] ^ fill);
+        }
+        std::size_t pos = i * word_bits + ctz(cur);
+        return pos < size() ? pos : npos;
+      }
+    };
+
+    template <typename Derived, typename W>
+    const std::size_t bitmap_base<Derived, W>::word_bits;
+
+    template <typename Derived, typename W>
+    const std::size_t bitmap_base<Derived, W>::npos;
+
+    template <typename Derived, typename W>
+    const W bitmap_base<Derived, W>::ones;
+  }
+
+  // Non-owning bitmap over existing word storage, for example an array
+  // already managed with alter(). Bits of the last word beyond nbits are
+  // ignored by searches and counts and never modified.
+  // Read only views use a const word type, e.g. bitmap_view<const unsigned>.
+  template <typename W = std::uint64_t>
+  class bitmap_view : public detail::bitmap_base<bitmap_view<W>, typename std::remove_const<W>::type> {
+    static_assert(std::numeric_limits<W>::is_integer && !std::numeric_limits<W>::is_signed,
+                  "Bitmap words must be unsigned integers.");
+  public:
+    bitmap_view(W *words, std::size_t nbits) :
+      w_(words), nbits_(nbits) {
+    }
+
+    W *data() const { return w_; }
+    std::size_t size() const { return nbits_; }
+
+  private:
+    W *w_;
+    std::size_t nbits_;
+  };
+
+  // Owning, resizable bitmap. Bits of the last word beyond size() are kept
+  // clear.
+  template <typename W = std::uint64_t>
+  class bitmap : public detail::bitmap_base<bitmap<W>, W> {
+    static_assert(std::numeric_limits<W>::is_integer && !std::numeric_limits<W>::is_signed,
+                  "Bitmap words must be unsigned integers.");
+    typedef detail::bitmap_base<bitmap<W>, W> base;
+  public:
+    explicit bitmap(std::size_t nbits = 0, bool val = false) :
+      nbits_(0) {
+      resize(nbits, val);
+    }
+
+    W *data() { return w_.data(); }
+    const W *data() const { return w_.data(); }
+    std::size_t size() const { return nbits_; }
+
+    void resize(std::size_t nbits, bool val = false) {
+      std::size_t old = nbits_;
+      w_.resize(base::word_count(nbits), val ? base::ones : W(0));
+      nbits_ = nbits;
+      if (val && nbits > old)
+        this->set(nbits - 1, old);
+      if (!w_.empty())
+        w_.back() &= base::tail_mask(nbits_);
+    }
+
+    bitmap_view<W> view() { return bitmap_view<W>(data(), nbits_); }
+
+  private:
+    std::vector<W> w_;
+    std::size_t nbits_;
+  };
+}
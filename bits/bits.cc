@@ -28,6 +28,39 @@ struct core_test {
   }  
 };
 
+// Compile time checks of the constexpr mask and copy operations.
+static_assert(bits::make_mask<unsigned char>(7, 0) == 0xffU, "Full width mask.");
+static_assert(bits::make_mask<unsigned long long>(63, 0) == ~0ULL, "Full width mask.");
+static_assert(bits::make_mask<unsigned long long>(63, 63) == 1ULL << 63, "Top bit mask.");
+static_assert(bits::make_mask<unsigned>(3, 4) == 0, "Empty mask.");
+static_assert(bits::make_mask<unsigned, 7, 4>() == 0xf0U, "Template mask.");
+static_assert(bits::make_mask<unsigned short>(bits::rng(11, 4)) == 0xff0U, "Range mask.");
+static_assert(bits::rng(3, 4).size() == 0, "Empty range.");
+static_assert(bits::count(0xf0f0U) == 8, "Constexpr count.");
+
+constexpr unsigned short encode_field(char v) {
+  unsigned short dst = 0xf00f;
+  bits::copy<7, 0, 4>(v, dst);
+  return dst;
+}
+static_assert(encode_field(char(0x55)) == 0xf55fU, "Template copy.");
+
+constexpr unsigned long long encode_full(unsigned long long v) {
+  unsigned long long dst = 0;
+  bits::copy(v, bits::rng(63, 0), dst, 0);
+  bits::copy<63, 0, 0>(v, dst);
+  return dst;
+}
+static_assert(encode_full(~0ULL) == ~0ULL, "Full width copy.");
+
+constexpr unsigned char encode_empty() {
+  unsigned char dst = 0x5a;
+  bits::copy(char(-1), bits::rng(3, 4), dst, 8);
+  bits::copy<7, 8, 8>(char(-1), dst);
+  return dst;
+}
+static_assert(encode_empty() == 0x5aU, "Empty copy.");
+
 int main() {
   using namespace std;
 
@@ -45,7 +78,7 @@ int main() {
   assert(ucdst == 0x80U);
 
   bits::copy(char(1), bits::rng::one(0), usdst, 15);  
-  assert(usdst = 0x8000U);
+  assert(usdst == 0x8000U);
 
   ucdst = 0;
   bits::copy(ushort(1), bits::rng::one(0), ucdst, 7);
@@ -64,10 +97,15 @@ int main() {
           
   char v2[] = { 0, 0, 0 };
   bits::alter(&v2[0], &v2[3], 11, 10, 1);
-  assert((std::vector<char>(&v2[0], &v2[3]) == std::vector<char>{ 0, 0x3c, 0 }));
+  assert((std::vector<char>(&v2[0], &v2[3]) == std::vector<char>{ 0, 0x0c, 0 }));
   
+  // Negative sources copy their bit pattern, not a sign extended value.
+  usdst = 0;
+  bits::copy<7, 4, 12>(char(-128), usdst);
+  assert(usdst == 0x8000U);
+
   unsigned short v1 = 0;
   bits::alter(v1, 3, 0, 1);
-  assert(v1 = 0x4);
+  assert(v1 == 0xf);
   return 0;
 }
@@ -4,8 +4,18 @@
 
 namespace bits {
   template <typename T>
-  std::size_t count(T var) {
-    typename as_unsigned<T>::type v(var);
+  constexpr std::size_t count(T var) {
+    typedef typename as_unsigned<T>::type u_type;
+    typedef std::numeric_limits<u_type> UL;
+    u_type v(var);
+#if defined(__GNUC__)
+    if (UL::digits <= std::numeric_limits<unsigned>::digits)
+      return __builtin_popcount(v);
+    if (UL::digits <= std::numeric_limits<unsigned long>::digits)
+      return __builtin_popcountl(v);
+    if (UL::digits <= std::numeric_limits<unsigned long long>::digits)
+      return __builtin_popcountll(v);
+#endif
     std::size_t cnt = 0;
     while (v) {
       v &= v - 1;
@@ -23,96 +33,181 @@ namespace bits {
     return cnt;
   }
 
+  // Index of the lowest set bit. Like the compiler builtins, the result is
+  // undefined when no bit is set.
+  template <typename T>
+  unsigned ctz(T var) {
+    typedef typename as_unsigned<T>::type u_type;
+    typedef std::numeric_limits<u_type> UL;
+    static_assert(UL::digits <= std::numeric_limits<unsigned long long>::digits,
+                  "Type wider than unsigned long long.");
+    u_type v(var);
+    assert(v != 0);
+#if defined(__GNUC__)
+    if (UL::digits <= std::numeric_limits<unsigned>::digits)
+      return __builtin_ctz(v);
+    if (UL::digits <= std::numeric_limits<unsigned long>::digits)
+      return __builtin_ctzl(v);
+    return __builtin_ctzll(v);
+#else
+    unsigned n = 0;
+    while (!(v & 1)) {
+      v >>= 1;
+      n++;
+    }
+    return n;
+#endif
+  }
+
+  // Number of clear bits above the highest set bit. Undefined when no bit
+  // is set.
+  template <typename T>
+  unsigned clz(T var) {
+    typedef typename as_unsigned<T>::type u_type;
+    typedef std::numeric_limits<u_type> UL;
+    static_assert(UL::digits <= std::numeric_limits<unsigned long long>::digits,
+                  "Type wider than unsigned long long.");
+    u_type v(var);
+    assert(v != 0);
+#if defined(__GNUC__)
+    if (UL::digits <= std::numeric_limits<unsigned>::digits)
+      return __builtin_clz(v) - (std::numeric_limits<unsigned>::digits - UL::digits);
+    if (UL::digits <= std::numeric_limits<unsigned long>::digits)
+      return __builtin_clzl(v) - (std::numeric_limits<unsigned long>::digits - UL::digits);
+    return __builtin_clzll(v) - (std::numeric_limits<unsigned long long>::digits - UL::digits);
+#else
+    unsigned n = 0;
+    while (!(v & (u_type(1) << (UL::digits - 1)))) {
+      v <<= 1;
+      n++;
+    }
+    return n;
+#endif
+  }
+
   typedef unsigned bit_off;
 
+  // Inclusive bit range, high bit first. An empty range is written with hi
+  // one below lo, for example rng(3, 4).
   struct rng {
     bit_off hi;
     bit_off lo;
 
-    rng(bit_off h, bit_off l) :
+    constexpr rng(bit_off h, bit_off l) :
       hi(h), lo(l) {
-      assert(hi >= lo);
+      assert(bit_off(hi + 1) >= lo);
     }
 
-    rng(bit_off r[2]) :
+    constexpr rng(bit_off r[2]) :
       hi(r[0]), lo(r[1]) {
       assert(hi > lo);
     }
 
-    static rng one(bit_off o) {
+    static constexpr rng one(bit_off o) {
       return rng(o, o);
     }
-    
-    std::size_t size() const {
-      return (hi - lo) + 1;
+
+    constexpr std::size_t size() const {
+      return bit_off(hi - lo + 1);
     }
   };
 
-  std::size_t range_size(bit_off hi, bit_off lo) {
-    return (hi - lo) + 1;
+  constexpr std::size_t range_size(bit_off hi, bit_off lo) {
+    return bit_off(hi - lo + 1);
   }
 
+  // Mask of the bits in [lo, hi]. Full width and empty ranges are valid.
   template <typename T>
-  T make_mask(bit_off hi, bit_off lo) {
-    static const T msk = std::numeric_limits<T>::max();
-    std::size_t sz = (hi - lo) + 1;
-    return (msk >> (std::numeric_limits<T>::digits - sz)) << lo;
+  constexpr T make_mask(bit_off hi, bit_off lo) {
+    typedef std::numeric_limits<T> TL;
+    const std::size_t sz = range_size(hi, lo);
+    assert(lo + sz <= std::size_t(TL::digits));
+    if (sz == 0)
+      return T(0);
+    return T(T(TL::max() >> (TL::digits - sz)) << lo);
   }
 
   template <typename T>
-  T make_mask(const rng &r) {
+  constexpr T make_mask(const rng &r) {
     return make_mask<T>(r.hi, r.lo);
   }
 
+  // Mask computed at compile time from a range known at compile time.
+  template <typename T, bit_off Hi, bit_off Lo>
+  constexpr T make_mask() {
+    static_assert(bit_off(Hi + 1) >= Lo, "Invalid bit range.");
+    static_assert(Lo + range_size(Hi, Lo) <= std::size_t(std::numeric_limits<T>::digits),
+                  "Bit range exceeds type.");
+    return make_mask<T>(Hi, Lo);
+  }
+
   template <typename T>
-  void alter(T &var, bit_off hi, bit_off lo, bool val) {
+  constexpr void alter(T &var, bit_off hi, bit_off lo, bool val) {
     typedef typename as_unsigned<T>::type u_type;
     u_type msk = make_mask<u_type>(hi, lo);
     var = (val) ? var | msk : var & ~msk;
   }
 
+  // Set or clear bits [lo, hi] of a range of words, where bit i is bit
+  // i % digits of word i / digits.
   template <typename Iter>
   void alter(Iter bg, Iter nd, bit_off hi, bit_off lo, bool val) {
     typedef typename std::iterator_traits<Iter>::value_type IT;
-    std::size_t blk_size = std::numeric_limits<typename as_unsigned<IT>::type>::digits;
-
-    // Should optimize by skipping to the first block containing to the lowest bit.
-    for (Iter i = bg; i != nd; i++) {
-      auto blk_off = std::distance(bg, i) * blk_size; // Block offset in bits.
-
-      // If the bit range starts within the current block.
-      if (lo >= blk_off && lo <= (blk_off + blk_size)) {
-        auto rem = hi - lo;     // Number of bits remaining in target range.
-
-        // Highest bit of the target range within the block.
-        auto blk_hi = (rem / blk_size) ? blk_size - 1 : (lo + hi) % blk_size;
-        alter(*i, blk_hi, lo % blk_size, val);
-        if ((blk_off + blk_size) >= hi) {
-          break;
-        }
-        lo += blk_size - (lo % blk_size);
-      }
+    const bit_off blk_size = std::numeric_limits<typename as_unsigned<IT>::type>::digits;
+    assert(hi >= lo);
+
+    const bit_off lo_blk = lo / blk_size, hi_blk = hi / blk_size;
+    for (bit_off blk = 0; bg != nd && blk <= hi_blk; ++bg, ++blk) {
+      if (blk < lo_blk)
+        continue;
+      // Portion of the target range within this block.
+      bit_off blk_lo = (blk == lo_blk) ? lo % blk_size : 0;
+      bit_off blk_hi = (blk == hi_blk) ? hi % blk_size : blk_size - 1;
+      alter(*bg, blk_hi, blk_lo, val);
     }
   }
 
   template <typename ST, typename DT>
-  void copy(ST src, rng src_rng, DT &dst, bit_off dst_off) {
+  constexpr void copy(ST src, rng src_rng, DT &dst, bit_off dst_off) {
     typedef typename as_unsigned<ST>::type UST;
     typedef std::numeric_limits<UST> USL;
     typedef typename as_unsigned<DT>::type UDT;
     typedef std::numeric_limits<UDT> UDL;
 
-    assert(src_rng.size() > 0);
     if (src_rng.size() == 0)
       return;
-    
+
     assert(USL::digits >= src_rng.size() + src_rng.lo);
 
     rng dst_rng(dst_off + src_rng.size() - 1, dst_off);
     assert(UDL::digits > dst_rng.hi);
 
-    dst &= ~bits::make_mask<UDT>(dst_rng);
-    src = (src & make_mask<UST>(src_rng)) >> src_rng.lo;
-    dst |= src << dst_rng.lo;
+    UST val = UST(UST(src) & make_mask<UST>(src_rng)) >> src_rng.lo;
+    dst = DT(UDT(dst) & UDT(~make_mask<UDT>(dst_rng)));
+    dst = DT(UDT(dst) | UDT(UDT(val) << dst_rng.lo));
+  }
+
+  // Copy with the source range and destination offset fixed at compile
+  // time, e.g. bits::copy<7, 0, 4>(src, dst). The masks and shifts fold to
+  // constants.
+  template <bit_off Hi, bit_off Lo, bit_off DstOff, typename ST, typename DT>
+  constexpr void copy(ST src, DT &dst) {
+    typedef typename as_unsigned<ST>::type UST;
+    typedef typename as_unsigned<DT>::type UDT;
+    constexpr std::size_t sz = range_size(Hi, Lo);
+    static_assert(Lo + sz <= std::size_t(std::numeric_limits<UST>::digits),
+                  "Source range exceeds source type.");
+    static_assert(DstOff + sz <= std::size_t(std::numeric_limits<UDT>::digits),
+                  "Destination range exceeds destination type.");
+
+    if (sz == 0)
+      return;
+    // Shifts are zeroed for empty ranges so they stay in bounds.
+    constexpr bit_off src_sh = sz ? Lo : 0;
+    constexpr bit_off dst_sh = sz ? DstOff : 0;
+    constexpr UST src_msk = make_mask<UST, Hi, Lo>();
+    constexpr UDT dst_msk = make_mask<UDT>(bit_off(DstOff + sz - 1), DstOff);
+    UST val = UST(UST(src) & src_msk) >> src_sh;
+    dst = DT(UDT(UDT(dst) & UDT(~dst_msk)) | UDT(UDT(val) << dst_sh));
   }
 }
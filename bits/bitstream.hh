@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "bits.hh"
+
+// Bit streams over byte buffers. Fields are packed least significant bit
+// first: bit i of the stream is bit i % 8 of byte i / 8, the layout alter()
+// and bitmap_view<unsigned char> use for byte arrays.
+namespace bits {
+  namespace detail {
+    inline std::uint64_t to_le64(std::uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      return __builtin_bswap64(v);
+#else
+      return v;
+#endif
+    }
+
+    // Little-endian load of up to eight bytes; missing bytes read as zero.
+    inline std::uint64_t load_le64(const unsigned char *p, std::size_t avail) {
+      std::uint64_t v = 0;
+      if (avail)
+        std::memcpy(&v, p, avail < 8 ? avail : 8);
+      return to_le64(v);
+    }
+
+    inline std::uint64_t field_mask(unsigned width) {
+      return make_mask<std::uint64_t>(width - 1, 0);
+    }
+  }
+
+  // Packs (value, width) fields into a byte buffer through a 64-bit
+  // accumulator, storing eight bytes at a time.
+  class bit_writer {
+  public:
+    bit_writer(unsigned char *buf, std::size_t cap) :
+      buf_(buf), cap_(cap), pos_(0), acc_(0), n_(0), good_(true) {
+    }
+
+    // Append the low width bits of val, 0 <= width <= 64.
+    void put(std::uint64_t val, unsigned width) {
+      assert(width <= 64);
+      val &= detail::field_mask(width);
+      acc_ |= val << n_;
+      unsigned total = n_ + width;
+      if (total < 64) {
+        n_ = total;
+        return;
+      }
+      store(acc_, 8);
+      acc_ = n_ ? val >> (64 - n_) : 0;
+      n_ = total - 64;
+    }
+
+    // Write out buffered bits, padding with zeros to a byte boundary.
+    // Returns the number of bytes written so far.
+    std::size_t flush() {
+      if (n_) {
+        store(acc_, (n_ + 7) / 8);
+        acc_ = 0;
+        n_ = 0;
+      }
+      return pos_;
+    }
+
+    // Bits put since construction or the last flush() padding.
+    std::size_t bit_size() const {
+      return pos_ * 8 + n_;
+    }
+
+    // False once a store did not fit in the buffer.
+    bool good() const {
+      return good_;
+    }
+
+  private:
+    void store(std::uint64_t v, std::size_t nbytes) {
+      if (!good_)
+        return;
+      v = detail::to_le64(v);
+      if (cap_ - pos_ >= 8) {
+        std::memcpy(buf_ + pos_, &v, 8);
+      } else if (cap_ - pos_ >= nbytes) {
+        std::memcpy(buf_ + pos_, &v, nbytes);
+      } else {
+        good_ = false;
+        return;
+      }
+      pos_ += nbytes;
+    }
+
+    unsigned char *buf_;
+    std::size_t cap_;
+    std::size_t pos_;
+    std::uint64_t acc_;
+    unsigned n_;
+    bool good_;
+  };
+
+  // Reads fields written by bit_writer. Each get() is one unaligned 64-bit
+  // load plus a shift, with a ninth byte only for wide unaligned fields.
+  class bit_reader {
+  public:
+    bit_reader(const unsigned char *buf, std::size_t size) :
+      buf_(buf), size_(size), pos_(0), good_(true) {
+    }
+
+    // Read the next width bits, 0 <= width <= 64. Reading past the end of
+    // the buffer yields zero bits and clears good().
+    std::uint64_t get(unsigned width) {
+      assert(width <= 64);
+      std::size_t byte = pos_ / 8;
+      unsigned sh = pos_ % 8;
+      if (pos_ + width > size_ * 8)
+        good_ = false;
+      std::uint64_t v = 0;
+      if (byte < size_) {
+        v = detail::load_le64(buf_ + byte, size_ - byte) >> sh;
+        if (sh + width > 64 && byte + 8 < size_)
+          v |= std::uint64_t(buf_[byte + 8]) << (64 - sh);
+      }
+      pos_ += width;
+      return v & detail::field_mask(width);
+    }
+
+    void skip(std::size_t nbits) {
+      pos_ += nbits;
+      if (pos_ > size_ * 8)
+        good_ = false;
+    }
+
+    std::size_t bit_pos() const {
+      return pos_;
+    }
+
+    bool good() const {
+      return good_;
+    }
+
+  private:
+    const unsigned char *buf_;
+    std::size_t size_;
+    std::size_t pos_;
+    bool good_;
+  };
+
+  namespace detail {
+#if defined(__AVX2__)
+    // Unpacks eight fields per iteration. Each 128-bit lane takes four
+    // fields from its own unaligned load; a byte shuffle gathers the four
+    // bytes that cover each field and a variable shift aligns it. Fields
+    // must fit in four bytes after the shift, hence width <= 25. Returns
+    // the number of fields unpacked.
+    inline std::size_t unpack_avx2(const unsigned char *in, std::size_t nbytes,
+                                   std::size_t count, unsigned width, std::uint32_t *out) {
+      if (width == 0 || width > 25)
+        return 0;
+      alignas(32) unsigned char shuf[32];
+      alignas(32) std::uint32_t shift[8];
+      for (unsigned l = 0; l < 2; l++) {
+        unsigned lane_bit = (l * 4 * width) / 8 * 8;
+        for (unsigned j = 0; j < 4; j++) {
+          unsigned off = (l * 4 + j) * width - lane_bit;
+          for (unsigned b = 0; b < 4; b++)
+            shuf[l * 16 + j * 4 + b] = (unsigned char)(off / 8 + b);
+          shift[l * 4 + j] = off % 8;
+        }
+      }
+      const __m256i vshuf = _mm256_load_si256(reinterpret_cast<const __m256i *>(shuf));
+      const __m256i vshift = _mm256_load_si256(reinterpret_cast<const __m256i *>(shift));
+      const __m256i vmask = _mm256_set1_epi32(int((1U << width) - 1));
+      const std::size_t lane1 = width / 2;
+
+      std::size_t i = 0;
+      for (; i + 8 <= count; i += 8) {
+        // Eight fields are exactly width bytes, so each block is byte aligned.
+        std::size_t byte = i / 8 * width;
+        if (byte + lane1 + 16 > nbytes)
+          break;
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + byte));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + byte + lane1));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_shuffle_epi8(v, vshuf);
+        v = _mm256_srlv_epi32(v, vshift);
+        v = _mm256_and_si256(v, vmask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), v);
+      }
+      return i;
+    }
+#endif
+  }
+
+  // Unpack a column of count fields, each width bits (at most 32), from the
+  // start of a bit stream of nbytes bytes.
+  inline void unpack_fields(const unsigned char *in, std::size_t nbytes,
+                            std::size_t count, unsigned width, std::uint32_t *out) {
+    assert(width <= 32);
+    assert(count * width <= nbytes * 8);
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    i = detail::unpack_avx2(in, nbytes, count, width, out);
+#endif
+    const std::uint64_t msk = detail::field_mask(width);
+    for (; i < count; i++) {
+      std::size_t off = i * width;
+      std::size_t byte = off / 8;
+      out[i] = std::uint32_t((detail::load_le64(in + byte, nbytes - byte) >> (off % 8)) & msk);
+    }
+  }
+
+  // Pack a column of count fields, each the low width bits of an input
+  // value. Returns the number of bytes written, or zero if cap is too small.
+  inline std::size_t pack_fields(const std::uint32_t *in, std::size_t count, unsigned width,
+                                 unsigned char *out, std::size_t cap) {
+    assert(width <= 32);
+    bit_writer w(out, cap);
+    for (std::size_t i = 0; i < count; i++)
+      w.put(in[i], width);
+    std::size_t n = w.flush();
+    return w.good() ? n : 0;
+  }
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+
+#include "bits.hh"
+
+// Compile-time bit-field descriptors for wire formats. A field is read or
+// written directly in a byte buffer with a load of exactly the bytes it
+// spans, a shift and a mask, all with constant operands. Loads use memcpy
+// so the buffer need not be aligned.
+//
+// Fields are described in one of two layouts:
+//
+//   byte_order::big     Network order, as in RFC header diagrams. Bit 0 is
+//                       the most significant bit of byte 0 and field values
+//                       are stored most significant bit first.
+//   byte_order::little  Bit 0 is the least significant bit of byte 0 and
+//                       field values are stored least significant bit
+//                       first, the layout of bit_writer.
+//
+// Registers with datasheet style bit numbering inside a multi-byte word
+// of either byte order are described with reg_field.
+//
+//   typedef bits::field<4, 4> ipv4_ihl;
+//   typedef bits::field<51, 13> ipv4_frag_offset;
+//   unsigned ihl = ipv4_ihl::get(pkt);
+namespace bits {
+  enum class byte_order { little, big };
+
+  // Smallest unsigned type with at least Width bits.
+  template <unsigned Width>
+  struct uint_for {
+    typedef typename std::conditional<(Width <= 8), std::uint8_t,
+      typename std::conditional<(Width <= 16), std::uint16_t,
+      typename std::conditional<(Width <= 32), std::uint32_t, std::uint64_t>::type>::type>::type type;
+  };
+
+  namespace detail {
+#if defined(__GNUC__)
+    inline std::uint64_t bswap(std::uint64_t v) { return __builtin_bswap64(v); }
+    inline std::uint32_t bswap(std::uint32_t v) { return __builtin_bswap32(v); }
+    inline std::uint16_t bswap(std::uint16_t v) { return __builtin_bswap16(v); }
+#else
+    inline std::uint16_t bswap(std::uint16_t v) {
+      return static_cast<std::uint16_t>((v >> 8) | (v << 8));
+    }
+    inline std::uint32_t bswap(std::uint32_t v) {
+      return (std::uint32_t(bswap(std::uint16_t(v))) << 16) | bswap(std::uint16_t(v >> 16));
+    }
+    inline std::uint64_t bswap(std::uint64_t v) {
+      return (std::uint64_t(bswap(std::uint32_t(v))) << 32) | bswap(std::uint32_t(v >> 32));
+    }
+#endif
+    inline std::uint8_t bswap(std::uint8_t v) { return v; }
+
+    constexpr bool host_big_endian() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      return true;
+#else
+      return false;
+#endif
+    }
+
+    // Convert between host order and the given byte order.
+    template <byte_order Order>
+    std::uint64_t to_order(std::uint64_t v) {
+      return (host_big_endian() == (Order == byte_order::big)) ? v : bswap(v);
+    }
+
+    // Load N <= 8 bytes as an integer of the given byte order. For big
+    // order the first byte ends up in the most significant byte of the
+    // 64-bit result, so the window reads left to right from bit 63.
+    template <std::size_t N, byte_order Order>
+    std::uint64_t load_window(const unsigned char *p) {
+      static_assert(N >= 1 && N <= 8, "Window must be 1 to 8 bytes.");
+      std::uint64_t v = 0;
+      std::memcpy(&v, p, N);
+      return to_order<Order>(v);
+    }
+
+    template <std::size_t N, byte_order Order>
+    void store_window(unsigned char *p, std::uint64_t v) {
+      static_assert(N >= 1 && N <= 8, "Window must be 1 to 8 bytes.");
+      v = to_order<Order>(v);
+      std::memcpy(p, &v, N);
+    }
+
+    // Field that fits in one window of at most eight bytes.
+    template <std::size_t Offset, unsigned Width, byte_order Order>
+    struct window_field {
+      static const std::size_t byte = Offset / 8;
+      static const unsigned skew = Offset % 8;
+      static const std::size_t span = (skew + Width + 7) / 8;
+      static_assert(span <= 8, "Field does not fit in one window.");
+      // Position of the field's least significant bit in the window value.
+      static const unsigned shift = (Order == byte_order::big) ? 64 - skew - Width : skew;
+
+      static std::uint64_t get(const unsigned char *buf) {
+        return (load_window<span, Order>(buf + byte) >> shift) & make_mask<std::uint64_t>(Width - 1, 0);
+      }
+
+      static void set(unsigned char *buf, std::uint64_t val) {
+        const std::uint64_t msk = make_mask<std::uint64_t>(Width - 1 + shift, shift);
+        std::uint64_t v = load_window<span, Order>(buf + byte);
+        v = (v & ~msk) | ((val << shift) & msk);
+        store_window<span, Order>(buf + byte, v);
+      }
+    };
+
+    // Field spanning nine bytes, only possible for unaligned fields over
+    // 56 bits. Split into the part filling the first eight bytes and the
+    // remainder.
+    template <std::size_t Offset, unsigned Width, byte_order Order>
+    struct split_field {
+      static const unsigned first = 64 - Offset % 8;
+      static const unsigned rest = Width - first;
+      typedef window_field<Offset, first, Order> a;
+      typedef window_field<Offset + first, rest, Order> b;
+
+      static std::uint64_t get(const unsigned char *buf) {
+        if (Order == byte_order::big)
+          return (a::get(buf) << rest) | b::get(buf);
+        return a::get(buf) | (b::get(buf) << first);
+      }
+
+      static void set(unsigned char *buf, std::uint64_t val) {
+        if (Order == byte_order::big) {
+          a::set(buf, val >> rest);
+          b::set(buf, val);
+        } else {
+          a::set(buf, val);
+          b::set(buf, val >> first);
+        }
+      }
+    };
+  }
+
+  // Width bits at bit Offset of a byte buffer, in the given layout.
+  template <std::size_t Offset, unsigned Width, byte_order Order = byte_order::big>
+  struct field {
+    static_assert(Width >= 1 && Width <= 64, "Field width must be 1 to 64 bits.");
+    typedef typename uint_for<Width>::type value_type;
+    static const std::size_t offset = Offset;
+    static const unsigned width = Width;
+    // Bytes a buffer must have for the field to be accessed.
+    static const std::size_t min_size = (Offset + Width + 7) / 8;
+
+    typedef typename std::conditional<(Offset % 8 + Width > 64),
+      detail::split_field<Offset, Width, Order>,
+      detail::window_field<Offset, Width, Order>>::type impl;
+
+    static value_type get(const unsigned char *buf) {
+      return value_type(impl::get(buf));
+    }
+
+    // Bits of val above Width are ignored.
+    static void set(unsigned char *buf, value_type val) {
+      impl::set(buf, val);
+    }
+  };
+
+  // Bits [Lo, Hi] of a Word stored at ByteOffset in the given byte order,
+  // numbered from the least significant bit as in rng and copy().
+  template <std::size_t ByteOffset, typename Word, byte_order Order, bit_off Hi, bit_off Lo>
+  struct reg_field {
+    static_assert(!std::numeric_limits<Word>::is_signed, "Register words must be unsigned.");
+    static_assert(Hi >= Lo && Hi < unsigned(std::numeric_limits<Word>::digits), "Invalid bit range.");
+    typedef typename uint_for<Hi - Lo + 1>::type value_type;
+    static const std::size_t min_size = ByteOffset + sizeof(Word);
+
+    static Word load(const unsigned char *buf) {
+      return Word(detail::load_window<sizeof(Word), Order>(buf + ByteOffset) >>
+                  (Order == byte_order::big ? 64 - 8 * sizeof(Word) : 0));
+    }
+
+    static void store(unsigned char *buf, Word w) {
+      detail::store_window<sizeof(Word), Order>(buf + ByteOffset, std::uint64_t(w) <<
+                                                (Order == byte_order::big ? 64 - 8 * sizeof(Word) : 0));
+    }
+
+    static value_type get(const unsigned char *buf) {
+      return value_type((load(buf) & make_mask<Word, Hi, Lo>()) >> Lo);
+    }
+
+    static void set(unsigned char *buf, value_type val) {
+      Word w = load(buf);
+      copy<Hi - Lo, 0, Lo>(val, w);
+      store(buf, w);
+    }
+  };
+}
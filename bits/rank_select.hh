@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+#include "bits.hh"
+
+namespace bits {
+  namespace detail {
+    // Offset of the r-th (from zero) set bit of w. w must have more than r
+    // bits set.
+    inline unsigned select_in_word(std::uint64_t w, unsigned r) {
+      assert(count(w) > r);
+#if defined(__BMI2__)
+      return unsigned(_tzcnt_u64(_pdep_u64(std::uint64_t(1) << r, w)));
+#else
+      unsigned off = 0;
+      for (;;) {
+        unsigned c = unsigned(count(std::uint8_t(w)));
+        if (r < c)
+          break;
+        r -= c;
+        w >>= 8;
+        off += 8;
+      }
+      while (r--)
+        w &= w - 1;
+      return off + ctz(w);
+#endif
+    }
+  }
+
+  // Rank and select directory over a static array of 64-bit words, which
+  // must outlive it and not change. Bit i is bit i % 64 of word i / 64.
+  //
+  // For every 2048 bit block one 64-bit entry holds the count of set bits
+  // before the block (relative to its 2^32 bit region) in the low 32 bits
+  // and the counts of the block's first three 512 bit sub-blocks in three
+  // 10-bit fields above that: 3.1% of the bitmap. A rank() reads one entry
+  // and popcounts at most eight words of one sub-block, which is a single
+  // cache line when the words are 64-byte aligned. select() starts from a
+  // sample taken every select_sample set bits, searches entries, then uses
+  // pdep/tzcnt within the final word when BMI2 is available.
+  class rank_select {
+  public:
+    static const std::size_t npos = std::size_t(-1);
+    static const std::size_t block_bits = 2048;
+    static const std::size_t sub_bits = 512;
+    static const std::size_t select_sample = 8192;
+
+    rank_select(const std::uint64_t *words, std::size_t nbits) :
+      w_(words), nbits_(nbits), nwords_((nbits + 63) / 64), ones_(0) {
+      build();
+    }
+
+    std::size_t size() const {
+      return nbits_;
+    }
+
+    std::size_t count() const {
+      return ones_;
+    }
+
+    // Number of set bits in [0, i), for i <= size().
+    std::size_t rank(std::size_t i) const {
+      assert(i <= nbits_);
+      std::size_t b = i / block_bits;
+      if (b == entries_.size())
+        return ones_;
+      std::uint64_t e = entries_[b];
+      std::size_t r = l0_[i >> l0_shift] + std::uint32_t(e);
+      std::size_t sub = (i % block_bits) / sub_bits;
+      for (std::size_t s = 0; s < sub; s++)
+        r += (e >> (32 + 10 * s)) & 0x3ff;
+      std::size_t wi = b * (block_bits / 64) + sub * (sub_bits / 64);
+      for (; wi < i / 64; wi++)
+        r += bits::count(w_[wi]);
+      if (i % 64)
+        r += bits::count(std::uint64_t(w_[wi] & make_mask<std::uint64_t>(unsigned(i % 64 - 1), 0)));
+      return r;
+    }
+
+    // Number of clear bits in [0, i).
+    std::size_t rank0(std::size_t i) const {
+      return i - rank(i);
+    }
+
+    // Offset of the k-th (from zero) set bit, or npos if there are not
+    // that many.
+    std::size_t select(std::size_t k) const {
+      if (k >= ones_)
+        return npos;
+      // Last block whose starting count is at most k, between the samples.
+      std::size_t lo = samples_[k / select_sample];
+      std::size_t hi = (k / select_sample + 1 < samples_.size()) ?
+        samples_[k / select_sample + 1] : entries_.size() - 1;
+      while (lo < hi) {
+        std::size_t mid = (lo + hi + 1) / 2;
+        if (block_rank(mid) <= k)
+          lo = mid;
+        else
+          hi = mid - 1;
+      }
+      std::uint64_t e = entries_[lo];
+      std::size_t r = k - block_rank(lo);
+      std::size_t sub = 0;
+      for (; sub < 3; sub++) {
+        std::size_t c = (e >> (32 + 10 * sub)) & 0x3ff;
+        if (r < c)
+          break;
+        r -= c;
+      }
+      std::size_t wi = lo * (block_bits / 64) + sub * (sub_bits / 64);
+      for (;; wi++) {
+        std::size_t c = bits::count(word(wi));
+        if (r < c)
+          break;
+        r -= c;
+      }
+      return wi * 64 + detail::select_in_word(word(wi), unsigned(r));
+    }
+
+    // Bytes used by the directory.
+    std::size_t overhead_bytes() const {
+      return entries_.size() * sizeof(std::uint64_t) + l0_.size() * sizeof(std::size_t) +
+        samples_.size() * sizeof(std::size_t);
+    }
+
+  private:
+    static const unsigned l0_shift = 32;
+
+    // Word wi with bits past the end cleared.
+    std::uint64_t word(std::size_t wi) const {
+      std::uint64_t v = w_[wi];
+      if (wi == nwords_ - 1 && nbits_ % 64)
+        v &= make_mask<std::uint64_t>(unsigned(nbits_ % 64 - 1), 0);
+      return v;
+    }
+
+    std::size_t block_rank(std::size_t b) const {
+      return l0_[(b * block_bits) >> l0_shift] + std::uint32_t(entries_[b]);
+    }
+
+    void build() {
+      const std::size_t block_words = block_bits / 64, sub_words = sub_bits / 64;
+      std::size_t nblocks = (nbits_ + block_bits - 1) / block_bits;
+      entries_.resize(nblocks);
+      l0_.resize((nbits_ >> l0_shift) + 1);
+      std::size_t total = 0, next_sample = 0;
+      for (std::size_t b = 0; b < nblocks; b++) {
+        std::size_t bit = b * block_bits;
+        if (bit % (std::size_t(1) << l0_shift) == 0)
+          l0_[bit >> l0_shift] = total;
+        std::uint64_t e = total - l0_[bit >> l0_shift];
+        std::size_t in_block = 0;
+        for (std::size_t s = 0; s < 4; s++) {
+          std::size_t c = 0;
+          std::size_t wi = b * block_words + s * sub_words;
+          for (std::size_t j = 0; j < sub_words && wi + j < nwords_; j++)
+            c += bits::count(word(wi + j));
+          if (s < 3)
+            e |= std::uint64_t(c) << (32 + 10 * s);
+          in_block += c;
+        }
+        entries_[b] = e;
+        for (; next_sample < total + in_block; next_sample += select_sample)
+          samples_.push_back(b);
+        total += in_block;
+      }
+      ones_ = total;
+    }
+
+    const std::uint64_t *w_;
+    std::size_t nbits_;
+    std::size_t nwords_;
+    std::size_t ones_;
+    std::vector<std::uint64_t> entries_;
+    std::vector<std::size_t> l0_;
+    std::vector<std::size_t> samples_;
+  };
+}
@@ -0,0 +1,802 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+#include "bitmap.hh"
+#include "setops.hh"
+
+// Compressed bitmap of 32-bit values in the style of Roaring bitmaps. The
+// value space is split into chunks of 64K by the high 16 bits. Each chunk
+// that has any bit set is stored as whichever container is smallest:
+//
+//   array   sorted 16-bit values, at most array_max of them
+//   bitset  a 65536 bit bitmap in 1024 64-bit words
+//   run     sorted (start, length - 1) pairs of 16-bit values
+//
+// Single value updates move between array and bitset as the cardinality
+// crosses array_max. Range updates and optimize() also consider runs.
+namespace bits {
+  namespace detail {
+    const std::size_t chunk_words = 1024;
+    const std::size_t array_max = 4096;
+
+    struct chunk {
+      enum kind : std::uint8_t { array = 0, bitset = 1, run = 2 };
+
+      std::uint16_t key;
+      kind type;
+      std::uint32_t card;
+      std::vector<std::uint16_t> v; // Array values, or run pairs.
+      std::vector<std::uint64_t> w; // Bitset words.
+
+      explicit chunk(std::uint16_t k = 0) :
+        key(k), type(array), card(0) {
+      }
+    };
+
+    inline bool chunk_contains(const chunk &c, std::uint16_t x) {
+      switch (c.type) {
+      case chunk::array:
+        return std::binary_search(c.v.begin(), c.v.end(), x);
+      case chunk::bitset:
+        return (c.w[x / 64] >> (x % 64)) & 1;
+      case chunk::run: {
+        // Last run starting at or before x.
+        std::size_t lo = 0, hi = c.v.size() / 2;
+        while (lo < hi) {
+          std::size_t mid = (lo + hi) / 2;
+          if (c.v[2 * mid] <= x)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+        return lo > 0 && x - c.v[2 * (lo - 1)] <= c.v[2 * (lo - 1) + 1];
+      }
+      }
+      return false;
+    }
+
+    // Expand any container into 1024 bitset words.
+    inline void chunk_words_of(const chunk &c, std::uint64_t *w) {
+      if (c.type == chunk::bitset) {
+        std::copy(c.w.begin(), c.w.end(), w);
+        return;
+      }
+      std::fill(w, w + chunk_words, std::uint64_t(0));
+      bitmap_view<std::uint64_t> bm(w, 65536);
+      if (c.type == chunk::array) {
+        for (std::uint16_t x : c.v)
+          bm.set(x);
+      } else {
+        for (std::size_t i = 0; i < c.v.size(); i += 2)
+          bm.set(std::size_t(c.v[i]) + c.v[i + 1], c.v[i]);
+      }
+    }
+
+    inline std::size_t run_count_of_words(const std::uint64_t *w) {
+      // A run starts at every set bit whose lower neighbour is clear.
+      std::size_t n = 0;
+      std::uint64_t carry = 0;
+      for (std::size_t i = 0; i < chunk_words; i++) {
+        n += count(std::uint64_t(w[i] & ~((w[i] << 1) | carry)));
+        carry = w[i] >> 63;
+      }
+      return n;
+    }
+
+    inline void set_array_from_words(chunk &c, const std::uint64_t *w) {
+      c.v.clear();
+      c.v.reserve(c.card);
+      bitmap_view<const std::uint64_t> bm(w, 65536);
+      for (std::size_t x : bm.set_bits())
+        c.v.push_back(std::uint16_t(x));
+      c.w.clear();
+      c.w.shrink_to_fit();
+      c.type = chunk::array;
+    }
+
+    inline void set_runs_from_words(chunk &c, const std::uint64_t *w) {
+      std::vector<std::uint16_t> runs;
+      bitmap_view<const std::uint64_t> bm(w, 65536);
+      std::size_t s = bm.find_first_set();
+      while (s != bm.npos) {
+        std::size_t e = bm.find_first_clear(s);
+        if (e == bm.npos)
+          e = 65536;
+        runs.push_back(std::uint16_t(s));
+        runs.push_back(std::uint16_t(e - s - 1));
+        s = (e < 65536) ? bm.find_first_set(e) : bm.npos;
+      }
+      c.v.swap(runs);
+      c.w.clear();
+      c.w.shrink_to_fit();
+      c.type = chunk::run;
+    }
+
+    inline void set_bitset_from_words(chunk &c, const std::uint64_t *w) {
+      if (c.type != chunk::bitset)
+        c.w.resize(chunk_words);
+      if (c.w.data() != w)
+        std::copy(w, w + chunk_words, c.w.begin());
+      c.v.clear();
+      c.v.shrink_to_fit();
+      c.type = chunk::bitset;
+    }
+
+    // Store the bits in w in the smallest container. With runs false only
+    // arrays and bitsets are considered, as for single value updates.
+    inline void assign_words(chunk &c, const std::uint64_t *w, bool runs) {
+      c.card = std::uint32_t(count(w, w + chunk_words));
+      std::size_t best = (c.card <= array_max) ? 2 * c.card : 8 * chunk_words;
+      if (runs && 4 * run_count_of_words(w) < best)
+        set_runs_from_words(c, w);
+      else if (c.card <= array_max)
+        set_array_from_words(c, w);
+      else
+        set_bitset_from_words(c, w);
+    }
+
+    // Make a run container an array or bitset so it can be updated a value
+    // at a time.
+    inline void unpack_runs(chunk &c) {
+      if (c.type != chunk::run)
+        return;
+      std::vector<std::uint64_t> w(chunk_words);
+      chunk_words_of(c, w.data());
+      assign_words(c, w.data(), false);
+    }
+
+    inline bool chunk_add(chunk &c, std::uint16_t x) {
+      unpack_runs(c);
+      if (c.type == chunk::bitset) {
+        std::uint64_t b = std::uint64_t(1) << (x % 64);
+        if (c.w[x / 64] & b)
+          return false;
+        c.w[x / 64] |= b;
+        c.card++;
+        return true;
+      }
+      auto it = std::lower_bound(c.v.begin(), c.v.end(), x);
+      if (it != c.v.end() && *it == x)
+        return false;
+      if (c.card == array_max) {
+        std::vector<std::uint64_t> w(chunk_words);
+        chunk_words_of(c, w.data());
+        w[x / 64] |= std::uint64_t(1) << (x % 64);
+        c.card++;
+        set_bitset_from_words(c, w.data());
+        return true;
+      }
+      c.v.insert(it, x);
+      c.card++;
+      return true;
+    }
+
+    inline bool chunk_remove(chunk &c, std::uint16_t x) {
+      unpack_runs(c);
+      if (c.type == chunk::bitset) {
+        std::uint64_t b = std::uint64_t(1) << (x % 64);
+        if (!(c.w[x / 64] & b))
+          return false;
+        c.w[x / 64] &= ~b;
+        c.card--;
+        if (c.card <= array_max) {
+          std::vector<std::uint64_t> w(c.w);
+          set_array_from_words(c, w.data());
+        }
+        return true;
+      }
+      auto it = std::lower_bound(c.v.begin(), c.v.end(), x);
+      if (it == c.v.end() || *it != x)
+        return false;
+      c.v.erase(it);
+      c.card--;
+      return true;
+    }
+
+    inline void chunk_alter(chunk &c, std::uint16_t hi, std::uint16_t lo, bool val) {
+      std::vector<std::uint64_t> w(chunk_words);
+      chunk_words_of(c, w.data());
+      bitmap_view<std::uint64_t>(w.data(), 65536).assign(hi, lo, val);
+      assign_words(c, w.data(), true);
+    }
+
+    inline std::size_t chunk_count(const chunk &c, std::uint16_t hi, std::uint16_t lo) {
+      switch (c.type) {
+      case chunk::array:
+        return std::upper_bound(c.v.begin(), c.v.end(), hi) -
+          std::lower_bound(c.v.begin(), c.v.end(), lo);
+      case chunk::bitset: {
+        std::size_t bw = lo / 64, ew = hi / 64;
+        if (bw == ew)
+          return count(std::uint64_t(c.w[bw] & make_mask<std::uint64_t>(hi % 64, lo % 64)));
+        return count(std::uint64_t(c.w[bw] & make_mask<std::uint64_t>(63, lo % 64))) +
+          count(c.w.data() + bw + 1, c.w.data() + ew) +
+          count(std::uint64_t(c.w[ew] & make_mask<std::uint64_t>(hi % 64, 0)));
+      }
+      case chunk::run: {
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < c.v.size(); i += 2) {
+          std::size_t s = c.v[i], e = s + c.v[i + 1];
+          if (e < lo || s > hi)
+            continue;
+          n += std::min<std::size_t>(e, hi) - std::max<std::size_t>(s, lo) + 1;
+        }
+        return n;
+      }
+      }
+      return 0;
+    }
+
+    template <typename F>
+    void chunk_for_each(const chunk &c, F &f) {
+      std::uint32_t base = std::uint32_t(c.key) << 16;
+      switch (c.type) {
+      case chunk::array:
+        for (std::uint16_t x : c.v)
+          f(base | x);
+        break;
+      case chunk::bitset:
+        for (std::size_t x : bitmap_view<const std::uint64_t>(c.w.data(), 65536).set_bits())
+          f(base | std::uint32_t(x));
+        break;
+      case chunk::run:
+        for (std::size_t i = 0; i < c.v.size(); i += 2)
+          for (std::uint32_t x = c.v[i]; x <= std::uint32_t(c.v[i]) + c.v[i + 1]; x++)
+            f(base | x);
+        break;
+      }
+    }
+
+    // Sorted array merges for each operation.
+    template <typename OutIter>
+    void merge_arrays(and_op, const std::vector<std::uint16_t> &a,
+                      const std::vector<std::uint16_t> &b, OutIter out) {
+      std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), out);
+    }
+
+    template <typename OutIter>
+    void merge_arrays(or_op, const std::vector<std::uint16_t> &a,
+                      const std::vector<std::uint16_t> &b, OutIter out) {
+      std::set_union(a.begin(), a.end(), b.begin(), b.end(), out);
+    }
+
+    template <typename OutIter>
+    void merge_arrays(xor_op, const std::vector<std::uint16_t> &a,
+                      const std::vector<std::uint16_t> &b, OutIter out) {
+      std::set_symmetric_difference(a.begin(), a.end(), b.begin(), b.end(), out);
+    }
+
+    template <typename OutIter>
+    void merge_arrays(andnot_op, const std::vector<std::uint16_t> &a,
+                      const std::vector<std::uint16_t> &b, OutIter out) {
+      std::set_difference(a.begin(), a.end(), b.begin(), b.end(), out);
+    }
+
+    inline bool is_and(and_op) { return true; }
+    template <typename Op>
+    bool is_and(Op) { return false; }
+    inline bool is_andnot(andnot_op) { return true; }
+    template <typename Op>
+    bool is_andnot(Op) { return false; }
+
+    // Array values kept or dropped by membership in a bitset.
+    inline void filter_array(const chunk &arr, const chunk &bs, bool keep, chunk &out) {
+      std::vector<std::uint16_t> v;
+      for (std::uint16_t x : arr.v)
+        if (((bs.w[x / 64] >> (x % 64)) & 1) == keep)
+          v.push_back(x);
+      out.v.swap(v);
+      out.w.clear();
+      out.type = chunk::array;
+      out.card = std::uint32_t(out.v.size());
+    }
+
+    // Apply Op to a in place with b.
+    template <typename Op>
+    void chunk_combine(chunk &a, const chunk &b) {
+      Op op;
+      if (a.type == chunk::array && b.type == chunk::array) {
+        std::vector<std::uint16_t> v;
+        v.reserve(is_and(op) || is_andnot(op) ? a.v.size() : a.v.size() + b.v.size());
+        merge_arrays(op, a.v, b.v, std::back_inserter(v));
+        a.v.swap(v);
+        a.card = std::uint32_t(a.v.size());
+        if (a.card > array_max) {
+          std::vector<std::uint64_t> w(chunk_words);
+          chunk_words_of(a, w.data());
+          set_bitset_from_words(a, w.data());
+        }
+        return;
+      }
+      if (a.type == chunk::array && b.type == chunk::bitset && (is_and(op) || is_andnot(op))) {
+        filter_array(a, b, is_and(op), a);
+        return;
+      }
+      if (a.type == chunk::bitset && b.type == chunk::array && is_and(op)) {
+        chunk r(a.key);
+        filter_array(b, a, true, r);
+        std::swap(a, r);
+        return;
+      }
+      std::vector<std::uint64_t> w(chunk_words), o(chunk_words);
+      chunk_words_of(a, w.data());
+      chunk_words_of(b, o.data());
+      combine_bytes<Op>(reinterpret_cast<unsigned char *>(w.data()),
+                        reinterpret_cast<const unsigned char *>(o.data()),
+                        chunk_words * sizeof(std::uint64_t));
+      assign_words(a, w.data(), a.type == chunk::run && b.type == chunk::run);
+    }
+
+    inline std::size_t chunk_and_count(const chunk &a, const chunk &b) {
+      if (a.type == chunk::array && b.type == chunk::array) {
+        std::size_t n = 0;
+        auto i = a.v.begin(), j = b.v.begin();
+        while (i != a.v.end() && j != b.v.end()) {
+          if (*i < *j) {
+            ++i;
+          } else if (*j < *i) {
+            ++j;
+          } else {
+            ++n;
+            ++i;
+            ++j;
+          }
+        }
+        return n;
+      }
+      if (a.type == chunk::array || b.type == chunk::array) {
+        const chunk &arr = (a.type == chunk::array) ? a : b;
+        const chunk &oth = (a.type == chunk::array) ? b : a;
+        std::size_t n = 0;
+        for (std::uint16_t x : arr.v)
+          n += chunk_contains(oth, x);
+        return n;
+      }
+      std::vector<std::uint64_t> ta, tb;
+      const std::uint64_t *wa = a.w.data(), *wb = b.w.data();
+      if (a.type != chunk::bitset) {
+        ta.resize(chunk_words);
+        chunk_words_of(a, ta.data());
+        wa = ta.data();
+      }
+      if (b.type != chunk::bitset) {
+        tb.resize(chunk_words);
+        chunk_words_of(b, tb.data());
+        wb = tb.data();
+      }
+      return and_count(wa, wa + chunk_words, wb);
+    }
+
+    template <typename T>
+    void store_le(unsigned char *p, T v) {
+      for (std::size_t i = 0; i < sizeof(T); i++)
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+
+    template <typename T>
+    T load_le(const unsigned char *p) {
+      T v = 0;
+      for (std::size_t i = 0; i < sizeof(T); i++)
+        v |= T(T(p[i]) << (8 * i));
+      return v;
+    }
+  }
+
+  class roaring_view;
+
+  class roaring {
+  public:
+    // Serialized layout, all integers little-endian:
+    //
+    //   u32 magic, u32 number of chunks
+    //   per chunk: u16 key, u8 type, u8 zero, u32 cardinality,
+    //              u32 payload offset, u32 payload length in 16-bit units
+    //   payloads, each starting on an 8 byte boundary
+    //
+    // Array payloads are the sorted values, run payloads the (start,
+    // length - 1) pairs and bitset payloads 1024 64-bit words. The layout
+    // can be used in place from a mapped file with roaring_view.
+    static const std::uint32_t magic = 0x314d5242; // "BRM1"
+    static const std::size_t header_size = 8;
+    static const std::size_t desc_size = 16;
+
+    bool contains(std::uint32_t x) const {
+      const detail::chunk *c = find(std::uint16_t(x >> 16));
+      return c && detail::chunk_contains(*c, std::uint16_t(x));
+    }
+
+    // Returns true if x was not already present.
+    bool add(std::uint32_t x) {
+      return detail::chunk_add(get(std::uint16_t(x >> 16)), std::uint16_t(x));
+    }
+
+    // Returns true if x was present.
+    bool remove(std::uint32_t x) {
+      auto it = lower(std::uint16_t(x >> 16));
+      if (it == chunks_.end() || it->key != (x >> 16))
+        return false;
+      bool found = detail::chunk_remove(*it, std::uint16_t(x));
+      if (it->card == 0)
+        chunks_.erase(it);
+      return found;
+    }
+
+    // Set or clear the inclusive range [lo, hi], as alter() does for words.
+    void alter(std::uint32_t hi, std::uint32_t lo, bool val) {
+      assert(hi >= lo);
+      for (std::uint32_t k = lo >> 16; k <= (hi >> 16); k++) {
+        std::uint16_t clo = (k == (lo >> 16)) ? std::uint16_t(lo) : 0;
+        std::uint16_t chi = (k == (hi >> 16)) ? std::uint16_t(hi) : 0xffff;
+        auto it = lower(std::uint16_t(k));
+        bool found = it != chunks_.end() && it->key == k;
+        if (!val) {
+          if (found) {
+            detail::chunk_alter(*it, chi, clo, false);
+            if (it->card == 0)
+              chunks_.erase(it);
+          }
+        } else if (!found || (clo == 0 && chi == 0xffff)) {
+          detail::chunk c{std::uint16_t(k)};
+          c.type = detail::chunk::run;
+          c.v.push_back(clo);
+          c.v.push_back(std::uint16_t(chi - clo));
+          c.card = std::uint32_t(chi - clo) + 1;
+          if (found)
+            *it = c;
+          else
+            chunks_.insert(it, c);
+        } else {
+          detail::chunk_alter(*it, chi, clo, true);
+        }
+      }
+    }
+
+    std::size_t count() const {
+      std::size_t n = 0;
+      for (auto &c : chunks_)
+        n += c.card;
+      return n;
+    }
+
+    // Number of values in [lo, hi].
+    std::size_t count(std::uint32_t hi, std::uint32_t lo) const {
+      assert(hi >= lo);
+      std::size_t n = 0;
+      for (auto it = lower(std::uint16_t(lo >> 16)); it != chunks_.end() && it->key <= (hi >> 16); ++it) {
+        std::uint16_t clo = (it->key == (lo >> 16)) ? std::uint16_t(lo) : 0;
+        std::uint16_t chi = (it->key == (hi >> 16)) ? std::uint16_t(hi) : 0xffff;
+        n += (clo == 0 && chi == 0xffff) ? it->card : detail::chunk_count(*it, chi, clo);
+      }
+      return n;
+    }
+
+    bool empty() const {
+      return chunks_.empty();
+    }
+
+    // Convert each chunk to its smallest container, including runs.
+    void optimize() {
+      std::vector<std::uint64_t> w(detail::chunk_words);
+      for (auto &c : chunks_) {
+        detail::chunk_words_of(c, w.data());
+        detail::assign_words(c, w.data(), true);
+      }
+    }
+
+    // Call f(x) for each value in ascending order.
+    template <typename F>
+    void for_each(F f) const {
+      for (auto &c : chunks_)
+        detail::chunk_for_each(c, f);
+    }
+
+    void and_into(const roaring &o) {
+      std::vector<detail::chunk> out;
+      auto i = chunks_.begin();
+      auto j = o.chunks_.begin();
+      while (i != chunks_.end() && j != o.chunks_.end()) {
+        if (i->key < j->key) {
+          ++i;
+        } else if (j->key < i->key) {
+          ++j;
+        } else {
+          detail::chunk_combine<detail::and_op>(*i, *j);
+          if (i->card)
+            out.push_back(std::move(*i));
+          ++i;
+          ++j;
+        }
+      }
+      chunks_.swap(out);
+    }
+
+    void or_into(const roaring &o) {
+      merge_into<detail::or_op>(o, true);
+    }
+
+    void xor_into(const roaring &o) {
+      merge_into<detail::xor_op>(o, true);
+    }
+
+    void andnot_into(const roaring &o) {
+      merge_into<detail::andnot_op>(o, false);
+    }
+
+    // Population counts of combinations without building the result.
+    friend std::size_t and_count(const roaring &a, const roaring &b) {
+      std::size_t n = 0;
+      auto i = a.chunks_.begin();
+      auto j = b.chunks_.begin();
+      while (i != a.chunks_.end() && j != b.chunks_.end()) {
+        if (i->key < j->key) {
+          ++i;
+        } else if (j->key < i->key) {
+          ++j;
+        } else {
+          n += detail::chunk_and_count(*i++, *j++);
+        }
+      }
+      return n;
+    }
+
+    friend std::size_t or_count(const roaring &a, const roaring &b) {
+      return a.count() + b.count() - and_count(a, b);
+    }
+
+    friend std::size_t xor_count(const roaring &a, const roaring &b) {
+      return a.count() + b.count() - 2 * and_count(a, b);
+    }
+
+    friend std::size_t andnot_count(const roaring &a, const roaring &b) {
+      return a.count() - and_count(a, b);
+    }
+
+    // Bytes used by containers, excluding vector and object overhead.
+    std::size_t memory_size() const {
+      std::size_t n = 0;
+      for (auto &c : chunks_)
+        n += c.v.size() * sizeof(std::uint16_t) + c.w.size() * sizeof(std::uint64_t);
+      return n;
+    }
+
+    std::size_t serialized_size() const {
+      std::size_t n = header_size + desc_size * chunks_.size();
+      for (auto &c : chunks_)
+        n = align(n) + payload_size(c);
+      return n;
+    }
+
+    // Write serialized_size() bytes to out.
+    void serialize(unsigned char *out) const {
+      std::size_t off = header_size + desc_size * chunks_.size();
+      std::memset(out, 0, serialized_size());
+      detail::store_le<std::uint32_t>(out, magic);
+      detail::store_le<std::uint32_t>(out + 4, std::uint32_t(chunks_.size()));
+      unsigned char *d = out + header_size;
+      for (auto &c : chunks_) {
+        off = align(off);
+        detail::store_le<std::uint16_t>(d, c.key);
+        d[2] = c.type;
+        detail::store_le<std::uint32_t>(d + 4, c.card);
+        detail::store_le<std::uint32_t>(d + 8, std::uint32_t(off));
+        std::size_t units = (c.type == detail::chunk::bitset) ? 4 * c.w.size() : c.v.size();
+        detail::store_le<std::uint32_t>(d + 12, std::uint32_t(units));
+        for (std::size_t i = 0; i < c.v.size(); i++)
+          detail::store_le<std::uint16_t>(out + off + 2 * i, c.v[i]);
+        for (std::size_t i = 0; i < c.w.size(); i++)
+          detail::store_le<std::uint64_t>(out + off + 8 * i, c.w[i]);
+        off += payload_size(c);
+        d += desc_size;
+      }
+    }
+
+    friend bool operator==(const roaring &a, const roaring &b) {
+      if (a.count() != b.count())
+        return false;
+      return and_count(a, b) == a.count();
+    }
+
+  private:
+    friend class roaring_view;
+
+    static std::size_t align(std::size_t n) {
+      return (n + 7) & ~std::size_t(7);
+    }
+
+    static std::size_t payload_size(const detail::chunk &c) {
+      return c.v.size() * sizeof(std::uint16_t) + c.w.size() * sizeof(std::uint64_t);
+    }
+
+    std::vector<detail::chunk>::iterator lower(std::uint16_t key) {
+      return std::lower_bound(chunks_.begin(), chunks_.end(), key,
+                              [](const detail::chunk &c, std::uint16_t k) { return c.key < k; });
+    }
+
+    std::vector<detail::chunk>::const_iterator lower(std::uint16_t key) const {
+      return std::lower_bound(chunks_.begin(), chunks_.end(), key,
+                              [](const detail::chunk &c, std::uint16_t k) { return c.key < k; });
+    }
+
+    const detail::chunk *find(std::uint16_t key) const {
+      auto it = lower(key);
+      return (it != chunks_.end() && it->key == key) ? &*it : nullptr;
+    }
+
+    detail::chunk &get(std::uint16_t key) {
+      auto it = lower(key);
+      if (it == chunks_.end() || it->key != key)
+        it = chunks_.insert(it, detail::chunk(key));
+      return *it;
+    }
+
+    // Merge for operations where chunks only in this set are kept; chunks
+    // only in o are copied when take_other is set.
+    template <typename Op>
+    void merge_into(const roaring &o, bool take_other) {
+      std::vector<detail::chunk> out;
+      out.reserve(chunks_.size() + (take_other ? o.chunks_.size() : 0));
+      auto i = chunks_.begin();
+      auto j = o.chunks_.begin();
+      while (i != chunks_.end() || j != o.chunks_.end()) {
+        if (j == o.chunks_.end() || (i != chunks_.end() && i->key < j->key)) {
+          out.push_back(std::move(*i++));
+        } else if (i == chunks_.end() || j->key < i->key) {
+          if (take_other)
+            out.push_back(*j);
+          ++j;
+        } else {
+          detail::chunk_combine<Op>(*i, *j);
+          if (i->card)
+            out.push_back(std::move(*i));
+          ++i;
+          ++j;
+        }
+      }
+      chunks_.swap(out);
+    }
+
+    std::vector<detail::chunk> chunks_;
+  };
+
+  // Read only access to a serialized roaring, for example a mapped file.
+  // Nothing is copied; values are decoded on access.
+  class roaring_view {
+  public:
+    roaring_view(const unsigned char *buf, std::size_t size) :
+      buf_(buf), size_(size), n_(0), valid_(false) {
+      valid_ = check();
+    }
+
+    // False if the buffer is not a well formed serialized roaring, in
+    // which case the view is empty.
+    bool valid() const {
+      return valid_;
+    }
+
+    std::size_t chunk_count() const {
+      return n_;
+    }
+
+    std::size_t count() const {
+      std::size_t n = 0;
+      for (std::size_t i = 0; i < n_; i++)
+        n += detail::load_le<std::uint32_t>(desc(i) + 4);
+      return n;
+    }
+
+    bool contains(std::uint32_t x) const {
+      std::size_t lo = 0, hi = n_;
+      std::uint16_t key = std::uint16_t(x >> 16), low = std::uint16_t(x);
+      while (lo < hi) {
+        std::size_t mid = (lo + hi) / 2;
+        std::uint16_t k = detail::load_le<std::uint16_t>(desc(mid));
+        if (k < key)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      if (lo == n_ || detail::load_le<std::uint16_t>(desc(lo)) != key)
+        return false;
+      const unsigned char *d = desc(lo);
+      const unsigned char *p = buf_ + detail::load_le<std::uint32_t>(d + 8);
+      std::size_t units = detail::load_le<std::uint32_t>(d + 12);
+      switch (d[2]) {
+      case detail::chunk::array: {
+        std::size_t a = 0, b = units;
+        while (a < b) {
+          std::size_t mid = (a + b) / 2;
+          if (detail::load_le<std::uint16_t>(p + 2 * mid) < low)
+            a = mid + 1;
+          else
+            b = mid;
+        }
+        return a < units && detail::load_le<std::uint16_t>(p + 2 * a) == low;
+      }
+      case detail::chunk::bitset:
+        return (detail::load_le<std::uint64_t>(p + 8 * (low / 64)) >> (low % 64)) & 1;
+      case detail::chunk::run: {
+        std::size_t a = 0, b = units / 2;
+        while (a < b) {
+          std::size_t mid = (a + b) / 2;
+          if (detail::load_le<std::uint16_t>(p + 4 * mid) <= low)
+            a = mid + 1;
+          else
+            b = mid;
+        }
+        if (a == 0)
+          return false;
+        std::uint16_t s = detail::load_le<std::uint16_t>(p + 4 * (a - 1));
+        return low - s <= detail::load_le<std::uint16_t>(p + 4 * (a - 1) + 2);
+      }
+      }
+      return false;
+    }
+
+    // Copy into an updatable roaring.
+    roaring to_roaring() const {
+      roaring r;
+      r.chunks_.reserve(n_);
+      for (std::size_t i = 0; i < n_; i++) {
+        const unsigned char *d = desc(i);
+        const unsigned char *p = buf_ + detail::load_le<std::uint32_t>(d + 8);
+        std::size_t units = detail::load_le<std::uint32_t>(d + 12);
+        detail::chunk c(detail::load_le<std::uint16_t>(d));
+        c.type = detail::chunk::kind(d[2]);
+        c.card = detail::load_le<std::uint32_t>(d + 4);
+        if (c.type == detail::chunk::bitset) {
+          c.w.resize(units / 4);
+          for (std::size_t j = 0; j < c.w.size(); j++)
+            c.w[j] = detail::load_le<std::uint64_t>(p + 8 * j);
+        } else {
+          c.v.resize(units);
+          for (std::size_t j = 0; j < units; j++)
+            c.v[j] = detail::load_le<std::uint16_t>(p + 2 * j);
+        }
+        r.chunks_.push_back(std::move(c));
+      }
+      return r;
+    }
+
+  private:
+    const unsigned char *desc(std::size_t i) const {
+      return buf_ + roaring::header_size + roaring::desc_size * i;
+    }
+
+    bool check() {
+      if (size_ < roaring::header_size || detail::load_le<std::uint32_t>(buf_) != roaring::magic)
+        return false;
+      std::size_t n = detail::load_le<std::uint32_t>(buf_ + 4);
+      if (n > 65536 || size_ < roaring::header_size + roaring::desc_size * n)
+        return false;
+      for (std::size_t i = 0; i < n; i++) {
+        const unsigned char *d = desc(i);
+        std::size_t off = detail::load_le<std::uint32_t>(d + 8);
+        std::size_t units = detail::load_le<std::uint32_t>(d + 12);
+        std::size_t card = detail::load_le<std::uint32_t>(d + 4);
+        if (i > 0 && detail::load_le<std::uint16_t>(d) <= detail::load_le<std::uint16_t>(desc(i - 1)))
+          return false;
+        if (d[2] == detail::chunk::bitset ? units != 4 * detail::chunk_words :
+            d[2] == detail::chunk::array ? units != card :
+            d[2] == detail::chunk::run ? units % 2 != 0 : true)
+          return false;
+        if (off % 8 != 0 || off > size_ || 2 * units > size_ - off)
+          return false;
+      }
+      n_ = n;
+      return true;
+    }
+
+    const unsigned char *buf_;
+    std::size_t size_;
+    std::size_t n_;
+    bool valid_;
+  };
+}
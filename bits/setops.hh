@@ -0,0 +1,265 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bits.hh"
+
+// Bitwise set algebra over ranges of words, following the iterator
+// conventions of count(Iter, Iter). The *_into operations update the first
+// range in place from the second; the *_count operations return the number
+// of bits set in the result without storing it.
+//
+// Ranges of integer words given as pointers are processed as raw bytes with
+// SIMD when available, and may be split across threads. Other iterators
+// fall back to a word at a time loop.
+namespace bits {
+  namespace detail {
+    // Smallest slice worth handing to a thread.
+    const std::size_t par_min_bytes = 1 << 20;
+
+    struct and_op {
+      template <typename T>
+      static T apply(T a, T b) { return T(a & b); }
+#if defined(__AVX2__)
+      static __m256i apply(__m256i a, __m256i b) { return _mm256_and_si256(a, b); }
+#elif defined(__SSE2__)
+      static __m128i apply(__m128i a, __m128i b) { return _mm_and_si128(a, b); }
+#endif
+    };
+
+    struct or_op {
+      template <typename T>
+      static T apply(T a, T b) { return T(a | b); }
+#if defined(__AVX2__)
+      static __m256i apply(__m256i a, __m256i b) { return _mm256_or_si256(a, b); }
+#elif defined(__SSE2__)
+      static __m128i apply(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+#endif
+    };
+
+    struct xor_op {
+      template <typename T>
+      static T apply(T a, T b) { return T(a ^ b); }
+#if defined(__AVX2__)
+      static __m256i apply(__m256i a, __m256i b) { return _mm256_xor_si256(a, b); }
+#elif defined(__SSE2__)
+      static __m128i apply(__m128i a, __m128i b) { return _mm_xor_si128(a, b); }
+#endif
+    };
+
+    // a & ~b
+    struct andnot_op {
+      template <typename T>
+      static T apply(T a, T b) { return T(a & ~b); }
+#if defined(__AVX2__)
+      static __m256i apply(__m256i a, __m256i b) { return _mm256_andnot_si256(b, a); }
+#elif defined(__SSE2__)
+      static __m128i apply(__m128i a, __m128i b) { return _mm_andnot_si128(b, a); }
+#endif
+    };
+
+#if defined(__AVX2__)
+    // Per byte population count by nibble table lookup.
+    inline __m256i popcount_bytes(__m256i v) {
+      const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+      const __m256i low = _mm256_set1_epi8(0x0f);
+      __m256i lo = _mm256_and_si256(v, low);
+      __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+      return _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+    }
+#endif
+
+    template <typename Op>
+    void combine_bytes(unsigned char *dst, const unsigned char *src, std::size_t n) {
+      std::size_t i = 0;
+#if defined(__AVX2__)
+      for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), Op::apply(a, b));
+      }
+#elif defined(__SSE2__)
+      for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), Op::apply(a, b));
+      }
+#endif
+      for (; i < n; i++)
+        dst[i] = Op::apply(dst[i], src[i]);
+    }
+
+    template <typename Op>
+    std::size_t combine_count_bytes(const unsigned char *a, const unsigned char *b, std::size_t n) {
+      std::size_t i = 0, cnt = 0;
+#if defined(__AVX2__)
+      const __m256i zero = _mm256_setzero_si256();
+      __m256i acc = zero;
+      for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(popcount_bytes(Op::apply(x, y)), zero));
+      }
+      cnt += std::uint64_t(_mm256_extract_epi64(acc, 0)) + std::uint64_t(_mm256_extract_epi64(acc, 1)) +
+        std::uint64_t(_mm256_extract_epi64(acc, 2)) + std::uint64_t(_mm256_extract_epi64(acc, 3));
+#endif
+      for (; i + 8 <= n; i += 8) {
+        std::uint64_t x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        cnt += count(Op::apply(x, y));
+      }
+      for (; i < n; i++)
+        cnt += count(Op::apply(a[i], b[i]));
+      return cnt;
+    }
+
+    // Split n bytes into 64 byte aligned slices of at least par_min_bytes,
+    // at most one per thread, and call f(index, offset, length) for each.
+    // The calling thread takes the first slice.
+    template <typename F>
+    void for_each_slice(std::size_t n, unsigned threads, F f) {
+      std::size_t want = n / par_min_bytes;
+      if (threads > want)
+        threads = unsigned(want);
+      if (threads <= 1) {
+        f(std::size_t(0), std::size_t(0), n);
+        return;
+      }
+      std::size_t slice = (n / threads + 63) & ~std::size_t(63);
+      std::vector<std::thread> workers;
+      for (std::size_t off = slice; off < n; off += slice) {
+        std::size_t len = (n - off < slice) ? n - off : slice;
+        workers.emplace_back(f, off / slice, off, len);
+      }
+      f(std::size_t(0), std::size_t(0), slice < n ? slice : n);
+      for (auto &t : workers)
+        t.join();
+    }
+
+    // True when both iterators are pointers to the same integer word type,
+    // so the range can be handled as contiguous bytes.
+    template <typename Iter, typename SrcIter>
+    struct is_word_ptr {
+      typedef typename std::remove_cv<typename std::remove_pointer<Iter>::type>::type IT;
+      typedef typename std::remove_cv<typename std::remove_pointer<SrcIter>::type>::type ST;
+      typedef std::integral_constant<bool,
+        std::is_pointer<Iter>::value && std::is_pointer<SrcIter>::value &&
+        std::is_same<IT, ST>::value && std::is_integral<IT>::value> type;
+    };
+
+    template <typename Op, typename Iter, typename SrcIter>
+    void combine(Iter bg, Iter nd, SrcIter src, unsigned, std::false_type) {
+      for (; bg != nd; ++bg, ++src)
+        *bg = Op::apply(*bg, *src);
+    }
+
+    template <typename Op, typename T>
+    void combine(T *bg, T *nd, const T *src, unsigned threads, std::true_type) {
+      assert(nd >= bg);
+      unsigned char *d = reinterpret_cast<unsigned char *>(bg);
+      const unsigned char *s = reinterpret_cast<const unsigned char *>(src);
+      for_each_slice(std::size_t(nd - bg) * sizeof(T), threads,
+                     [=](std::size_t, std::size_t off, std::size_t len) {
+                       combine_bytes<Op>(d + off, s + off, len);
+                     });
+    }
+
+    template <typename Op, typename Iter, typename SrcIter>
+    std::size_t combine_count(Iter bg, Iter nd, SrcIter src, unsigned, std::false_type) {
+      std::size_t cnt = 0;
+      for (; bg != nd; ++bg, ++src)
+        cnt += count(Op::apply(*bg, *src));
+      return cnt;
+    }
+
+    template <typename Op, typename T>
+    std::size_t combine_count(const T *bg, const T *nd, const T *src, unsigned threads,
+                              std::true_type) {
+      assert(nd >= bg);
+      const unsigned char *a = reinterpret_cast<const unsigned char *>(bg);
+      const unsigned char *b = reinterpret_cast<const unsigned char *>(src);
+      std::size_t n = std::size_t(nd - bg) * sizeof(T);
+      // One slot per possible slice, each written by one thread.
+      std::vector<std::size_t> part(n / par_min_bytes + 1, 0);
+      for_each_slice(n, threads, [&](std::size_t idx, std::size_t off, std::size_t len) {
+          part[idx] = combine_count_bytes<Op>(a + off, b + off, len);
+        });
+      std::size_t cnt = 0;
+      for (std::size_t c : part)
+        cnt += c;
+      return cnt;
+    }
+  }
+
+  // [bg, nd) &= [src, ...)
+  template <typename Iter, typename SrcIter>
+  void and_into(Iter bg, Iter nd, SrcIter src, unsigned threads = 1) {
+    detail::combine<detail::and_op>(bg, nd, src, threads,
+                                    typename detail::is_word_ptr<Iter, SrcIter>::type());
+  }
+
+  // [bg, nd) |= [src, ...)
+  template <typename Iter, typename SrcIter>
+  void or_into(Iter bg, Iter nd, SrcIter src, unsigned threads = 1) {
+    detail::combine<detail::or_op>(bg, nd, src, threads,
+                                   typename detail::is_word_ptr<Iter, SrcIter>::type());
+  }
+
+  // [bg, nd) ^= [src, ...)
+  template <typename Iter, typename SrcIter>
+  void xor_into(Iter bg, Iter nd, SrcIter src, unsigned threads = 1) {
+    detail::combine<detail::xor_op>(bg, nd, src, threads,
+                                    typename detail::is_word_ptr<Iter, SrcIter>::type());
+  }
+
+  // [bg, nd) &= ~[src, ...)
+  template <typename Iter, typename SrcIter>
+  void andnot_into(Iter bg, Iter nd, SrcIter src, unsigned threads = 1) {
+    detail::combine<detail::andnot_op>(bg, nd, src, threads,
+                                       typename detail::is_word_ptr<Iter, SrcIter>::type());
+  }
+
+  // count([bg, nd) & [src, ...))
+  template <typename Iter, typename SrcIter>
+  std::size_t and_count(Iter bg, Iter nd, SrcIter src, unsigned threads = 1) {
+    return detail::combine_count<detail::and_op>(bg, nd, src, threads,
+                                                 typename detail::is_word_ptr<Iter, SrcIter>::type());
+  }
+
+  // count([bg, nd) | [src, ...))
+  template <typename Iter, typename SrcIter>
+  std::size_t or_count(Iter bg, Iter nd, SrcIter src, unsigned threads = 1) {
+    return detail::combine_count<detail::or_op>(bg, nd, src, threads,
+                                                typename detail::is_word_ptr<Iter, SrcIter>::type());
+  }
+
+  // count([bg, nd) ^ [src, ...))
+  template <typename Iter, typename SrcIter>
+  std::size_t xor_count(Iter bg, Iter nd, SrcIter src, unsigned threads = 1) {
+    return detail::combine_count<detail::xor_op>(bg, nd, src, threads,
+                                                 typename detail::is_word_ptr<Iter, SrcIter>::type());
+  }
+
+  // count([bg, nd) & ~[src, ...))
+  template <typename Iter, typename SrcIter>
+  std::size_t andnot_count(Iter bg, Iter nd, SrcIter src, unsigned threads = 1) {
+    return detail::combine_count<detail::andnot_op>(bg, nd, src, threads,
+                                                    typename detail::is_word_ptr<Iter, SrcIter>::type());
+  }
+}
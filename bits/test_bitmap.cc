@@ -0,0 +1,131 @@
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+#include "bitmap.hh"
+
+template <typename W>
+void naive_test(std::size_t nbits) {
+  typedef bits::bitmap<W> bm_type;
+  const std::size_t npos = bm_type::npos;
+  bm_type bm(nbits);
+  std::vector<bool> ref(nbits);
+
+  assert(bm.count() == 0);
+  assert(bm.find_first_set() == npos);
+  assert(bm.find_first_clear() == (nbits ? 0 : npos));
+
+  // Sparse pattern with a dense stretch in the middle.
+  for (std::size_t i = 0; i < nbits; i += 37) {
+    bm.set(i);
+    ref[i] = true;
+  }
+  if (nbits > 300) {
+    bm.set(260, 100);
+    for (std::size_t i = 100; i <= 260; i++)
+      ref[i] = true;
+    bm.clear(200, 150);
+    for (std::size_t i = 150; i <= 200; i++)
+      ref[i] = false;
+  }
+
+  std::size_t cnt = 0;
+  for (std::size_t i = 0; i < nbits; i++) {
+    assert(bm.test(i) == ref[i]);
+    cnt += ref[i];
+  }
+  assert(bm.count() == cnt);
+
+  std::vector<std::size_t> set;
+  for (auto i : bm.set_bits())
+    set.push_back(i);
+  assert(set.size() == cnt);
+  for (std::size_t i : set)
+    assert(ref[i]);
+
+  for (std::size_t from = 0; from < nbits; from += 7) {
+    std::size_t s = npos, c = npos, l = npos;
+    for (std::size_t i = from; i < nbits; i++) {
+      if (s == npos && ref[i])
+        s = i;
+      if (c == npos && !ref[i])
+        c = i;
+    }
+    for (std::size_t i = from + 1; i-- > 0;) {
+      if (ref[i]) {
+        l = i;
+        break;
+      }
+    }
+    assert(bm.find_first_set(from) == s);
+    assert(bm.find_first_clear(from) == c);
+    assert(bm.find_last_set(from) == l);
+  }
+}
+
+int main() {
+  naive_test<unsigned char>(0);
+  naive_test<unsigned char>(13);
+  naive_test<unsigned char>(1000);
+  naive_test<unsigned short>(517);
+  naive_test<unsigned>(4096);
+  naive_test<std::uint64_t>(1);
+  naive_test<std::uint64_t>(64);
+  naive_test<std::uint64_t>(10000);
+
+  // Zero word skipping over long empty and full stretches.
+  bits::bitmap<> big(1 << 20);
+  assert(big.find_first_set() == bits::bitmap<>::npos);
+  big.set((1 << 20) - 3);
+  assert(big.find_first_set(5) == (1 << 20) - 3);
+  big.set((1 << 20) - 1, 0);
+  assert(big.count() == 1 << 20);
+  assert(big.find_first_clear() == bits::bitmap<>::npos);
+  big.clear(700000);
+  assert(big.find_first_clear(1) == 700000);
+  assert(big.all(699999, 0));
+  assert(!big.all(700000, 0));
+  assert(big.none(700000, 700000));
+  assert(big.any(700001, 700000));
+
+  // Growing with set bits keeps bits beyond size() clear.
+  bits::bitmap<unsigned char> grow(3);
+  grow.resize(11, true);
+  assert(grow.count() == 8);
+  assert(grow.data()[1] == 0x07);
+  grow.resize(5);
+  assert(grow.count() == 2);
+
+  // Free run search, as a page allocator would use it.
+  bits::bitmap<> pages(256);
+  pages.set(9, 0);
+  pages.set(20, 20);
+  pages.set(100, 30);
+  assert(pages.find_clear_run(5) == 10);
+  assert(pages.find_clear_run(10) == 10);
+  assert(pages.find_clear_run(11) == 101);
+  assert(pages.find_clear_run(9, 15) == 21);
+  assert(pages.find_clear_run(155) == 101);
+  assert(pages.find_clear_run(156) == bits::bitmap<>::npos);
+
+  // Views over words managed with alter().
+  unsigned short words[4] = { 0, 0, 0, 0 };
+  bits::alter(words[2], 4, 4, true);
+  bits::bitmap_view<unsigned short> view(words, 60);
+  assert(view.find_first_set() == 36);
+  view.set(59, 48);
+  assert(words[3] == 0x0fff);
+  assert(view.find_first_clear(48) == bits::bitmap_view<unsigned short>::npos);
+  assert(view.find_last_set() == 59);
+  // Bits past the end of the view are ignored.
+  words[3] = 0xffff;
+  assert(view.count() == 13);
+
+  const unsigned short *cwords = words;
+  bits::bitmap_view<const unsigned short> cview(cwords, 60);
+  assert(cview.find_first_set() == 36);
+  assert(cview.count() == 13);
+  return 0;
+}
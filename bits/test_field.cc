@@ -0,0 +1,130 @@
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "bitstream.hh"
+#include "field.hh"
+
+// IPv4 header fields in RFC 791 bit numbering.
+namespace ipv4 {
+  typedef bits::field<0, 4> version;
+  typedef bits::field<4, 4> ihl;
+  typedef bits::field<8, 6> dscp;
+  typedef bits::field<14, 2> ecn;
+  typedef bits::field<16, 16> total_length;
+  typedef bits::field<49, 1> dont_fragment;
+  typedef bits::field<51, 13> frag_offset;
+  typedef bits::field<64, 8> ttl;
+  typedef bits::field<96, 32> src;
+}
+
+void header_test() {
+  unsigned char pkt[20] = {
+    0x45, 0x2e, 0x05, 0xdc, 0x1c, 0x46, 0x40, 0x00, 0x40, 0x06,
+    0x00, 0x00, 0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7
+  };
+  assert(ipv4::version::get(pkt) == 4);
+  assert(ipv4::ihl::get(pkt) == 5);
+  assert(ipv4::dscp::get(pkt) == 0x0b);
+  assert(ipv4::ecn::get(pkt) == 2);
+  assert(ipv4::total_length::get(pkt) == 1500);
+  assert(ipv4::dont_fragment::get(pkt) == 1);
+  assert(ipv4::frag_offset::get(pkt) == 0);
+  assert(ipv4::ttl::get(pkt) == 64);
+  assert(ipv4::src::get(pkt) == 0xc0a80001U);
+
+  ipv4::frag_offset::set(pkt, 0x1abc);
+  assert(pkt[6] == 0x5a && pkt[7] == 0xbc);
+  assert(ipv4::dont_fragment::get(pkt) == 1);
+  ipv4::ttl::set(pkt, 0x3f);
+  assert(pkt[8] == 0x3f && pkt[9] == 0x06);
+  ipv4::ihl::set(pkt, 0xff);
+  assert(pkt[0] == 0x4f);
+
+  // A big-endian 32-bit register and a little-endian one with the same
+  // datasheet field, bits 11..4.
+  unsigned char regs[8] = { 0x12, 0x34, 0x56, 0x78, 0x78, 0x56, 0x34, 0x12 };
+  typedef bits::reg_field<0, std::uint32_t, bits::byte_order::big, 11, 4> be_fld;
+  typedef bits::reg_field<4, std::uint32_t, bits::byte_order::little, 11, 4> le_fld;
+  assert(be_fld::get(regs) == 0x67);
+  assert(le_fld::get(regs) == 0x67);
+  be_fld::set(regs, 0xab);
+  le_fld::set(regs, 0xcd);
+  assert(regs[2] == 0x5a && regs[3] == 0xb8);
+  assert(regs[4] == 0xd8 && regs[5] == 0x5c);
+}
+
+// Reference readers, one bit at a time.
+std::uint64_t ref_get(const std::vector<unsigned char> &buf, std::size_t off, unsigned width,
+                      bits::byte_order order) {
+  std::uint64_t v = 0;
+  for (unsigned i = 0; i < width; i++) {
+    std::size_t k = off + i;
+    if (order == bits::byte_order::big)
+      v = (v << 1) | ((buf[k / 8] >> (7 - k % 8)) & 1);
+    else
+      v |= std::uint64_t((buf[k / 8] >> (k % 8)) & 1) << i;
+  }
+  return v;
+}
+
+template <std::size_t Offset, unsigned Width, bits::byte_order Order>
+void field_check(std::mt19937_64 &rnd) {
+  typedef bits::field<Offset, Width, Order> fld;
+  // Exactly min_size bytes, so any over read is caught by the sanitizers.
+  std::vector<unsigned char> buf(fld::min_size);
+  for (auto &b : buf)
+    b = (unsigned char)rnd();
+  assert(fld::get(buf.data()) == ref_get(buf, Offset, Width, Order));
+
+  std::vector<unsigned char> before(buf);
+  std::uint64_t val = rnd();
+  fld::set(buf.data(), typename fld::value_type(val));
+  assert(fld::get(buf.data()) == (val & bits::make_mask<std::uint64_t>(Width - 1, 0)));
+  for (std::size_t k = 0; k < buf.size() * 8; k++) {
+    if (k >= Offset && k < Offset + Width)
+      continue;
+    assert(ref_get(buf, k, 1, Order) == ref_get(before, k, 1, Order));
+  }
+}
+
+template <unsigned Width, std::size_t... Offsets>
+void widths_check(std::mt19937_64 &rnd, std::index_sequence<Offsets...>) {
+  int dummy[] = { (field_check<Offsets, Width, bits::byte_order::big>(rnd),
+                   field_check<Offsets, Width, bits::byte_order::little>(rnd), 0)... };
+  (void)dummy;
+}
+
+void layout_test() {
+  std::mt19937_64 rnd(33);
+  for (int i = 0; i < 20; i++) {
+    widths_check<1>(rnd, std::make_index_sequence<17>());
+    widths_check<3>(rnd, std::make_index_sequence<17>());
+    widths_check<8>(rnd, std::make_index_sequence<17>());
+    widths_check<13>(rnd, std::make_index_sequence<17>());
+    widths_check<32>(rnd, std::make_index_sequence<17>());
+    widths_check<57>(rnd, std::make_index_sequence<17>());
+    widths_check<63>(rnd, std::make_index_sequence<17>());
+    widths_check<64>(rnd, std::make_index_sequence<17>());
+  }
+
+  // Little order fields share bit_writer's layout.
+  unsigned char buf[16] = {};
+  bits::bit_writer w(buf, sizeof(buf));
+  w.put(0x5, 3);
+  w.put(0x1234, 13);
+  w.put(0x1ffffffffULL, 33);
+  w.flush();
+  assert((bits::field<3, 13, bits::byte_order::little>::get(buf) == 0x1234));
+  assert((bits::field<16, 33, bits::byte_order::little>::get(buf) == 0x1ffffffffULL));
+}
+
+int main() {
+  header_test();
+  layout_test();
+  return 0;
+}
@@ -0,0 +1,159 @@
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "bits.hh"
+
+// Randomized checks of the core operations against bit by bit reference
+// implementations, for every integer type handled by as_unsigned.
+
+namespace ref {
+  template <typename T>
+  bool bit(T v, unsigned i) {
+    typedef typename bits::as_unsigned<T>::type UT;
+    return (UT(v) >> i) & 1;
+  }
+
+  template <typename T>
+  T with_bit(T v, unsigned i, bool b) {
+    typedef typename bits::as_unsigned<T>::type UT;
+    UT u(v);
+    u = b ? UT(u | (UT(1) << i)) : UT(u & ~(UT(1) << i));
+    return T(u);
+  }
+
+  template <typename T>
+  std::size_t count(T v) {
+    std::size_t n = 0;
+    for (unsigned i = 0; i < unsigned(std::numeric_limits<typename bits::as_unsigned<T>::type>::digits); i++)
+      n += bit(v, i);
+    return n;
+  }
+
+  // Empty when hi + 1 == lo.
+  template <typename T>
+  T make_mask(bits::bit_off hi, bits::bit_off lo) {
+    T m = 0;
+    for (bits::bit_off i = lo; i != bits::bit_off(hi + 1); i++)
+      m = with_bit(m, i, true);
+    return m;
+  }
+}
+
+template <typename T>
+T random_value(std::mt19937_64 &rnd) {
+  typedef typename bits::as_unsigned<T>::type UT;
+  return T(UT(rnd()));
+}
+
+template <typename T>
+void scalar_props(std::mt19937_64 &rnd) {
+  typedef typename bits::as_unsigned<T>::type UT;
+  const unsigned digits = std::numeric_limits<UT>::digits;
+
+  for (int n = 0; n < 2000; n++) {
+    T v = random_value<T>(rnd);
+    assert(bits::count(v) == ref::count(v));
+  }
+  assert(bits::count(T(0)) == 0);
+  assert(bits::count(T(~UT(0))) == digits);
+
+  // Every range, including full width and empty ones.
+  for (unsigned lo = 0; lo <= digits; lo++) {
+    for (unsigned hi = lo - 1; hi != digits; hi++) {
+      assert(bits::make_mask<UT>(hi, lo) == ref::make_mask<UT>(hi, lo));
+      if (hi + 1 == lo)
+        continue;
+      T v = random_value<T>(rnd), expect = v;
+      bool val = rnd() & 1;
+      bits::alter(v, hi, lo, val);
+      for (unsigned i = lo; i <= hi; i++)
+        expect = ref::with_bit(expect, i, val);
+      assert(v == expect);
+    }
+  }
+}
+
+template <typename ST, typename DT>
+void copy_props(std::mt19937_64 &rnd) {
+  const unsigned sd = std::numeric_limits<typename bits::as_unsigned<ST>::type>::digits;
+  const unsigned dd = std::numeric_limits<typename bits::as_unsigned<DT>::type>::digits;
+  for (int n = 0; n < 2000; n++) {
+    unsigned lo = rnd() % sd;
+    unsigned size = 1 + rnd() % (sd - lo);
+    if (size > dd)
+      size = dd;
+    unsigned off = rnd() % (dd - size + 1);
+    ST src = random_value<ST>(rnd);
+    DT dst = random_value<DT>(rnd), expect = dst;
+    bits::copy(src, bits::rng(lo + size - 1, lo), dst, off);
+    for (unsigned i = 0; i < size; i++)
+      expect = ref::with_bit(expect, off + i, ref::bit(src, lo + i));
+    assert(dst == expect);
+  }
+}
+
+template <typename ST>
+void copy_all(std::mt19937_64 &rnd) {
+  copy_props<ST, char>(rnd);
+  copy_props<ST, unsigned char>(rnd);
+  copy_props<ST, short>(rnd);
+  copy_props<ST, unsigned short>(rnd);
+  copy_props<ST, int>(rnd);
+  copy_props<ST, unsigned>(rnd);
+  copy_props<ST, long>(rnd);
+  copy_props<ST, unsigned long>(rnd);
+  copy_props<ST, long long>(rnd);
+  copy_props<ST, unsigned long long>(rnd);
+}
+
+template <typename T>
+void range_props(std::mt19937_64 &rnd) {
+  typedef typename bits::as_unsigned<T>::type UT;
+  const unsigned digits = std::numeric_limits<UT>::digits;
+  for (int n = 0; n < 500; n++) {
+    std::vector<T> v(1 + rnd() % 12);
+    std::size_t expect_cnt = 0;
+    for (auto &w : v) {
+      w = random_value<T>(rnd);
+      expect_cnt += ref::count(w);
+    }
+    assert(bits::count(v.begin(), v.end()) == expect_cnt);
+
+    // Ranges may run past the end of the words; the excess is ignored.
+    unsigned nbits = unsigned(v.size()) * digits;
+    unsigned lo = rnd() % nbits;
+    unsigned hi = lo + rnd() % (nbits - lo + digits);
+    bool val = rnd() & 1;
+    std::vector<T> expect(v);
+    for (unsigned i = lo; i <= hi && i < nbits; i++)
+      expect[i / digits] = ref::with_bit(expect[i / digits], i % digits, val);
+    bits::alter(v.begin(), v.end(), hi, lo, val);
+    assert(v == expect);
+  }
+}
+
+template <typename T>
+void all_props(std::mt19937_64 &rnd) {
+  scalar_props<T>(rnd);
+  copy_all<T>(rnd);
+  range_props<T>(rnd);
+}
+
+int main() {
+  std::mt19937_64 rnd(32);
+  all_props<char>(rnd);
+  all_props<unsigned char>(rnd);
+  all_props<short>(rnd);
+  all_props<unsigned short>(rnd);
+  all_props<int>(rnd);
+  all_props<unsigned>(rnd);
+  all_props<long>(rnd);
+  all_props<unsigned long>(rnd);
+  all_props<long long>(rnd);
+  all_props<unsigned long long>(rnd);
+  return 0;
+}
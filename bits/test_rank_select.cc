@@ -0,0 +1,72 @@
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "rank_select.hh"
+
+// Check rank and select at every position against a running count.
+void naive_test(std::size_t nbits, unsigned density, std::uint32_t seed) {
+  std::mt19937_64 rnd(seed);
+  std::vector<std::uint64_t> words((nbits + 63) / 64 + 1);
+  for (auto &w : words) {
+    w = 0;
+    for (unsigned b = 0; b < 64; b++)
+      if (rnd() % 100 < density)
+        w |= std::uint64_t(1) << b;
+  }
+  // The word past the end and the bits past nbits must be ignored.
+  words.back() = ~std::uint64_t(0);
+
+  bits::rank_select rs(words.data(), nbits);
+  std::vector<std::size_t> pos;
+  std::size_t r = 0;
+  for (std::size_t i = 0; i < nbits; i++) {
+    assert(rs.rank(i) == r);
+    assert(rs.rank0(i) == i - r);
+    if ((words[i / 64] >> (i % 64)) & 1) {
+      pos.push_back(i);
+      r++;
+    }
+  }
+  assert(rs.rank(nbits) == r);
+  assert(rs.count() == r);
+  for (std::size_t k = 0; k < pos.size(); k++)
+    assert(rs.select(k) == pos[k]);
+  assert(rs.select(pos.size()) == bits::rank_select::npos);
+}
+
+void select_in_word_test() {
+  std::mt19937_64 rnd(31);
+  for (int i = 0; i < 10000; i++) {
+    std::uint64_t w = rnd() | 1;
+    unsigned r = 0;
+    for (unsigned b = 0; b < 64; b++) {
+      if ((w >> b) & 1)
+        assert(bits::detail::select_in_word(w, r++) == b);
+    }
+  }
+}
+
+int main() {
+  select_in_word_test();
+  naive_test(0, 50, 1);
+  naive_test(1, 100, 2);
+  naive_test(63, 50, 3);
+  naive_test(2048, 100, 4);
+  naive_test(2049, 50, 5);
+  naive_test(100000, 1, 6);
+  naive_test(100000, 50, 7);
+  naive_test(100000, 99, 8);
+  naive_test(1 << 20, 0, 9);
+  naive_test(1 << 20, 3, 10);
+
+  // Directory overhead stays near 3% for large bitmaps.
+  std::vector<std::uint64_t> big(1 << 20, 0x8000000000000001ULL);
+  bits::rank_select rs(big.data(), big.size() * 64);
+  assert(rs.overhead_bytes() * 100 < big.size() * 8 * 4);
+  assert(rs.select(12345) == 12344 / 2 * 64 + 63);
+  return 0;
+}
@@ -0,0 +1,185 @@
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "roaring.hh"
+
+typedef std::set<std::uint32_t> ref_set;
+
+void check(const bits::roaring &r, const ref_set &ref) {
+  assert(r.count() == ref.size());
+  std::vector<std::uint32_t> vals;
+  r.for_each([&](std::uint32_t x) { vals.push_back(x); });
+  assert(std::vector<std::uint32_t>(ref.begin(), ref.end()) == vals);
+}
+
+// A mix of sparse values, a dense chunk and long runs.
+void fill(bits::roaring &r, ref_set &ref, std::uint32_t seed) {
+  std::mt19937 rnd(seed);
+  for (int i = 0; i < 3000; i++) {
+    std::uint32_t x = rnd() % (1u << 22);
+    r.add(x);
+    ref.insert(x);
+  }
+  std::uint32_t base = (seed % 8) << 16;
+  for (int i = 0; i < 8000; i++) {
+    std::uint32_t x = base + rnd() % 65536;
+    r.add(x);
+    ref.insert(x);
+  }
+  std::uint32_t lo = (rnd() % 64) << 16 | 1234, hi = lo + 100000;
+  r.alter(hi, lo, true);
+  for (std::uint32_t x = lo; x <= hi; x++)
+    ref.insert(x);
+}
+
+void update_test() {
+  bits::roaring r;
+  ref_set ref;
+  fill(r, ref, 1);
+  check(r, ref);
+
+  std::mt19937 rnd(30);
+  for (int i = 0; i < 20000; i++) {
+    std::uint32_t x = rnd() % (1u << 22);
+    assert(r.contains(x) == (ref.count(x) != 0));
+    assert(r.remove(x) == (ref.erase(x) != 0));
+  }
+  check(r, ref);
+
+  // Clearing most of a dense chunk turns it back into an array.
+  r.alter(0x1ffff, 0x10010, false);
+  for (auto it = ref.lower_bound(0x10010); it != ref.end() && *it <= 0x1ffff;)
+    it = ref.erase(it);
+  check(r, ref);
+  assert(r.count(0x1ffff, 0x10000) == r.count(0x1000f, 0x10000));
+
+  for (std::uint32_t lo : { 0u, 5u, 70000u, 123456u }) {
+    std::uint32_t hi = lo + rnd() % 500000;
+    std::size_t n = 0;
+    for (auto it = ref.lower_bound(lo); it != ref.end() && *it <= hi; ++it)
+      n++;
+    assert(r.count(hi, lo) == n);
+  }
+
+  r.optimize();
+  check(r, ref);
+
+  // Ranges reaching the top of the value space.
+  bits::roaring top;
+  top.alter(0xffffffff, 0xfffff000, true);
+  assert(top.count() == 0x1000 && top.contains(0xffffffff));
+  top.alter(0xffffffff, 0, false);
+  assert(top.empty());
+}
+
+template <typename F>
+ref_set ref_op(const ref_set &a, const ref_set &b, F keep) {
+  ref_set r;
+  ref_set all(a);
+  all.insert(b.begin(), b.end());
+  for (std::uint32_t x : all)
+    if (keep(a.count(x) != 0, b.count(x) != 0))
+      r.insert(x);
+  return r;
+}
+
+void algebra_test() {
+  bits::roaring a, b;
+  ref_set ra, rb;
+  fill(a, ra, 2);
+  fill(b, rb, 3);
+  b.optimize();
+
+  ref_set r_and = ref_op(ra, rb, [](bool x, bool y) { return x && y; });
+  ref_set r_or = ref_op(ra, rb, [](bool x, bool y) { return x || y; });
+  ref_set r_xor = ref_op(ra, rb, [](bool x, bool y) { return x != y; });
+  ref_set r_andnot = ref_op(ra, rb, [](bool x, bool y) { return x && !y; });
+
+  assert(and_count(a, b) == r_and.size());
+  assert(or_count(a, b) == r_or.size());
+  assert(xor_count(a, b) == r_xor.size());
+  assert(andnot_count(a, b) == r_andnot.size());
+
+  bits::roaring t(a);
+  t.and_into(b);
+  check(t, r_and);
+  t = a;
+  t.or_into(b);
+  check(t, r_or);
+  t = a;
+  t.xor_into(b);
+  check(t, r_xor);
+  t = a;
+  t.andnot_into(b);
+  check(t, r_andnot);
+  t = b;
+  t.andnot_into(a);
+  check(t, ref_op(ra, rb, [](bool x, bool y) { return y && !x; }));
+  t = b;
+  t.or_into(a);
+  assert(t == a || !(ra == rb));
+}
+
+void serialize_test() {
+  bits::roaring r;
+  ref_set ref;
+  fill(r, ref, 4);
+  r.optimize();
+
+  std::vector<unsigned char> buf(r.serialized_size());
+  r.serialize(buf.data());
+  bits::roaring_view view(buf.data(), buf.size());
+  assert(view.valid());
+  assert(view.count() == ref.size());
+  std::mt19937 rnd(31);
+  for (int i = 0; i < 100000; i++) {
+    std::uint32_t x = rnd() % (1u << 22);
+    assert(view.contains(x) == (ref.count(x) != 0));
+  }
+  for (std::uint32_t x : ref)
+    assert(view.contains(x));
+  check(view.to_roaring(), ref);
+
+  assert(!bits::roaring_view(buf.data(), buf.size() - 1).valid());
+
+  // A bad descriptor after good ones leaves the whole view empty.
+  std::size_t last = bits::roaring::header_size + bits::roaring::desc_size * (view.chunk_count() - 1);
+  std::vector<unsigned char> bad(buf);
+  bad[last + 8] = 0xff;
+  bad[last + 11] = 0xff;
+  bits::roaring_view broken(bad.data(), bad.size());
+  assert(!broken.valid());
+  assert(broken.chunk_count() == 0 && broken.count() == 0);
+  for (std::uint32_t x : ref)
+    assert(!broken.contains(x));
+  assert(broken.to_roaring().empty());
+  bad.resize(last + 4);
+  assert(!bits::roaring_view(bad.data(), bad.size()).valid());
+
+  buf[0] ^= 1;
+  assert(!bits::roaring_view(buf.data(), buf.size()).valid());
+}
+
+// Dense and sparse data both compress well against a flat bitmap.
+void size_test() {
+  bits::roaring dense, sparse;
+  dense.alter(100000000, 1000, true);
+  for (std::uint32_t x = 0; x < 100000000; x += 10007)
+    sparse.add(x);
+  std::size_t flat = 100000000 / 8;
+  assert(dense.memory_size() * 1000 < flat);
+  assert(sparse.memory_size() * 10 < flat);
+}
+
+int main() {
+  update_test();
+  algebra_test();
+  serialize_test();
+  size_test();
+  return 0;
+}
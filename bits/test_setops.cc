@@ -0,0 +1,79 @@
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <random>
+#include <vector>
+
+#include "setops.hh"
+
+template <typename T>
+std::vector<T> random_words(std::size_t n, std::mt19937_64 &rnd) {
+  std::vector<T> v(n);
+  for (auto &w : v)
+    w = T(rnd());
+  return v;
+}
+
+// Compare every operation against a plain word loop.
+template <typename T>
+void ops_test(std::size_t n, unsigned threads) {
+  std::mt19937_64 rnd(n);
+  std::vector<T> a = random_words<T>(n, rnd), b = random_words<T>(n, rnd);
+  std::vector<T> r_and(a), r_or(a), r_xor(a), r_andnot(a);
+  std::size_t c_and = 0, c_or = 0, c_xor = 0, c_andnot = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    r_and[i] = T(a[i] & b[i]);
+    r_or[i] = T(a[i] | b[i]);
+    r_xor[i] = T(a[i] ^ b[i]);
+    r_andnot[i] = T(a[i] & ~b[i]);
+    c_and += bits::count(r_and[i]);
+    c_or += bits::count(r_or[i]);
+    c_xor += bits::count(r_xor[i]);
+    c_andnot += bits::count(r_andnot[i]);
+  }
+
+  const T *pa = a.data(), *pb = b.data();
+  assert(bits::and_count(pa, pa + n, pb, threads) == c_and);
+  assert(bits::or_count(pa, pa + n, pb, threads) == c_or);
+  assert(bits::xor_count(pa, pa + n, pb, threads) == c_xor);
+  assert(bits::andnot_count(pa, pa + n, pb, threads) == c_andnot);
+
+  std::vector<T> d(a);
+  bits::and_into(d.data(), d.data() + n, pb, threads);
+  assert(d == r_and);
+  d = a;
+  bits::or_into(d.data(), d.data() + n, b.data(), threads);
+  assert(d == r_or);
+  d = a;
+  bits::xor_into(d.data(), d.data() + n, pb, threads);
+  assert(d == r_xor);
+  d = a;
+  bits::andnot_into(d.data(), d.data() + n, pb, threads);
+  assert(d == r_andnot);
+
+  // Non-pointer iterators take the word loop.
+  d = a;
+  bits::and_into(d.begin(), d.end(), b.begin());
+  assert(d == r_and);
+  assert(bits::and_count(a.begin(), a.end(), b.begin()) == c_and);
+}
+
+int main() {
+  for (std::size_t n : { 0, 1, 3, 31, 32, 33, 1000 }) {
+    ops_test<unsigned char>(n, 1);
+    ops_test<unsigned short>(n, 1);
+    ops_test<std::uint32_t>(n, 1);
+    ops_test<std::uint64_t>(n, 1);
+  }
+  ops_test<char>(517, 1);
+
+  // Large enough to be split across threads, with a ragged tail.
+  ops_test<std::uint64_t>((5 << 20) / 8 + 3, 4);
+  ops_test<unsigned char>((3 << 20) + 7, 8);
+
+  std::list<unsigned> la = { 0xf0f0, 0xffff }, lb = { 0xff00, 0x0f0f };
+  assert(bits::and_count(la.begin(), la.end(), lb.begin()) == 12);
+  return 0;
+}
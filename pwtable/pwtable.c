@@ -2,126 +2,698 @@
 /*
  * Generate a password tabula recta as describe by John
  * Graham-Cumming.
- * 
+ *
  * http://blog.jgc.org/2010/12/write-your-passwords-down.html
  */
 
-#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <termios.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-char hex(int i) 
+#define TBL_DIM 26
+#define TBL_SIZE (TBL_DIM * TBL_DIM)
+
+/*
+ * A data file is an archive of tables, each stored as a TBL_HEADER_SIZE
+ * byte header, rows * cols characters row by row and a 32 bit checksum,
+ * FNV-1a over the header and characters. Numbers are little endian:
+ *
+ *   0  magic           4  version     5  alphabet id
+ *   6  rows (16 bit)   8  cols (16 bit)   10  zero (16 bit)
+ *
+ * Files from before the header are a run of TBL_SIZE byte tables of
+ * printable characters and are still read.
+ */
+#define TBL_MAGIC "\x89PWT"
+#define TBL_VERSION 1
+#define TBL_HEADER_SIZE 12
+#define TBL_CHECKSUM_SIZE 4
+
+/* Character sets a table can be drawn from. The index is the id stored
+ * in the file, so new sets go at the end. */
+struct alphabet {
+    const char *name;
+    const char *chars;
+};
+
+#define PRINTABLE " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ" \
+    "[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~"
+
+static const struct alphabet alphabets[] = {
+    { "print", PRINTABLE },
+    { "graph", PRINTABLE + 1 },
+    { "alnum", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz" },
+    { "alpha", "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz" },
+    { "lower", "abcdefghijklmnopqrstuvwxyz" },
+    { "digit", "0123456789" },
+};
+
+#define ALPHABET_COUNT (sizeof(alphabets) / sizeof(alphabets[0]))
+
+/* A table in a mapped data file. */
+struct table {
+    int rows;
+    int cols;
+    int alphabet;
+    const char *cells;
+};
+
+/* Directions a walk through a table can take, as row and column steps. */
+struct direction {
+    const char *name;
+    int dr;
+    int dc;
+};
+
+static const struct direction directions[] = {
+    { "n", -1, 0 }, { "ne", -1, 1 }, { "e", 0, 1 }, { "se", 1, 1 },
+    { "s", 1, 0 }, { "sw", 1, -1 }, { "w", 0, -1 }, { "nw", -1, -1 },
+};
+
+#define DIRECTION_COUNT (sizeof(directions) / sizeof(directions[0]))
+
+/* Longest string a walk derives. */
+#define WALK_MAX 4096
+
+/* Bytes generated and written at a time. */
+#define BATCH 65536
+
+/* Each random word yields as many characters as fit below this bound, so
+ * a word is rejected with probability below 2^-24. */
+#define DIGITS_MAX (1ULL << 40)
+
+/* Printed tables are gathered into RENDER_BUF bytes and up to IOV_BATCH
+ * pieces before each writev(). */
+#define RENDER_BUF (1024 * 1024)
+#define IOV_BATCH 1024
+
+char hex(int i)
 {
     static char hexdigits[] = "0123456789ABCDEF";
     return hexdigits[i % 16];
 }
 
-int main(int argc, char **argv)
+void put16(unsigned char *p, unsigned v)
 {
-#define TBL_DIM 26
-#define TBL_SIZE (TBL_DIM * TBL_DIM)
-    
-    char table[TBL_SIZE] = {};
-    int i;
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+void put32(unsigned char *p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+unsigned get16(const unsigned char *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+uint32_t get32(const unsigned char *p)
+{
+    return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+uint32_t fnv1a(uint32_t h, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    while (len-- > 0)
+        h = (h ^ *p++) * 16777619;
+    return h;
+}
+
+#define FNV_INIT 2166136261u
+
+void fill_random(void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t rc = getrandom(p, len, 0);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0) {
+            perror("getrandom");
+            exit(EXIT_FAILURE);
+        }
+        p += rc;
+        len -= rc;
+    }
+}
+
+/*
+ * Fill out with len characters of chars, each equally likely. Random
+ * words are taken as a number below n^k, with k as large as DIGITS_MAX
+ * allows, by the multiply and shift of Lemire's method, and that number is
+ * written in base n as k characters. Only the rare word landing in the
+ * uneven remainder is thrown away.
+ */
+void generate(char *out, size_t len, const char *chars)
+{
+    static uint64_t pool[BATCH / 8];
+    static size_t pool_pos = BATCH / 8;
+    static const char *last;
+    static uint64_t n, range, digits;
+    static int per_word, left;
+    size_t i;
+
+    if (chars != last) {
+        last = chars;
+        n = strlen(chars);
+        per_word = 0;
+        left = 0;
+        for (range = 1; range * n <= DIGITS_MAX; range *= n)
+            per_word++;
+    }
+    for (i = 0; i < len; i++) {
+        while (left == 0) {
+            unsigned __int128 m;
+
+            if (pool_pos == BATCH / 8) {
+                fill_random(pool, sizeof(pool));
+                pool_pos = 0;
+            }
+            m = (unsigned __int128)pool[pool_pos++] * range;
+            if ((uint64_t)m < -range % range)
+                continue;
+            digits = m >> 64;
+            left = per_word;
+        }
+        out[i] = chars[digits % n];
+        digits /= n;
+        left--;
+    }
+}
+
+int write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t rc = write(fd, p, len);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        p += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+/* Write count tables of rows by cols characters from alphabet to
+ * datfile, or standard output for "-". */
+void write_tables(const char *datfile, unsigned long count, int rows, int cols, int alphabet)
+{
+    static char batch[BATCH];
+    unsigned char header[TBL_HEADER_SIZE], sum[TBL_CHECKSUM_SIZE];
+    unsigned long t;
     int fd;
-    ssize_t rc;
-    char *datfile = "pwtable.dat";
-    static char bubble[] = ".oO";
-
-    if (argc == 1) {
-	fd = open("/dev/random", O_RDONLY);
-	if (fd < 0) {
-	    perror("/dev/random");
-	    exit(EXIT_FAILURE);
-	}
-	printf("Generating tabula recta data. This can take several minutes. |");
-	i = 0;
-	while (i < TBL_DIM * TBL_DIM) {        
-	    char c;
-	    rc = read(fd, &c, 1);
-	    if (rc == 1) {
-		if (isprint(c)) {
-                    putchar(0x8);
-                    putchar(bubble[i % 3]);
-                    fflush(stdout);
-		    table[i++] = c;
-		}
-	    } else if (rc < 0) {
-		perror("reading from /dev/random");
-		exit(EXIT_FAILURE);
-	    } else {
-		perror("failed to read from /dev/random");
-	    }
-	}
-	rc = close(fd);
-	if (rc < 0) {
-	    perror("closing /dev/random");
-	    exit(EXIT_FAILURE);
-	}
-	puts("done");
-
-	fd = open(datfile, O_WRONLY|O_CREAT, 0644);
-	if (fd < 0) {
-	    perror(datfile);
-	    exit(EXIT_FAILURE);
-	}
-	rc = write(fd, table, TBL_SIZE);
-	if (rc != TBL_DIM * TBL_DIM) {
-	    perror("writing pwtable.dat");
-	    exit(EXIT_FAILURE);
-	}
-	close(fd);
-    } else if (argc == 2) {
-        datfile = argv[1];
+
+    if (strcmp(datfile, "-") == 0) {
+        fd = STDOUT_FILENO;
     } else {
+        fd = open(datfile, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if (fd < 0) {
+            perror(datfile);
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(header, TBL_MAGIC, 4);
+    header[4] = TBL_VERSION;
+    header[5] = alphabet;
+    put16(header + 6, rows);
+    put16(header + 8, cols);
+    put16(header + 10, 0);
+    for (t = 0; t < count; t++) {
+        uint64_t left = (uint64_t)rows * cols;
+        uint32_t h = fnv1a(FNV_INIT, header, sizeof(header));
+
+        if (write_full(fd, header, sizeof(header)) < 0)
+            goto fail;
+        while (left > 0) {
+            size_t n = left < BATCH ? left : BATCH;
+            generate(batch, n, alphabets[alphabet].chars);
+            h = fnv1a(h, batch, n);
+            if (write_full(fd, batch, n) < 0)
+                goto fail;
+            left -= n;
+        }
+        put32(sum, h);
+        if (write_full(fd, sum, sizeof(sum)) < 0)
+            goto fail;
+    }
+    if (fd != STDOUT_FILENO && close(fd) < 0)
+        goto fail;
+    return;
+
+fail:
+    perror(datfile);
+    exit(EXIT_FAILURE);
+}
+
+/* Map datfile, which stays mapped until exit. */
+const unsigned char *map_tables(const char *datfile, size_t *size)
+{
+    struct stat info;
+    void *map;
+    int fd;
+
+    fd = open(datfile, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        perror(datfile);
+        exit(EXIT_FAILURE);
+    }
+    if (info.st_size == 0) {
+        fprintf(stderr, "%s: no tables\n", datfile);
+        exit(EXIT_FAILURE);
+    }
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror(datfile);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    *size = info.st_size;
+    return map;
+}
+
+/*
+ * Find the table at *pos in the size byte file at map and move *pos past
+ * it. Returns 0 at the end of the file and exits on a damaged table.
+ */
+int next_table(const char *datfile, const unsigned char *map, size_t size, size_t *pos,
+               struct table *t)
+{
+    const unsigned char *p = map + *pos;
+    size_t cells;
+
+    if (*pos == size)
+        return 0;
+    if (memcmp(map, TBL_MAGIC, 4) != 0) {
+        if (size - *pos < TBL_SIZE)
+            goto damaged;
+        t->rows = TBL_DIM;
+        t->cols = TBL_DIM;
+        t->alphabet = 0;
+        t->cells = (const char *)p;
+        *pos += TBL_SIZE;
+        return 1;
+    }
+    if (size - *pos < TBL_HEADER_SIZE + TBL_CHECKSUM_SIZE || memcmp(p, TBL_MAGIC, 4) != 0)
+        goto damaged;
+    if (p[4] != TBL_VERSION) {
+        fprintf(stderr, "%s: table version %d, expected %d\n", datfile, p[4], TBL_VERSION);
+        exit(EXIT_FAILURE);
+    }
+    t->alphabet = p[5];
+    t->rows = get16(p + 6);
+    t->cols = get16(p + 8);
+    cells = (size_t)t->rows * t->cols;
+    if (t->alphabet >= (int)ALPHABET_COUNT || cells == 0 ||
+        size - *pos - TBL_HEADER_SIZE - TBL_CHECKSUM_SIZE < cells)
+        goto damaged;
+    t->cells = (const char *)p + TBL_HEADER_SIZE;
+    if (fnv1a(FNV_INIT, p, TBL_HEADER_SIZE + cells) != get32(p + TBL_HEADER_SIZE + cells))
+        goto damaged;
+    *pos += TBL_HEADER_SIZE + cells + TBL_CHECKSUM_SIZE;
+    return 1;
+
+damaged:
+    fprintf(stderr, "%s: damaged table at offset %zu\n", datfile, *pos);
+    exit(EXIT_FAILURE);
+}
+
+/* Output gathered for writev(): pieces of buf and of longer lived
+ * memory, in order. */
+struct render {
+    struct iovec iov[IOV_BATCH];
+    int iovcnt;
+    char *buf;
+    size_t used;
+};
+
+void render_init(struct render *r)
+{
+    r->iovcnt = 0;
+    r->used = 0;
+    r->buf = malloc(RENDER_BUF);
+    if (r->buf == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void render_flush(struct render *r)
+{
+    struct iovec *iov = r->iov;
+    int iovcnt = r->iovcnt;
+
+    while (iovcnt > 0) {
+        ssize_t rc = writev(STDOUT_FILENO, iov, iovcnt);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0) {
+            perror("writing tables");
+            exit(EXIT_FAILURE);
+        }
+        while (iovcnt > 0 && (size_t)rc >= iov->iov_len) {
+            rc -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + rc;
+            iov->iov_len -= rc;
+        }
+    }
+    r->iovcnt = 0;
+    r->used = 0;
+}
+
+/* Queue len bytes at p, which must stay put until the next flush. */
+void render_add(struct render *r, const char *p, size_t len)
+{
+    struct iovec *last = r->iovcnt ? &r->iov[r->iovcnt - 1] : NULL;
+
+    if (last && (char *)last->iov_base + last->iov_len == p) {
+        last->iov_len += len;
+        return;
+    }
+    if (r->iovcnt == IOV_BATCH)
+        render_flush(r);
+    r->iov[r->iovcnt].iov_base = (void *)p;
+    r->iov[r->iovcnt].iov_len = len;
+    r->iovcnt++;
+}
+
+/* Room for len bytes in the buffer, queued once written. */
+char *render_room(struct render *r, size_t len)
+{
+    if (r->used + len > RENDER_BUF || r->iovcnt == IOV_BATCH)
+        render_flush(r);
+    return r->buf + r->used;
+}
+
+void render_commit(struct render *r, size_t len)
+{
+    render_add(r, r->buf + r->used, len);
+    r->used += len;
+}
+
+/* Column labels for a table cols wide: a hex digit counting to 12 and a
+ * letter, repeating past 26 columns, then the rule under them. */
+size_t render_labels(char *p, int cols)
+{
+    char *start = p;
+    int i;
+
+    *p++ = ' ';
+    *p++ = ' ';
+    *p++ = ' ';
+    *p++ = ' ';
+    for (i = 0; i < cols; i++) {
+        *p++ = hex(i % 13);
+        *p++ = ' ';
+    }
+    *p++ = '\n';
+    *p++ = ' ';
+    *p++ = ' ';
+    *p++ = ' ';
+    *p++ = ' ';
+    for (i = 0; i < cols; i++) {
+        *p++ = 'A' + i % 26;
+        *p++ = ' ';
+    }
+    *p++ = '\n';
+    *p++ = ' ';
+    *p++ = ' ';
+    *p++ = ' ';
+    *p++ = '+';
+    for (i = 0; i < 2 * cols - 1; i++)
+        *p++ = '-';
+    return p - start;
+}
+
+/* Print every table in datfile, separated by blank lines. */
+void print_tables(const char *datfile)
+{
+    const unsigned char *map;
+    struct render r;
+    struct table t;
+    char *labels = NULL;
+    size_t size, pos = 0, labels_len = 0;
+    int cols = 0, tables = 0, i, j;
+
+    map = map_tables(datfile, &size);
+    render_init(&r);
+    labels = malloc(13 + 6 * 65535);
+    if (labels == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    while (next_table(datfile, map, size, &pos, &t)) {
+        if (t.cols != cols) {
+            render_flush(&r);
+            cols = t.cols;
+            labels_len = render_labels(labels, cols);
+        }
+        if (tables++ > 0)
+            render_add(&r, "\n", 1);
+        render_add(&r, labels, labels_len);
+        for (i = 0; i < t.rows; i++) {
+            const char *cell = t.cells + (size_t)i * t.cols;
+            char *p = render_room(&r, 5 + 2 * t.cols), *start = p;
+
+            *p++ = '\n';
+            *p++ = hex(i % 13);
+            *p++ = ' ';
+            *p++ = 'A' + i % 26;
+            *p++ = '|';
+            for (j = 0; j < t.cols; j++) {
+                *p++ = cell[j];
+                *p++ = ' ';
+            }
+            render_commit(&r, p - start);
+        }
+        render_add(&r, "\n", 1);
+    }
+    render_flush(&r);
+    free(labels);
+    free(r.buf);
+}
+
+/* Row or column coordinate: a number from 0 or, for the first 26, the
+ * letter labelling it. */
+int parse_coord(const char *s, int limit, int *v)
+{
+    char *end;
+    long n;
+
+    if (s[0] >= 'A' && s[0] <= 'Z' && s[1] == 0) {
+        n = s[0] - 'A';
+    } else {
+        n = strtol(s, &end, 10);
+        if (end == s || *end != 0)
+            return -1;
+    }
+    if (n < 0 || n >= limit)
+        return -1;
+    *v = n;
+    return 0;
+}
+
+/*
+ * Derive a string for each walk read from standard input, a line of
+ *
+ *   [table] row col direction length
+ *
+ * starting at row and col of the table, the first if not given, and
+ * stepping in direction n, ne, e, se, s, sw, w or nw, wrapping at the
+ * edges. Each string is printed on its own line; a line that does not
+ * parse prints an empty one and makes the exit status non-zero.
+ */
+int lookup_tables(const char *datfile)
+{
+    const unsigned char *map;
+    struct table *tables = NULL;
+    struct render r;
+    size_t size, pos = 0, count = 0, alloc = 0, line_size = 0;
+    unsigned long lineno = 0;
+    char *line = NULL;
+    int status = EXIT_SUCCESS;
+
+    map = map_tables(datfile, &size);
+    for (;;) {
+        if (count == alloc) {
+            alloc = alloc ? 2 * alloc : 64;
+            tables = realloc(tables, alloc * sizeof(*tables));
+            if (tables == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (!next_table(datfile, map, size, &pos, &tables[count]))
+            break;
+        count++;
+    }
+    render_init(&r);
+
+    while (getline(&line, &line_size, stdin) > 0) {
+        char *field[5], *save = NULL, *end = "", *out;
+        const struct table *t;
+        const struct direction *d = NULL;
+        int fields = 0, row, col, i;
+        unsigned long index = 0;
+        long len;
+        unsigned k;
+
+        lineno++;
+        for (out = strtok_r(line, " \t\r\n", &save); out != NULL;
+             out = strtok_r(NULL, " \t\r\n", &save)) {
+            if (fields == 5)
+                goto bad;
+            field[fields++] = out;
+        }
+        if (fields == 5)
+            index = strtoul(field[0], &end, 10);
+        if (fields < 4 || *end != 0 || index >= count)
+            goto bad;
+        t = &tables[index];
+        if (parse_coord(field[fields - 4], t->rows, &row) < 0 ||
+            parse_coord(field[fields - 3], t->cols, &col) < 0)
+            goto bad;
+        for (k = 0; k < DIRECTION_COUNT; k++) {
+            if (strcmp(directions[k].name, field[fields - 2]) == 0)
+                d = &directions[k];
+        }
+        len = strtol(field[fields - 1], &end, 10);
+        if (d == NULL || *end != 0 || len < 1 || len > WALK_MAX)
+            goto bad;
+
+        out = render_room(&r, len + 1);
+        for (i = 0; i < len; i++) {
+            out[i] = t->cells[(size_t)row * t->cols + col];
+            row = (row + d->dr + t->rows) % t->rows;
+            col = (col + d->dc + t->cols) % t->cols;
+        }
+        out[len] = '\n';
+        render_commit(&r, len + 1);
+        continue;
+
+bad:
+        fprintf(stderr, "line %lu: invalid walk\n", lineno);
+        render_add(&r, "\n", 1);
+        status = EXIT_FAILURE;
+    }
+    render_flush(&r);
+    free(line);
+    free(r.buf);
+    free(tables);
+    return status;
+}
+
+int find_alphabet(const char *name)
+{
+    unsigned i;
+
+    for (i = 0; i < ALPHABET_COUNT; i++) {
+        if (strcmp(alphabets[i].name, name) == 0)
+            return i;
+    }
+    fprintf(stderr, "unknown alphabet %s\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int parse_dim(const char *arg)
+{
+    char *end;
+    long v = strtol(arg, &end, 10);
+
+    if (*end != 0 || v < 1 || v > 65535) {
+        fprintf(stderr, "invalid table dimension %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    return v;
+}
+
+int main(int argc, char **argv)
+{
+    int opt, rows = TBL_DIM, cols = TBL_DIM, alphabet = 0, lookup = 0;
+    unsigned long count = 0;
+    char *datfile = "pwtable.dat", *end;
+
+    while ((opt = getopt(argc, argv, "a:c:ln:r:")) != -1) {
+        switch (opt) {
+        case 'a':
+            alphabet = find_alphabet(optarg);
+            break;
+        case 'c':
+            cols = parse_dim(optarg);
+            break;
+        case 'l':
+            lookup = 1;
+            break;
+        case 'n':
+            count = strtoul(optarg, &end, 10);
+            if (*end != 0 || count == 0) {
+                fprintf(stderr, "invalid table count %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'r':
+            rows = parse_dim(optarg);
+            break;
+        default:
+            argc = -1;
+        }
+    }
+
+    if (argc - optind == 1) {
+        datfile = argv[optind];
+    } else if (argc != optind || lookup) {
         puts("\n"
-             "Usage: pwtable [datfile]\n"
+             "Usage: pwtable [-n count] [-r rows] [-c cols] [-a alphabet] [datfile]\n"
+             "       pwtable -l datfile < walks\n"
              "\n"
              "If no datfile is specified then one will be generated\n"
              "and stored in pwtable.dat.\n"
              "A tabula recta will then be printed out in ASCII.\n"
              "\n"
+             "With -n, count tables are generated into datfile, or\n"
+             "standard output if it is -, and none are printed.\n"
+             "Tables are 26 by 26 unless -r and -c say otherwise, and\n"
+             "drawn from the alphabet print, graph, alnum, alpha, lower\n"
+             "or digit, default print.\n"
+             "\n"
+             "With -l, each line of standard input, [table] row col\n"
+             "direction length, is a walk through a table of datfile\n"
+             "and the characters it passes are printed. row and col\n"
+             "count from 0 or are letters, direction is n, ne, e, se,\n"
+             "s, sw, w or nw and the walk wraps at the edges.\n"
+             "\n"
              "http://blog.jgc.org/2010/12/write-your-passwords-down.html\n");
         exit(EXIT_FAILURE);
-    }        
-
-    fd = open(datfile, O_RDONLY);
-    if (fd < 0) {
-	perror(datfile);
-	exit(EXIT_FAILURE);
-    }
-    rc = read(fd, table, TBL_SIZE);
-    if (rc != TBL_SIZE) {
-	perror("reading pwtable.dat");
-	exit(EXIT_FAILURE);
     }
-    close(fd);
-    
-    printf("    ");
-    for (i = 0; i < 26; i++) {
-        putchar(hex(i % 13));
-        putchar(' ');
-    }
-    printf("\n    ");
-    for (i = 0; i < 26; i++) {
-        putchar('A' + i);
-        putchar(' ');
-    }
-    printf("\n   +---------------------------------------------------");
-    for (i = 0; i < TBL_DIM * TBL_DIM; i++) {
-        if (i % 26 == 0) {
-            putchar('\n');
-            putchar(hex((i / 26) % 13));
-            putchar(' ');
-            putchar('A' + (i / 26));
-            putchar('|');            
-        }
-        putchar(table[i]);
-        putchar(' ');
+
+    if (lookup)
+        exit(lookup_tables(datfile));
+    if (count > 0) {
+        write_tables(datfile, count, rows, cols, alphabet);
+        exit(EXIT_SUCCESS);
     }
-    putchar('\n');
+    if (argc == optind)
+        write_tables(datfile, 1, rows, cols, alphabet);
+    print_tables(datfile);
     exit(EXIT_SUCCESS);
 }